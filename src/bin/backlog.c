@@ -1,7 +1,107 @@
 #include "private.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <Elementary.h>
 #include "termpty.h"
 #include "backlog.h"
+#if defined(BINARY_TYTEST)
+#include "unit_tests.h"
+#endif
+
+/* Backlog lines are packed: their codepoints take as many bytes as the
+ * largest of them needs, and are followed by the runs of cells sharing the
+ * same attributes.
+ *
+ * Lines far enough from the screen not to change anymore are compressed
+ * further. They then start with a Termsavecomp header, followed by the
+ * distinct attributes of the line and by its cells, each one encoded as:
+ *  - 0x00 to 0x7f: that codepoint with the current attribute,
+ *  - COMP_ATT then 1 byte: index of the attribute of the next cells, the
+ *    first one being current at start,
+ *  - COMP_CP16 then 2 bytes: a codepoint from the BMP,
+ *  - COMP_CP32 then 4 bytes: any other codepoint,
+ *  - COMP_REPEAT | n: n + 1 more copies of the previous cell.
+ */
+typedef struct _Termsavepacked
+{
+   unsigned int   size; // in bytes, header included
+   unsigned int   runs : 30;
+   unsigned int   cp_shift : 2; // codepoints take 1 << cp_shift bytes
+} Termsavepacked;
+
+typedef struct _Termsaverun
+{
+   Termatt        att;
+   unsigned int   len;
+} Termsaverun;
+
+#define COMP_ATT         0x80
+#define COMP_CP16        0x81
+#define COMP_CP32        0x82
+#define COMP_REPEAT      0xc0
+#define COMP_REPEAT_MAX  64
+#define COMP_ATTS_MAX    256
+/* worst case: an attribute change then a 32 bits codepoint */
+#define COMP_CELL_MAX    7
+
+#define TS_PACKED(_ts) ((Termsavepacked *)(_ts)->data)
+#define TS_COMP(_ts) ((Termsavecomp *)(_ts)->data)
+
+/* Chunks are aligned on their size to find them back from their blocks */
+#define SLAB_CHUNK_SIZE  (64 * 1024)
+#define SLAB_ALIGN       16
+#define SLAB_BLOCK_MAX   (BACKLOG_SLAB_CLASSES * SLAB_ALIGN)
+
+struct _Termsave_Slab_Chunk
+{
+   Termsave_Slab_Chunk *prev, *next; /* in the partial list of its class */
+   void *free; /* blocks given back, linked through their first bytes */
+   unsigned int cls;
+   unsigned int used; /* blocks given out */
+   unsigned int carved; /* blocks taken from the end of the chunk so far */
+   unsigned int blocks; /* room for that many blocks */
+};
+
+#define SLAB_HEADER_SIZE \
+   ((sizeof(Termsave_Slab_Chunk) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+/* Lines moved to disk are appended to the current segment, in memory, and
+ * the segment is written to the file once full. Other segments are mapped
+ * back when their lines are read. A line on disk has its data hold
+ * ((segment << DISK_OFFSET_BITS) | offset / DISK_ALIGN) + 1 */
+#define DISK_SEGMENT_SIZE  (1024 * 1024)
+#define DISK_ALIGN         16
+#define DISK_OFFSET_BITS   16
+#define DISK_LINE_MAX      (DISK_SEGMENT_SIZE / 16)
+#define DISK_ATTS_MAX      1024 /* distinct attributes of a segment */
+#define DISK_ATTS_HASH     (DISK_ATTS_MAX * 2)
+#define DISK_MAPS          8
+#define DISK_SEGMENTS_MAX  65535 /* what fits in 32 bits of data */
+
+typedef struct _Termsave_Segment
+{
+   Termatt       *atts; /* distinct attributes of its lines */
+   unsigned int   nb_atts;
+   unsigned int   lines; /* still on disk */
+   void          *map;
+} Termsave_Segment;
+
+struct _Termsave_Disk
+{
+   int fd;
+   Eina_Bool failed; /* to write, lines on disk can still be read */
+   Termsave_Segment *segments;
+   unsigned int nb_segments;
+   unsigned int cur; /* segment being filled */
+   unsigned char *buf; /* its content */
+   size_t len;
+   uint16_t atts_hash[DISK_ATTS_HASH]; /* its attributes, by index + 1 */
+   unsigned int maps[DISK_MAPS]; /* segments mapped, oldest first */
+   unsigned int nb_maps;
+};
 
 
 static int ts_comp = 0;
@@ -9,104 +109,1709 @@ static int ts_uncomp = 0;
 static int ts_freeops = 0;
 static Eina_List *ptys = NULL;
 
-static int64_t _mem_used = 0;
+static int64_t _mem_used = 0;
+/* part of it evicting lines does not free: the rings of slots, the
+ * indexes and the disk buffers */
+static int64_t _mem_fixed = 0;
+static uint64_t _lines_evicted = 0;
+
+static void
+_accounting_change(int64_t diff)
+{
+   if (diff > 0)
+     {
+        diff = ((diff + 16-1) / 16) * 16;
+     }
+   else
+     {
+        diff = ((-1 * diff + 16-1) / 16) * -16;
+     }
+   _mem_used += diff;
+}
+
+static void
+_accounting_fixed_change(int64_t diff)
+{
+   int64_t used = _mem_used;
+
+   _accounting_change(diff);
+   _mem_fixed += _mem_used - used;
+}
+
+/* What evicting lines can bring the memory used down by */
+static inline int64_t
+_mem_lines(void)
+{
+   return _mem_used - _mem_fixed;
+}
+
+int64_t
+termpty_backlog_memory_get(void)
+{
+   return _mem_used;
+}
+
+uint64_t
+termpty_backlog_evicted_get(void)
+{
+   return _lines_evicted;
+}
+
+
+void
+termpty_save_register(Termpty *ty)
+{
+   termpty_backlog_lock();
+   ptys = eina_list_append(ptys, ty);
+   termpty_backlog_unlock();
+}
+
+void
+termpty_save_unregister(Termpty *ty)
+{
+   termpty_backlog_lock();
+   ptys = eina_list_remove(ptys, ty);
+   termpty_backlog_unlock();
+}
+
+/* {{{ Slab */
+
+static inline unsigned int
+_slab_class(size_t size)
+{
+   return (size + SLAB_ALIGN - 1) / SLAB_ALIGN - 1;
+}
+
+static inline Termsave_Slab_Chunk *
+_slab_chunk(const void *block)
+{
+   return (Termsave_Slab_Chunk *)
+      ((uintptr_t)block & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+}
+
+static void
+_slab_partial_add(Termsave_Slab *slab, Termsave_Slab_Chunk *chunk)
+{
+   chunk->prev = NULL;
+   chunk->next = slab->partial[chunk->cls];
+   if (chunk->next)
+     chunk->next->prev = chunk;
+   slab->partial[chunk->cls] = chunk;
+}
+
+static void
+_slab_partial_del(Termsave_Slab *slab, Termsave_Slab_Chunk *chunk)
+{
+   if (chunk->prev)
+     chunk->prev->next = chunk->next;
+   else
+     slab->partial[chunk->cls] = chunk->next;
+   if (chunk->next)
+     chunk->next->prev = chunk->prev;
+   chunk->prev = chunk->next = NULL;
+}
+
+static inline Eina_Bool
+_slab_chunk_full(const Termsave_Slab_Chunk *chunk)
+{
+   return (!chunk->free) && (chunk->carved == chunk->blocks);
+}
+
+static void *
+_slab_alloc(Termpty *ty, size_t size)
+{
+   Termsave_Slab *slab = &ty->backlog_slab;
+   Termsave_Slab_Chunk *chunk;
+   unsigned int cls;
+   void *block;
+
+   if (size > SLAB_BLOCK_MAX)
+     {
+        ty->stats.backlog_mallocs++;
+        return malloc(size);
+     }
+   cls = _slab_class(size);
+   chunk = slab->partial[cls];
+   if (!chunk)
+     {
+        chunk = slab->empty;
+        slab->empty = NULL;
+        if (!chunk)
+          {
+             if (posix_memalign((void **)&chunk, SLAB_CHUNK_SIZE,
+                                SLAB_CHUNK_SIZE))
+               return NULL;
+             ty->stats.backlog_mallocs++;
+          }
+        chunk->free = NULL;
+        chunk->cls = cls;
+        chunk->used = 0;
+        chunk->carved = 0;
+        chunk->blocks = (SLAB_CHUNK_SIZE - SLAB_HEADER_SIZE) /
+           ((cls + 1) * SLAB_ALIGN);
+        _slab_partial_add(slab, chunk);
+     }
+
+   if (chunk->free)
+     {
+        block = chunk->free;
+        chunk->free = *(void **)block;
+     }
+   else
+     {
+        block = (unsigned char *)chunk + SLAB_HEADER_SIZE +
+           (size_t)chunk->carved * (cls + 1) * SLAB_ALIGN;
+        chunk->carved++;
+     }
+   chunk->used++;
+   if (_slab_chunk_full(chunk))
+     _slab_partial_del(slab, chunk);
+   ty->stats.backlog_blocks++;
+   return block;
+}
+
+static void
+_slab_free(Termpty *ty, void *block, size_t size)
+{
+   Termsave_Slab *slab = &ty->backlog_slab;
+   Termsave_Slab_Chunk *chunk;
+
+   if (!block)
+     return;
+   if (size > SLAB_BLOCK_MAX)
+     {
+        free(block);
+        return;
+     }
+   chunk = _slab_chunk(block);
+   if (_slab_chunk_full(chunk))
+     _slab_partial_add(slab, chunk);
+   *(void **)block = chunk->free;
+   chunk->free = block;
+   chunk->used--;
+   if (chunk->used > 0)
+     return;
+
+   _slab_partial_del(slab, chunk);
+   if (slab->empty)
+     free(chunk);
+   else
+     slab->empty = chunk;
+}
+
+/* Keeps the block when @size is of the same class */
+static void *
+_slab_realloc(Termpty *ty, void *block, size_t old_size, size_t size)
+{
+   void *b;
+
+   if ((old_size > SLAB_BLOCK_MAX) && (size > SLAB_BLOCK_MAX))
+     {
+        ty->stats.backlog_mallocs++;
+        return realloc(block, size);
+     }
+   if ((old_size <= SLAB_BLOCK_MAX) && (size <= SLAB_BLOCK_MAX) &&
+       (_slab_class(size) == _slab_class(old_size)))
+     return block;
+   b = _slab_alloc(ty, size);
+   if (!b)
+     return NULL;
+   memcpy(b, block, MIN(old_size, size));
+   _slab_free(ty, block, old_size);
+   return b;
+}
+
+/* Once all lines are freed */
+static void
+_slab_flush(Termpty *ty)
+{
+   Termsave_Slab *slab = &ty->backlog_slab;
+   unsigned int cls;
+
+   for (cls = 0; cls < BACKLOG_SLAB_CLASSES; cls++)
+     {
+        if (slab->partial[cls])
+          ERR("backlog slab still used by class %u", cls);
+     }
+   free(slab->empty);
+   slab->empty = NULL;
+}
+
+/* }}} */
+/* {{{ Packing */
+
+static inline unsigned char *
+_packed_cps(const Termsavepacked *p)
+{
+   return (unsigned char *)(p + 1);
+}
+
+static inline size_t
+_packed_runs_offset(unsigned int w, unsigned int cp_shift)
+{
+   /* keep runs aligned */
+   return (sizeof(Termsavepacked) + ((size_t)w << cp_shift) + 3) & ~(size_t)3;
+}
+
+static inline Termsaverun *
+_packed_runs(const Termsavepacked *p, unsigned int w)
+{
+   return (Termsaverun *)((unsigned char *)p +
+                          _packed_runs_offset(w, p->cp_shift));
+}
+
+static inline Eina_Unicode
+_cp_get(const unsigned char *cps, unsigned int cp_shift, unsigned int i)
+{
+   switch (cp_shift)
+     {
+      case 0: return cps[i];
+      case 1: return ((const uint16_t *)cps)[i];
+      default: return ((const uint32_t *)cps)[i];
+     }
+}
+
+static unsigned int
+_cells_cp_shift(const Termcell *cells, unsigned int n)
+{
+   Eina_Unicode all = 0;
+   unsigned int i;
+
+   for (i = 0; i < n; i++)
+     all |= cells[i].codepoint;
+   if (all < 0x100)
+     return 0;
+   if (all < 0x10000)
+     return 1;
+   return 2;
+}
+
+/* Number of runs @cells add after a run of attribute @last, if any */
+static unsigned int
+_cells_runs_count(const Termpty *ty, const Termatt *last,
+                  const Termcell *cells, unsigned int n)
+{
+   unsigned int i, runs = 0;
+
+   if (n == 0)
+     return 0;
+   if ((!last) ||
+       (memcmp(last, termpty_cell_att(ty, &cells[0]), sizeof(Termatt))))
+     runs++;
+   /* interned attributes are equal when their indexes are */
+   for (i = 1; i < n; i++)
+     {
+        if (cells[i].att_id != cells[i - 1].att_id)
+          runs++;
+     }
+   return runs;
+}
+
+static unsigned int
+_runs_write(const Termpty *ty, Termsaverun *runs, unsigned int nb_runs,
+            const Termcell *cells, unsigned int n)
+{
+   unsigned int i;
+
+   for (i = 0; i < n; i++)
+     {
+        const Termatt *att;
+
+        if ((i > 0) && (cells[i].att_id == cells[i - 1].att_id))
+          {
+             runs[nb_runs - 1].len++;
+             continue;
+          }
+        att = termpty_cell_att(ty, &cells[i]);
+        if ((i == 0) && (nb_runs > 0) &&
+            (!memcmp(&runs[nb_runs - 1].att, att, sizeof(Termatt))))
+          runs[nb_runs - 1].len++;
+        else
+          {
+             runs[nb_runs].att = *att;
+             runs[nb_runs].len = 1;
+             nb_runs++;
+          }
+     }
+   return nb_runs;
+}
+
+static void
+_cps_write(Termsavepacked *p, unsigned int from,
+           const Termcell *cells, unsigned int n)
+{
+   unsigned int i;
+
+   switch (p->cp_shift)
+     {
+      case 0:
+           {
+              uint8_t *cps = _packed_cps(p) + from;
+
+              for (i = 0; i < n; i++)
+                cps[i] = cells[i].codepoint;
+           }
+         break;
+      case 1:
+           {
+              uint16_t *cps = (uint16_t *)_packed_cps(p) + from;
+
+              for (i = 0; i < n; i++)
+                cps[i] = cells[i].codepoint;
+           }
+         break;
+      default:
+           {
+              uint32_t *cps = (uint32_t *)_packed_cps(p) + from;
+
+              for (i = 0; i < n; i++)
+                cps[i] = cells[i].codepoint;
+           }
+     }
+}
+
+static Termsavepacked *
+_cells_pack(Termpty *ty, const Termcell *cells, unsigned int w)
+{
+   Termsavepacked *p;
+   unsigned int cp_shift = _cells_cp_shift(cells, w);
+   unsigned int runs = _cells_runs_count(ty, NULL, cells, w);
+   size_t size = _packed_runs_offset(w, cp_shift) + runs * sizeof(Termsaverun);
+
+   p = _slab_alloc(ty, size);
+   if (!p)
+     return NULL;
+   p->size = size;
+   p->cp_shift = cp_shift;
+   _cps_write(p, 0, cells, w);
+   p->runs = _runs_write(ty, _packed_runs(p, w), 0, cells, w);
+   return p;
+}
+
+static void
+_packed_unpack(Termpty *ty, const Termsavepacked *p, Termcell *cells,
+               unsigned int w)
+{
+   const Termsaverun *runs = _packed_runs(p, w);
+   unsigned int r, i = 0;
+
+   for (r = 0; r < p->runs; r++)
+     {
+        unsigned int end = MIN(i + runs[r].len, w);
+        uint32_t att_id = termpty_att_id(ty, &runs[r].att);
+
+        for (; i < end; i++)
+          cells[i].att_id = att_id;
+     }
+   switch (p->cp_shift)
+     {
+      case 0:
+           {
+              const uint8_t *cps = _packed_cps(p);
+
+              for (i = 0; i < w; i++)
+                cells[i].codepoint = cps[i];
+           }
+         break;
+      case 1:
+           {
+              const uint16_t *cps = (const uint16_t *)_packed_cps(p);
+
+              for (i = 0; i < w; i++)
+                cells[i].codepoint = cps[i];
+           }
+         break;
+      default:
+           {
+              const uint32_t *cps = (const uint32_t *)_packed_cps(p);
+
+              for (i = 0; i < w; i++)
+                cells[i].codepoint = cps[i];
+           }
+     }
+}
+
+/* The backlog holds references on the hyperlinks and blocks of its cells */
+static void
+_cells_ref(Termpty *ty, const Termcell *cells, unsigned int n)
+{
+   unsigned int i;
+
+   if (!termpty_cells_flags_get(ty, cells, n))
+     return;
+   for (i = 0; i < n; i++)
+     {
+        HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, 0, cells[i].codepoint);
+        if (EINA_UNLIKELY(termpty_cell_link_id(ty, &cells[i])))
+          term_link_refcount_inc(ty, termpty_cell_link_id(ty, &cells[i]), 1);
+     }
+}
+
+/* }}} */
+/* {{{ Compression */
+
+static Termsavecomp *
+_packed_compress(Termpty *ty, const Termsavepacked *p, unsigned int w)
+{
+   Termsave_Cache *cache = &ty->backlog_cache;
+   const Termsaverun *runs = _packed_runs(p, w);
+   const unsigned char *cps = _packed_cps(p);
+   const unsigned int cp_shift = p->cp_shift, nb_runs = p->runs;
+   Termatt atts[COMP_ATTS_MAX];
+   unsigned int nb_atts = 0, cur = 0, r, i = 0;
+   size_t len = 0, size;
+   unsigned char *out;
+   Termsavecomp *comp;
+   Eina_Bool links = EINA_FALSE;
+
+   if (cache->buf_size < (size_t)w * COMP_CELL_MAX)
+     {
+        out = realloc(cache->buf, (size_t)w * COMP_CELL_MAX);
+        if (!out)
+          return NULL;
+        cache->buf = out;
+        cache->buf_size = (size_t)w * COMP_CELL_MAX;
+     }
+   out = cache->buf;
+
+   for (r = 0; r < nb_runs; r++)
+     {
+        unsigned int a, start = i, end = MIN(i + runs[r].len, w);
+        unsigned int repeat = 0;
+        Eina_Unicode prev = 0;
+
+        for (a = 0; a < nb_atts; a++)
+          {
+             if (!memcmp(&runs[r].att, &atts[a], sizeof(Termatt)))
+               break;
+          }
+        if (a == nb_atts)
+          {
+             if (nb_atts == COMP_ATTS_MAX)
+               return NULL;
+             atts[nb_atts++] = runs[r].att;
+             if (runs[r].att.link_id)
+               links = EINA_TRUE;
+          }
+        if (a != cur)
+          {
+             out[len++] = COMP_ATT;
+             out[len++] = a;
+             cur = a;
+          }
+
+        for (; i < end; i++)
+          {
+             Eina_Unicode cp = _cp_get(cps, cp_shift, i);
+
+             if ((i > start) && (cp == prev) && (repeat < COMP_REPEAT_MAX))
+               {
+                  repeat++;
+                  continue;
+               }
+             if (repeat)
+               out[len++] = COMP_REPEAT | (repeat - 1);
+             repeat = 0;
+             prev = cp;
+
+             if (cp < 0x80)
+               out[len++] = cp;
+             else if (cp < 0x10000)
+               {
+                  out[len++] = COMP_CP16;
+                  out[len++] = cp & 0xff;
+                  out[len++] = cp >> 8;
+               }
+             else
+               {
+                  out[len++] = COMP_CP32;
+                  out[len++] = cp & 0xff;
+                  out[len++] = (cp >> 8) & 0xff;
+                  out[len++] = (cp >> 16) & 0xff;
+                  out[len++] = cp >> 24;
+               }
+          }
+        if (repeat)
+          out[len++] = COMP_REPEAT | (repeat - 1);
+     }
+
+   size = sizeof(Termsavecomp) + nb_atts * sizeof(Termatt) + len;
+   if (size >= p->size)
+     return NULL;
+   comp = _slab_alloc(ty, size);
+   if (!comp)
+     return NULL;
+   comp->size = size;
+   comp->atts = nb_atts;
+   comp->links = links;
+   memcpy(comp + 1, atts, nb_atts * sizeof(Termatt));
+   memcpy((unsigned char *)(comp + 1) + nb_atts * sizeof(Termatt), out, len);
+   return comp;
+}
+
+static void
+_comp_uncompress(Termpty *ty, const Termsavecomp *comp, Termcell *cells,
+                 unsigned int w)
+{
+   const Termatt *atts = (const Termatt *)(comp + 1);
+   const unsigned char *in = (const unsigned char *)(atts + comp->atts);
+   const unsigned char *end = (const unsigned char *)comp + comp->size;
+   uint32_t att_id = termpty_att_id(ty, &atts[0]);
+   unsigned int i = 0;
+
+   while ((in < end) && (i < w))
+     {
+        unsigned char b = *in++;
+
+        if (b < 0x80)
+          {
+             cells[i].codepoint = b;
+             cells[i].att_id = att_id;
+             i++;
+          }
+        else if (b >= COMP_REPEAT)
+          {
+             unsigned int n = (b & ~COMP_REPEAT) + 1;
+
+             for (; (n > 0) && (i < w); n--, i++)
+               cells[i] = cells[i - 1];
+          }
+        else if (b == COMP_ATT)
+          att_id = termpty_att_id(ty, &atts[*in++]);
+        else if (b == COMP_CP16)
+          {
+             cells[i].codepoint = in[0] | (in[1] << 8);
+             cells[i].att_id = att_id;
+             in += 2;
+             i++;
+          }
+        else
+          {
+             cells[i].codepoint = in[0] | (in[1] << 8) | (in[2] << 16) |
+                ((Eina_Unicode)in[3] << 24);
+             cells[i].att_id = att_id;
+             in += 4;
+             i++;
+          }
+     }
+}
+
+/* }}} */
+/* {{{ Cache */
+
+static void
+_cache_forget(Termpty *ty, const Termsave *ts)
+{
+   Termsave_Cache *cache = &ty->backlog_cache;
+   int i;
+
+   for (i = 0; i < BACKLOG_CACHE_SIZE; i++)
+     {
+        if (cache->lines[i].ts == ts)
+          cache->lines[i].ts = NULL;
+     }
+}
+
+static void
+_cache_flush(Termpty *ty)
+{
+   Termsave_Cache *cache = &ty->backlog_cache;
+   int i;
+
+   for (i = 0; i < BACKLOG_CACHE_SIZE; i++)
+     {
+        cache->lines[i].ts = NULL;
+        free(cache->lines[i].cells);
+        cache->lines[i].cells = NULL;
+        cache->lines[i].size = 0;
+     }
+   cache->next = 0;
+   free(cache->buf);
+   cache->buf = NULL;
+   cache->buf_size = 0;
+}
+
+/* }}} */
+/* {{{ Disk */
+
+static inline unsigned int
+_disk_segment(const Termsave *ts)
+{
+   return ((uintptr_t)ts->data - 1) >> DISK_OFFSET_BITS;
+}
+
+static inline size_t
+_disk_offset(const Termsave *ts)
+{
+   return (((uintptr_t)ts->data - 1) &
+           ((1 << DISK_OFFSET_BITS) - 1)) * DISK_ALIGN;
+}
+
+static inline size_t
+_data_size(const void *data)
+{
+   /* packed and compressed lines both start with their size */
+   return *(const unsigned int *)data;
+}
+
+static Termsave_Disk *
+_disk_get(Termpty *ty)
+{
+   Termsave_Disk *disk = ty->backlog_disk;
+   char path[PATH_MAX];
+   int fd;
+
+   if (disk)
+     return ((disk->fd >= 0) && (!disk->failed)) ? disk : NULL;
+
+   disk = calloc(1, sizeof(Termsave_Disk));
+   if (!disk)
+     return NULL;
+   disk->fd = -1;
+   ty->backlog_disk = disk;
+   disk->buf = malloc(DISK_SEGMENT_SIZE);
+   if (!disk->buf)
+     return NULL;
+   _accounting_fixed_change(DISK_SEGMENT_SIZE);
+   disk->segments = calloc(1, sizeof(Termsave_Segment));
+   if (!disk->segments)
+     return NULL;
+   disk->nb_segments = 1;
+   disk->segments[0].atts = malloc(DISK_ATTS_MAX * sizeof(Termatt));
+   if (!disk->segments[0].atts)
+     return NULL;
+
+   snprintf(path, sizeof(path), "%s/terminology", efreet_cache_home_get());
+   ecore_file_mkpath(path);
+   snprintf(path, sizeof(path), "%s/terminology/backlog-XXXXXX",
+            efreet_cache_home_get());
+   fd = mkstemp(path);
+   if (fd < 0)
+     {
+        ERR("can not create '%s' to keep the scrollback: %s",
+            path, strerror(errno));
+        return NULL;
+     }
+   /* gone with the terminal, whatever happens */
+   unlink(path);
+   if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+     {
+        close(fd);
+        return NULL;
+     }
+   disk->fd = fd;
+   return disk;
+}
+
+static void
+_disk_unmap(Termsave_Disk *disk, unsigned int seg)
+{
+   unsigned int i;
+
+   if (!disk->segments[seg].map)
+     return;
+   munmap(disk->segments[seg].map, DISK_SEGMENT_SIZE);
+   disk->segments[seg].map = NULL;
+   for (i = 0; i < disk->nb_maps; i++)
+     {
+        if (disk->maps[i] == seg)
+          {
+             memmove(disk->maps + i, disk->maps + i + 1,
+                     (disk->nb_maps - i - 1) * sizeof(unsigned int));
+             disk->nb_maps--;
+             break;
+          }
+     }
+}
+
+static const void *
+_disk_line_get(Termpty *ty, const Termsave *ts)
+{
+   Termsave_Disk *disk = ty->backlog_disk;
+   unsigned int seg = _disk_segment(ts);
+   Termsave_Segment *s = &disk->segments[seg];
+
+   if (seg == disk->cur)
+     return disk->buf + _disk_offset(ts);
+   if (!s->map)
+     {
+        void *map = mmap(NULL, DISK_SEGMENT_SIZE, PROT_READ, MAP_SHARED,
+                         disk->fd, (off_t)seg * DISK_SEGMENT_SIZE);
+
+        if (map == MAP_FAILED)
+          {
+             ERR("can not map scrollback segment %u: %s",
+                 seg, strerror(errno));
+             return NULL;
+          }
+        if (disk->nb_maps == DISK_MAPS)
+          _disk_unmap(disk, disk->maps[0]);
+        s->map = map;
+        disk->maps[disk->nb_maps++] = seg;
+        ty->stats.backlog_mapped++;
+     }
+   return (unsigned char *)s->map + _disk_offset(ts);
+}
+
+static void
+_disk_segment_reset(Termsave_Disk *disk, unsigned int seg)
+{
+   Termsave_Segment *s = &disk->segments[seg];
+
+   _disk_unmap(disk, seg);
+   s->nb_atts = 0;
+   if (seg == disk->cur)
+     {
+        disk->len = 0;
+        memset(disk->atts_hash, 0, sizeof(disk->atts_hash));
+     }
+   else
+     {
+        free(s->atts);
+        s->atts = NULL;
+     }
+}
+
+/* Get the lines of the current segment back to memory */
+static void
+_disk_fail(Termpty *ty)
+{
+   Termsave_Disk *disk = ty->backlog_disk;
+   size_t i;
+
+   for (i = 0; i < ty->backsize; i++)
+     {
+        Termsave *ts = &ty->back[i];
+        const void *data;
+        void *copy;
+
+        if ((!ts->data) || (!ts->disk) || (_disk_segment(ts) != disk->cur))
+          continue;
+        data = disk->buf + _disk_offset(ts);
+        copy = _slab_alloc(ty, _data_size(data));
+        if (!copy)
+          {
+             termpty_save_free(ty, ts);
+             continue;
+          }
+        memcpy(copy, data, _data_size(data));
+        disk->segments[disk->cur].lines--;
+        _accounting_change(_data_size(data));
+        ts->data = copy;
+        ts->disk = 0;
+        ty->backlog_use.lines++;
+        if (ts->comp)
+          ts_comp++;
+        else
+          ts_uncomp++;
+     }
+   _disk_segment_reset(disk, disk->cur);
+   disk->failed = EINA_TRUE;
+   /* older lines may be in memory again */
+   ty->backlog_use.evicted = ty->backlog_use.freed;
+}
+
+/* Write the current segment and start another one */
+static Eina_Bool
+_disk_seal(Termpty *ty)
+{
+   Termsave_Disk *disk = ty->backlog_disk;
+   Termsave_Segment *s = &disk->segments[disk->cur];
+   Termatt *atts;
+   unsigned int seg;
+   size_t done = 0;
+
+   while (done < disk->len)
+     {
+        ssize_t n = pwrite(disk->fd, disk->buf + done, disk->len - done,
+                           (off_t)disk->cur * DISK_SEGMENT_SIZE + done);
+
+        if ((n < 0) && (errno == EINTR))
+          continue;
+        if (n <= 0)
+          {
+             ERR("can not write the scrollback to disk: %s",
+                 strerror(errno));
+             _disk_fail(ty);
+             return EINA_FALSE;
+          }
+        done += n;
+     }
+   if (s->lines == 0)
+     {
+        _disk_segment_reset(disk, disk->cur);
+        return EINA_TRUE;
+     }
+   if (s->nb_atts < DISK_ATTS_MAX)
+     {
+        atts = realloc(s->atts, s->nb_atts * sizeof(Termatt));
+        if ((atts) || (s->nb_atts == 0))
+          s->atts = atts;
+     }
+
+   /* no other segment can be started: the lines of that one get back to
+    * memory rather than it being written again for each line */
+   atts = malloc(DISK_ATTS_MAX * sizeof(Termatt));
+   if (!atts)
+     goto fail;
+   for (seg = 0; seg < disk->nb_segments; seg++)
+     {
+        if ((disk->segments[seg].lines == 0) && (seg != disk->cur))
+          break;
+     }
+   if (seg == disk->nb_segments)
+     {
+        Termsave_Segment *segments;
+
+        if (seg >= DISK_SEGMENTS_MAX)
+          {
+             ERR("no room left for the scrollback on disk");
+             free(atts);
+             goto fail;
+          }
+        segments = realloc(disk->segments,
+                           (seg + 1) * sizeof(Termsave_Segment));
+        if (!segments)
+          {
+             free(atts);
+             goto fail;
+          }
+        memset(&segments[seg], 0, sizeof(Termsave_Segment));
+        disk->segments = segments;
+        disk->nb_segments++;
+     }
+   disk->segments[seg].atts = atts;
+   _disk_unmap(disk, seg);
+   disk->cur = seg;
+   disk->len = 0;
+   memset(disk->atts_hash, 0, sizeof(disk->atts_hash));
+   return EINA_TRUE;
+
+fail:
+   _disk_fail(ty);
+   return EINA_FALSE;
+}
+
+static void
+_disk_att_add(Termsave_Disk *disk, const Termatt *att)
+{
+   Termsave_Segment *s = &disk->segments[disk->cur];
+   uint64_t key = 0;
+   unsigned int h;
+
+   memcpy(&key, att, MIN(sizeof(key), sizeof(Termatt)));
+   h = (key * 0x9e3779b97f4a7c15ULL) >> 40;
+   for (;; h++)
+     {
+        uint16_t i = disk->atts_hash[h % DISK_ATTS_HASH];
+
+        if (!i)
+          break;
+        if (!memcmp(&s->atts[i - 1], att, sizeof(Termatt)))
+          return;
+     }
+   s->atts[s->nb_atts++] = *att;
+   disk->atts_hash[h % DISK_ATTS_HASH] = s->nb_atts;
+}
+
+static void
+_disk_line_free(Termpty *ty, const Termsave *ts)
+{
+   Termsave_Disk *disk = ty->backlog_disk;
+   unsigned int seg = _disk_segment(ts);
+
+   disk->segments[seg].lines--;
+   if (disk->segments[seg].lines == 0)
+     _disk_segment_reset(disk, seg);
+}
+
+static void
+_disk_free(Termpty *ty)
+{
+   Termsave_Disk *disk = ty->backlog_disk;
+   unsigned int seg;
+
+   if (!disk)
+     return;
+   for (seg = 0; seg < disk->nb_segments; seg++)
+     {
+        if (disk->segments[seg].map)
+          munmap(disk->segments[seg].map, DISK_SEGMENT_SIZE);
+        free(disk->segments[seg].atts);
+     }
+   if (disk->buf)
+     _accounting_fixed_change(-DISK_SEGMENT_SIZE);
+   if (disk->fd >= 0)
+     close(disk->fd);
+   free(disk->segments);
+   free(disk->buf);
+   free(disk);
+   ty->backlog_disk = NULL;
+}
+
+/* }}} */
+/* {{{ Index of screen rows */
+
+/* Past a 1/INDEX_FILL_RATIO of the lines to count, all are counted at once */
+#define INDEX_FILL_RATIO 32
+
+/* Width of the line in @ts, -1 if there is none */
+static inline int
+_save_w(const Termsave *ts)
+{
+   return (ts->data) ? (int)ts->w : -1;
+}
+
+static inline unsigned int
+_line_rows(int lw, int w)
+{
+   if (lw < 0)
+     return 0;
+   return (lw == 0) ? 1 : (lw + w - 1) / w;
+}
+
+static void
+_widths_add(Termpty *ty, int lw, int diff)
+{
+   Termsave_Rows *r = &ty->backlog_rows;
+   unsigned int page = lw / BACKLOG_WIDTHS_PAGE;
+
+   if ((lw < 0) || ((diff < 0) && ((page >= r->nb_pages) ||
+                                   (!r->pages[page].lines))))
+     return;
+   if (page >= r->nb_pages)
+     {
+        void *pages = realloc(r->pages, (page + 1) * sizeof(*r->pages));
+
+        if (!pages)
+          return;
+        r->pages = pages;
+        memset(&r->pages[r->nb_pages], 0,
+               (page + 1 - r->nb_pages) * sizeof(*r->pages));
+        r->nb_pages = page + 1;
+     }
+   if (!r->pages[page].lines)
+     {
+        r->pages[page].lines = calloc(BACKLOG_WIDTHS_PAGE,
+                                      sizeof(unsigned int));
+        if (!r->pages[page].lines)
+          return;
+        _accounting_fixed_change(BACKLOG_WIDTHS_PAGE *
+                                 sizeof(unsigned int));
+     }
+   r->pages[page].lines[lw % BACKLOG_WIDTHS_PAGE] += diff;
+   r->pages[page].count += diff;
+   if (r->pages[page].count == 0)
+     {
+        free(r->pages[page].lines);
+        r->pages[page].lines = NULL;
+        _accounting_fixed_change((-1) * (int64_t)(BACKLOG_WIDTHS_PAGE *
+                                                  sizeof(unsigned int)));
+     }
+}
+
+static void
+_widths_free(Termpty *ty)
+{
+   Termsave_Rows *r = &ty->backlog_rows;
+   unsigned int page;
+
+   for (page = 0; page < r->nb_pages; page++)
+     {
+        if (!r->pages[page].lines)
+          continue;
+        free(r->pages[page].lines);
+        _accounting_fixed_change((-1) * (int64_t)(BACKLOG_WIDTHS_PAGE *
+                                                  sizeof(unsigned int)));
+     }
+   free(r->pages);
+   r->pages = NULL;
+   r->nb_pages = 0;
+}
+
+/* The slot at 0 is also the oldest one */
+static inline Eina_Bool
+_index_counts(const Termpty *ty, const Termsave_Index *idx, const Termsave *ts)
+{
+   size_t age = (ty->backpos + ty->backsize - 1 - (ts - ty->back)) %
+      ty->backsize;
+
+   return ((age == 0) ? ty->backsize : age) <= idx->lines;
+}
+
+static inline void
+_index_tree_add(Termpty *ty, Termsave_Index *idx, const Termsave *ts,
+                int diff)
+{
+   size_t i;
+
+   assert((ts >= ty->back) && (ts < ty->back + ty->backsize));
+   for (i = ts - ty->back + 1; i <= ty->backsize; i += i & -i)
+     idx->tree[i] += diff;
+   idx->rows += diff;
+}
+
+/* A line went from width @from to width @to, -1 when there is none */
+static void
+_index_change(Termpty *ty, const Termsave *ts, int from, int to)
+{
+   Termsave_Rows *r = &ty->backlog_rows;
+   unsigned int k;
+
+   if (from == to)
+     return;
+   _widths_add(ty, from, -1);
+   _widths_add(ty, to, 1);
+   for (k = 0; k < BACKLOG_INDEX_WIDTHS; k++)
+     {
+        Termsave_Index *idx = &r->index[k];
+        int diff;
+
+        if (!idx->w)
+          continue;
+        diff = (int)_line_rows(to, idx->w) - (int)_line_rows(from, idx->w);
+        idx->total += diff;
+        if ((diff) && (idx->tree) && (_index_counts(ty, idx, ts)))
+          _index_tree_add(ty, idx, ts, diff);
+     }
+}
+
+static void
+_index_tree_free(Termpty *ty, Termsave_Index *idx)
+{
+   if (idx->tree)
+     _accounting_fixed_change((-1) * (int64_t)((ty->backsize + 1) *
+                                               sizeof(unsigned int)));
+   free(idx->tree);
+   idx->tree = NULL;
+   idx->lines = 0;
+   idx->rows = 0;
+}
+
+/* Index of the rows at the current width, reusing the one used the longest
+ * ago if there is none yet */
+static Termsave_Index *
+_index_get(Termpty *ty)
+{
+   Termsave_Rows *r = &ty->backlog_rows;
+   Termsave_Index *idx = NULL;
+   unsigned int k, page;
+   int lw;
+
+   for (k = 0; k < BACKLOG_INDEX_WIDTHS; k++)
+     {
+        if (r->index[k].w == ty->w)
+          {
+             idx = &r->index[k];
+             goto end;
+          }
+        if ((!idx) || (r->index[k].used < idx->used))
+          idx = &r->index[k];
+     }
+   _index_tree_free(ty, idx);
+   idx->w = ty->w;
+   idx->total = 0;
+   for (page = 0; page < r->nb_pages; page++)
+     {
+        if (!r->pages[page].lines)
+          continue;
+        for (lw = 0; lw < BACKLOG_WIDTHS_PAGE; lw++)
+          idx->total += (size_t)r->pages[page].lines[lw] *
+             _line_rows(page * BACKLOG_WIDTHS_PAGE + lw, idx->w);
+     }
+end:
+   idx->used = ++r->clock;
+   return idx;
+}
+
+/* Count all the lines, in O(n) */
+static void
+_index_build(Termpty *ty, Termsave_Index *idx)
+{
+   size_t i;
+
+   idx->tree[0] = 0;
+   for (i = 1; i <= ty->backsize; i++)
+     idx->tree[i] = _line_rows(_save_w(&ty->back[i - 1]), idx->w);
+   for (i = 1; i <= ty->backsize; i++)
+     {
+        size_t parent = i + (i & -i);
+
+        if (parent <= ty->backsize)
+          idx->tree[parent] += idx->tree[i];
+     }
+   idx->lines = ty->backsize;
+   idx->rows = idx->total;
+}
+
+/* Count lines from the newest ones until they take at least @rows */
+static Eina_Bool
+_index_fill(Termpty *ty, Termsave_Index *idx, size_t rows)
+{
+   size_t start;
+
+   if (!idx->tree)
+     {
+        idx->tree = calloc(ty->backsize + 1, sizeof(unsigned int));
+        if (!idx->tree)
+          return EINA_FALSE;
+        _accounting_fixed_change((ty->backsize + 1) *
+                                 sizeof(unsigned int));
+     }
+   start = idx->lines;
+   while ((idx->rows < rows) && (idx->lines < ty->backsize))
+     {
+        const Termsave *ts;
+
+        if (idx->lines - start > ty->backsize / INDEX_FILL_RATIO)
+          {
+             _index_build(ty, idx);
+             break;
+          }
+        idx->lines++;
+        ts = BACKLOG_ROW_GET(ty, idx->lines);
+        if (ts->data)
+          _index_tree_add(ty, idx, ts, _line_rows(ts->w, idx->w));
+     }
+   return EINA_TRUE;
+}
+
+static void
+_index_free(Termpty *ty)
+{
+   Termsave_Rows *r = &ty->backlog_rows;
+   unsigned int k;
+
+   for (k = 0; k < BACKLOG_INDEX_WIDTHS; k++)
+     {
+        _index_tree_free(ty, &r->index[k]);
+        r->index[k].w = 0;
+     }
+}
+
+/* Rows of the lines in the first @n slots */
+static unsigned int
+_index_prefix(const Termsave_Index *idx, size_t n)
+{
+   unsigned int rows = 0;
 
-static void
-_accounting_change(int64_t diff)
+   for (; n > 0; n -= n & -n)
+     rows += idx->tree[n];
+   return rows;
+}
+
+/* Largest number of first slots taking at most @rows */
+static size_t
+_index_search(const Termsave_Index *idx, size_t size, unsigned int rows)
 {
-   if (diff > 0)
+   size_t pos = 0, step = 1;
+
+   while (step * 2 <= size)
+     step *= 2;
+   for (; step > 0; step /= 2)
      {
-        diff = ((diff + 16-1) / 16) * 16;
+        if ((pos + step <= size) && (idx->tree[pos + step] <= rows))
+          {
+             pos += step;
+             rows -= idx->tree[pos];
+          }
      }
-   else
+   return pos;
+}
+
+/* Make the line saved in the slot at 0 the newest one */
+void
+termpty_backlog_advance(Termpty *ty)
+{
+   Termsave_Rows *r = &ty->backlog_rows;
+   unsigned int k;
+
+   ty->backpos++;
+   if (ty->backpos >= ty->backsize)
+     ty->backpos = 0;
+   /* the oldest slot now holds the newest line */
+   if (ty->backlog_use.evicted > 0)
+     ty->backlog_use.evicted--;
+   if (ty->backlog_use.freed > 0)
+     ty->backlog_use.freed--;
+   /* the line saved in the slot at 0 was not counted unless all are */
+   for (k = 0; k < BACKLOG_INDEX_WIDTHS; k++)
      {
-        diff = ((-1 * diff + 16-1) / 16) * -16;
+        Termsave_Index *idx = &r->index[k];
+        const Termsave *ts;
+
+        if ((!idx->tree) || (idx->lines >= ty->backsize))
+          continue;
+        idx->lines++;
+        ts = BACKLOG_ROW_GET(ty, 1);
+        if (ts->data)
+          _index_tree_add(ty, idx, ts, _line_rows(ts->w, idx->w));
      }
-   _mem_used += diff;
 }
 
-int64_t
-termpty_backlog_memory_get(void)
+/* Forget the newest line slot, once freed */
+void
+termpty_backlog_retreat(Termpty *ty)
 {
-   return _mem_used;
+   Termsave_Rows *r = &ty->backlog_rows;
+   unsigned int k;
+
+   /* it becomes the slot at 0 */
+   for (k = 0; k < BACKLOG_INDEX_WIDTHS; k++)
+     {
+        Termsave_Index *idx = &r->index[k];
+
+        if ((idx->lines > 0) && (idx->lines < ty->backsize))
+          idx->lines--;
+     }
+   if (ty->backpos == 0)
+     ty->backpos = ty->backsize - 1;
+   else
+     ty->backpos--;
 }
 
+/* }}} */
 
 void
-termpty_save_register(Termpty *ty)
+termpty_save_compress(Termpty *ty, Termsave *ts)
 {
-   termpty_backlog_lock();
-   ptys = eina_list_append(ptys, ty);
-   termpty_backlog_unlock();
+   Termsavecomp *comp;
+
+   if ((!ts->data) || (ts->comp) || (ts->disk))
+     return;
+   comp = _packed_compress(ty, TS_PACKED(ts), ts->w);
+   if (!comp)
+     return;
+   _accounting_change((-1) * (int64_t)TS_PACKED(ts)->size);
+   _accounting_change(comp->size);
+   _slab_free(ty, ts->data, TS_PACKED(ts)->size);
+   ts->data = comp;
+   ts->comp = 1;
+   ts_uncomp--;
+   ts_comp++;
+   ty->stats.backlog_compressed++;
 }
 
-void
-termpty_save_unregister(Termpty *ty)
+Eina_Bool
+termpty_save_to_disk(Termpty *ty, Termsave *ts)
 {
-   termpty_backlog_lock();
-   ptys = eina_list_remove(ptys, ty);
-   termpty_backlog_unlock();
+   Termsave_Disk *disk;
+   const Termatt *atts = NULL;
+   const Termsaverun *runs = NULL;
+   unsigned int nb_atts, i;
+   size_t size;
+   uintptr_t loc;
+
+   if ((!ts->data) || (ts->disk))
+     return ts->disk;
+   termpty_save_compress(ty, ts);
+   if (ts->comp)
+     {
+        /* hyperlinks are refcounted by cell, keep them at hand */
+        if (TS_COMP(ts)->links)
+          return EINA_FALSE;
+        atts = (const Termatt *)(TS_COMP(ts) + 1);
+        nb_atts = TS_COMP(ts)->atts;
+     }
+   else
+     {
+        runs = _packed_runs(TS_PACKED(ts), ts->w);
+        nb_atts = TS_PACKED(ts)->runs;
+        for (i = 0; i < nb_atts; i++)
+          {
+             if (runs[i].att.link_id)
+               return EINA_FALSE;
+          }
+     }
+   size = _data_size(ts->data);
+   if ((size > DISK_LINE_MAX) || (nb_atts > DISK_ATTS_MAX))
+     return EINA_FALSE;
+
+   disk = _disk_get(ty);
+   if (!disk)
+     return EINA_FALSE;
+   if ((disk->len + size > DISK_SEGMENT_SIZE) ||
+       (disk->segments[disk->cur].nb_atts + nb_atts > DISK_ATTS_MAX))
+     {
+        if (!_disk_seal(ty))
+          return EINA_FALSE;
+     }
+
+   for (i = 0; i < nb_atts; i++)
+     _disk_att_add(disk, (atts) ? &atts[i] : &runs[i].att);
+   memcpy(disk->buf + disk->len, ts->data, size);
+   loc = (((uintptr_t)disk->cur << DISK_OFFSET_BITS) |
+          (disk->len / DISK_ALIGN)) + 1;
+   disk->len = (disk->len + size + DISK_ALIGN - 1) & ~(DISK_ALIGN - 1);
+   disk->segments[disk->cur].lines++;
+
+   _accounting_change((-1) * (int64_t)size);
+   _slab_free(ty, ts->data, size);
+   if (ts->comp)
+     ts_comp--;
+   else
+     ts_uncomp--;
+   ty->backlog_use.lines--;
+   ty->stats.backlog_disk++;
+   ts->data = (void *)loc;
+   ts->disk = 1;
+   return EINA_TRUE;
 }
 
-Termsave *
-termpty_save_extract(Termsave *ts)
+/* Get a compressed line back to the packed format */
+static Termsave *
+_save_extract(Termpty *ty, Termsave *ts)
 {
-   if (!ts) return NULL;
+   Termsavecomp *comp;
+   Termsavepacked *p;
+   Termcell *cells;
+
+   if ((!ts->data) || (!ts->comp))
+     return ts;
+
+   comp = TS_COMP(ts);
+   cells = malloc(ts->w * sizeof(Termcell));
+   if (!cells)
+     return NULL;
+   _comp_uncompress(ty, comp, cells, ts->w);
+   p = _cells_pack(ty, cells, ts->w);
+   free(cells);
+   if (!p)
+     return NULL;
+   _accounting_change((-1) * (int64_t)comp->size);
+   _accounting_change(p->size);
+   _slab_free(ty, comp, comp->size);
+   ts->data = p;
+   ts->comp = 0;
+   ts_comp--;
+   ts_uncomp++;
    return ts;
 }
 
+Termcell *
+termpty_save_cells_get(Termpty *ty, const Termsave *ts)
+{
+   Termsave_Cache *cache = &ty->backlog_cache;
+   const void *data;
+   unsigned int i;
+
+   if (!ts->data)
+     return NULL;
+   for (i = 0; i < BACKLOG_CACHE_SIZE; i++)
+     {
+        if (cache->lines[i].ts == ts)
+          return cache->lines[i].cells;
+     }
+
+   data = (ts->disk) ? _disk_line_get(ty, ts) : ts->data;
+   if (!data)
+     return NULL;
+   i = cache->next;
+   if (cache->lines[i].size < ts->w)
+     {
+        Termcell *cells = realloc(cache->lines[i].cells,
+                                  ts->w * sizeof(Termcell));
+        if (!cells)
+          return NULL;
+        cache->lines[i].cells = cells;
+        cache->lines[i].size = ts->w;
+     }
+   if (ts->comp)
+     _comp_uncompress(ty, data, cache->lines[i].cells, ts->w);
+   else
+     _packed_unpack(ty, data, cache->lines[i].cells, ts->w);
+   cache->lines[i].ts = ts;
+   cache->next = (i + 1) % BACKLOG_CACHE_SIZE;
+   ty->stats.backlog_inflated++;
+   return cache->lines[i].cells;
+}
+
+Eina_Bool
+termpty_save_autowrapped_get(Termpty *ty, const Termsave *ts)
+{
+   if ((!ts->data) || (ts->w == 0))
+     return EINA_FALSE;
+   if ((ts->comp) || (ts->disk))
+     {
+        Termcell *cells = termpty_save_cells_get(ty, ts);
+
+        return cells && termpty_cell_att(ty, &cells[ts->w - 1])->autowrapped;
+     }
+   return _packed_runs(TS_PACKED(ts), ts->w)
+      [TS_PACKED(ts)->runs - 1].att.autowrapped;
+}
+
+/* Calls cb on the attributes of at most n lines of the backlog, from the
+ * y-th on, then on those of the lines on disk. Returns where to go on from,
+ * 0 once done */
+size_t
+termpty_backlog_atts_foreach(Termpty *ty, size_t y, size_t n,
+                             Termsave_Att_Cb cb, void *data)
+{
+   Termsave_Disk *disk = ty->backlog_disk;
+   unsigned int i;
+
+   for (; (y < ty->backsize) && (n > 0); y++, n--)
+     {
+        const Termsave *ts = &ty->back[y];
+
+        if ((!ts->data) || (ts->disk))
+          continue;
+        if (ts->comp)
+          {
+             const Termatt *atts = (const Termatt *)(TS_COMP(ts) + 1);
+
+             for (i = 0; i < TS_COMP(ts)->atts; i++)
+               cb(&atts[i], data);
+          }
+        else
+          {
+             const Termsaverun *runs = _packed_runs(TS_PACKED(ts), ts->w);
+
+             for (i = 0; i < TS_PACKED(ts)->runs; i++)
+               cb(&runs[i].att, data);
+          }
+     }
+   if (y < ty->backsize)
+     return y;
+   /* lines on disk are known by the attributes of their segments */
+   if (!disk)
+     return 0;
+   for (y = 0; y < disk->nb_segments; y++)
+     {
+        const Termsave_Segment *s = &disk->segments[y];
+
+        if (s->lines == 0)
+          continue;
+        for (i = 0; i < s->nb_atts; i++)
+          cb(&s->atts[i], data);
+     }
+   return 0;
+}
+
 Termsave *
-termpty_save_new(Termpty *ty, Termsave *ts, int w)
+termpty_save_new(Termpty *ty, Termsave *ts, Termcell *cells, int w)
 {
+   Termsavepacked *p;
+
    termpty_save_free(ty, ts);
 
-   Termcell *cells = calloc(1, w * sizeof(Termcell));
-   if (!cells ) return NULL;
-   ts->cells = cells;
+   p = _cells_pack(ty, cells, w);
+   if (!p)
+     return NULL;
+   _cells_ref(ty, cells, w);
+   ts->data = p;
    ts->w = w;
-   _accounting_change(w * sizeof(Termcell));
+   ts->comp = 0;
+   ts_uncomp++;
+   ty->backlog_use.lines++;
+   _accounting_change(p->size);
+   _index_change(ty, ts, -1, w);
    return ts;
 }
 
 Termsave *
 termpty_save_expand(Termpty *ty, Termsave *ts, Termcell *cells, size_t delta)
 {
-   Termcell *newcells;
+   Termsavepacked *p, *newp;
+   unsigned int w = ts->w, cp_shift;
+   size_t old_size;
 
-   newcells = realloc(ts->cells, (ts->w + delta) * sizeof(Termcell));
-   if (!newcells)
+   /* only the newest line grows, it is never on disk */
+   if ((ts->disk) || (!_save_extract(ty, ts)))
      return NULL;
+   _cache_forget(ty, ts);
+   p = TS_PACKED(ts);
+   old_size = p->size;
+
+   cp_shift = MAX(p->cp_shift, _cells_cp_shift(cells, delta));
+   if (cp_shift != p->cp_shift)
+     {
+        /* codepoints need more room, pack the whole line again */
+        Termcell *all = malloc((w + delta) * sizeof(Termcell));
 
-   memset(newcells + ts->w,
-          0, delta * sizeof(Termcell));
-   TERMPTY_CELL_COPY(ty, cells, &newcells[ts->w], (int)delta);
+        if (!all)
+          return NULL;
+        _packed_unpack(ty, p, all, w);
+        memcpy(all + w, cells, delta * sizeof(Termcell));
+        newp = _cells_pack(ty, all, w + delta);
+        free(all);
+        if (!newp)
+          return NULL;
+        _slab_free(ty, p, old_size);
+     }
+   else
+     {
+        const Termatt *last = (p->runs > 0) ?
+           &_packed_runs(p, w)[p->runs - 1].att : NULL;
+        unsigned int runs = p->runs +
+           _cells_runs_count(ty, last, cells, delta);
+        size_t size = _packed_runs_offset(w + delta, cp_shift) +
+           runs * sizeof(Termsaverun);
+
+        newp = _slab_realloc(ty, p, old_size, size);
+        if (!newp)
+          return NULL;
+        memmove(_packed_runs(newp, w + delta), _packed_runs(newp, w),
+                newp->runs * sizeof(Termsaverun));
+        newp->size = size;
+        _cps_write(newp, w, cells, delta);
+        newp->runs = _runs_write(ty, _packed_runs(newp, w + delta),
+                                 newp->runs, cells, delta);
+     }
+   _cells_ref(ty, cells, delta);
 
-   _accounting_change((-1) * (int64_t)(ts->w * sizeof(Termcell)));
+   _accounting_change((-1) * (int64_t)old_size);
+   _accounting_change(newp->size);
+   ts->data = newp;
    ts->w += delta;
-   _accounting_change(ts->w * sizeof(Termcell));
-   ts->cells = newcells;
+   _index_change(ty, ts, (int)w, (int)ts->w);
    return ts;
 }
 
 void
 termpty_save_free(Termpty *ty, Termsave *ts)
 {
-   unsigned int i;
+   size_t size;
+
    if (!ts) return;
-   if (ts->comp) ts_comp--;
-   else ts_uncomp--;
+   if (!ts->data) return;
+   ty->stats.backlog_freed++;
+   _index_change(ty, ts, ts->w, -1);
    ts_freeops++;
-   for (i = 0; i < ts->w; i++)
+   _cache_forget(ty, ts);
+   if (ts->disk)
+     {
+        _disk_line_free(ty, ts);
+        goto end;
+     }
+   ty->backlog_use.lines--;
+   /* hyperlinks are refcounted by cell */
+   if ((ts->comp) && (TS_COMP(ts)->links))
+     _save_extract(ty, ts);
+   if (ts->comp)
+     {
+        ts_comp--;
+        size = TS_COMP(ts)->size;
+     }
+   else
      {
-        if (EINA_UNLIKELY(ts->cells[i].att.link_id))
-          term_link_refcount_dec(ty, ts->cells[i].att.link_id, 1);
+        const Termsavepacked *p = TS_PACKED(ts);
+        const Termsaverun *runs = _packed_runs(p, ts->w);
+        unsigned int i;
+
+        ts_uncomp--;
+        for (i = 0; i < p->runs; i++)
+          {
+             unsigned int len = runs[i].len;
+
+             if (EINA_LIKELY(!runs[i].att.link_id))
+               continue;
+             for (; len > 0xffff; len -= 0xffff)
+               term_link_refcount_dec(ty, runs[i].att.link_id, 0xffff);
+             term_link_refcount_dec(ty, runs[i].att.link_id, len);
+          }
+        size = p->size;
      }
-   free(ts->cells);
-   ts->cells = NULL;
-   _accounting_change((-1) * (int64_t)(ts->w * sizeof(Termcell)));
+   _accounting_change((-1) * (int64_t)size);
+   _slab_free(ty, ts->data, size);
+end:
+   ts->data = NULL;
+   ts->comp = 0;
+   ts->disk = 0;
    ts->w = 0;
 }
 
+/* Frees the lines older than the y-th one, which can only be on disk.
+ * Returns how many there were */
+static size_t
+_backlog_free_older(Termpty *ty, size_t y)
+{
+   size_t evicted = 0;
+
+   for (y++; y <= ty->backsize - ty->backlog_use.freed; y++)
+     {
+        Termsave *ts = BACKLOG_ROW_GET(ty, y);
+
+        if (!ts->data)
+          continue;
+        termpty_save_free(ty, ts);
+        evicted++;
+     }
+   return evicted;
+}
+
+/* Returns how many lines were evicted or moved to disk */
+static size_t
+_backlog_evict_oldest(Termpty *ty, int64_t target)
+{
+   size_t y, evicted = 0, moved = 0;
+
+   for (y = ty->backsize - ty->backlog_use.evicted;
+        (y > 0) && (_mem_lines() > target) &&
+        (ty->backlog_use.lines > BACKLOG_EVICT_FLOOR);
+        y--)
+     {
+        Termsave *ts = BACKLOG_ROW_GET(ty, y);
+
+        if ((!ts->data) || (ts->disk))
+          continue;
+        if ((ty->config) && (ty->config->scrollback_disk > 0) && (y > 1) &&
+            (termpty_save_to_disk(ty, ts)))
+          {
+             moved++;
+             continue;
+          }
+        /* the scrollback is only ever trimmed from its oldest end, the
+         * older lines that went to disk go with that one */
+        evicted += _backlog_free_older(ty, y);
+        termpty_save_free(ty, ts);
+        evicted++;
+        ty->backlog_use.freed = ty->backsize - y + 1;
+     }
+   ty->backlog_use.evicted = ty->backsize - y;
+   if (evicted)
+     {
+        ty->stats.backlog_evicted += evicted;
+        _lines_evicted += evicted;
+        /* rows of the backlog show other lines */
+        ty->changes.rewritten = ty->changes.gen;
+     }
+   return evicted + moved;
+}
+
+void
+termpty_backlog_evict(int64_t budget)
+{
+   int64_t target;
+
+   if (_mem_lines() <= budget)
+     return;
+   /* leave some room not to evict again on the next line */
+   target = budget - budget / 10;
+   while (_mem_lines() > target)
+     {
+        Termpty *ty, *victim = NULL;
+        double victim_use = 0.0;
+        Eina_List *l;
+
+        EINA_LIST_FOREACH(ptys, l, ty)
+          {
+             double use = MAX(ty->backlog_use.viewed, ty->backlog_use.written);
+
+             if (ty->backlog_use.lines <= BACKLOG_EVICT_FLOOR)
+               continue;
+             if ((!victim) || (use < victim_use))
+               {
+                  victim = ty;
+                  victim_use = use;
+               }
+          }
+        if ((!victim) || (!_backlog_evict_oldest(victim, target)))
+          return;
+     }
+}
+
 void
 termpty_backlog_lock(void)
 {
@@ -127,9 +1832,17 @@ termpty_backlog_free(Termpty *ty)
 
    for (i = 0; i < ty->backsize; i++)
      termpty_save_free(ty, &ty->back[i]);
-   _accounting_change((-1) * (int64_t)(sizeof(Termsave) * ty->backsize));
+   _disk_free(ty);
+   _accounting_fixed_change((-1) *
+                            (int64_t)(sizeof(Termsave) * ty->backsize));
+   _index_free(ty);
+   _widths_free(ty);
    free(ty->back);
    ty->back = NULL;
+   ty->backlog_use.evicted = 0;
+   ty->backlog_use.freed = 0;
+   _cache_flush(ty);
+   _slab_flush(ty);
 }
 
 void
@@ -137,43 +1850,50 @@ termpty_clear_backlog(Termpty *ty)
 {
    int backsize;
 
-   ty->backlog_beacon.screen_y = 0;
-   ty->backlog_beacon.backlog_y = 0;
-
    termpty_backlog_lock();
    termpty_backlog_free(ty);
    ty->backpos = 0;
    backsize = ty->backsize;
    ty->backsize = 0;
    termpty_backlog_size_set(ty, backsize);
+   ty->changes.rewritten = ty->changes.gen;
    termpty_backlog_unlock();
 }
 
 ssize_t
 termpty_backlog_length(Termpty *ty)
 {
-   int backlog_y = ty->backlog_beacon.backlog_y;
-   int screen_y = ty->backlog_beacon.screen_y;
-
-   if (!ty->backsize)
+   if ((!ty->backsize) || (ty->w <= 0))
      return 0;
+   return _index_get(ty)->total;
+}
 
-   for (backlog_y++; backlog_y < (int)ty->backsize; backlog_y++)
-     {
-        int nb_lines;
-        const Termsave *ts;
-
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells)
-          goto end;
+Termsave *
+termpty_backlog_row_find(Termpty *ty, unsigned int row, unsigned int *offset)
+{
+   Termsave_Index *idx;
+   size_t newest, slot;
+   unsigned int rows;
 
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-        screen_y += nb_lines;
-        ty->backlog_beacon.screen_y = screen_y;
-        ty->backlog_beacon.backlog_y = backlog_y;
+   if ((!ty->backsize) || (ty->w <= 0) || (row == 0))
+     return NULL;
+   idx = _index_get(ty);
+   if ((row > idx->total) || (!_index_fill(ty, idx, row)))
+     return NULL;
+   /* lines get older from the newest slot down to 0, then from the last
+    * slot down to the newest one */
+   newest = (ty->backpos + ty->backsize - 2) % ty->backsize;
+   rows = _index_prefix(idx, newest + 1);
+   if (row > rows)
+     {
+        row -= rows;
+        if (row > idx->rows - rows)
+          return NULL;
+        rows = idx->rows;
      }
-end:
-     return ty->backlog_beacon.screen_y;
+   slot = _index_search(idx, ty->backsize, rows - row);
+   *offset = rows - _index_prefix(idx, slot) - row;
+   return &ty->back[slot];
 }
 
 
@@ -181,7 +1901,7 @@ void
 termpty_backlog_size_set(Termpty *ty, size_t size)
 {
    Termsave *new_back;
-   size_t i;
+   size_t i, k, n = 0;
 
    if (ty->backsize == size)
      return;
@@ -193,34 +1913,464 @@ termpty_backlog_size_set(Termpty *ty, size_t size)
         termpty_backlog_free(ty);
         goto end;
      }
-   if (size > ty->backsize)
+   new_back = calloc(1, sizeof(Termsave) * size);
+   if (!new_back)
      {
-        new_back = realloc(ty->back, sizeof(Termsave) * size);
-        if (!new_back)
-          return;
-        memset(new_back + ty->backsize, 0,
-               sizeof(Termsave) * (size - ty->backsize));
-        ty->back = new_back;
+        termpty_backlog_unlock();
+        return;
      }
-   else
+
+   /* lines are about to move */
+   _cache_flush(ty);
+   _index_free(ty);
+
+   /* keep the newest lines in order, the oldest one kept in slot 0 */
+   for (i = 1; i <= ty->backsize; i++)
      {
-        new_back = calloc(1, sizeof(Termsave) * size);
-        if (!new_back)
-          return;
-        for (i = 0; i < size; i++)
-          new_back[i] = ty->back[i];
-        for (i = size; i < ty->backsize; i++)
-          termpty_save_free(ty, &ty->back[i]);
-        free(ty->back);
-        ty->back = new_back;
-     }
-   _accounting_change((size - ty->backsize) * (int64_t)sizeof(Termsave));
+        if (BACKLOG_ROW_GET(ty, i)->data)
+          n++;
+     }
+   n = MIN(n, size);
+   for (i = 1, k = n; (i <= ty->backsize) && (k > 0); i++)
+     {
+        Termsave *ts = BACKLOG_ROW_GET(ty, i);
+
+        if (!ts->data)
+          continue;
+        new_back[--k] = *ts;
+        ts->data = NULL;
+     }
+   for (i = 0; i < ty->backsize; i++)
+     termpty_save_free(ty, &ty->back[i]);
+   free(ty->back);
+   ty->back = new_back;
+   _accounting_fixed_change((size - ty->backsize) *
+                            (int64_t)sizeof(Termsave));
 end:
-   ty->backpos = 0;
+   ty->backpos = (n > 0) ? (n + 1) % size : 0;
    ty->backsize = size;
-   /* Reset beacon */
-   ty->backlog_beacon.screen_y = 0;
-   ty->backlog_beacon.backlog_y = 0;
+   ty->backlog_use.evicted = 0;
+   ty->backlog_use.freed = 0;
+   ty->changes.rewritten = ty->changes.gen;
+   termpty_truecolor_sweep_restart(ty);
 
    termpty_backlog_unlock();
 }
+
+#if defined(BINARY_TYTEST)
+int
+tytest_backlog_compress(void)
+{
+   Termpty ty;
+   Termcell cells[200], out[200];
+   Termsavepacked *p;
+   Termsavecomp *comp;
+   unsigned int i;
+
+   memset(&ty, 0, sizeof(ty));
+   assert(termpty_atts_init(&ty));
+   memset(cells, 0, sizeof(cells));
+   for (i = 0; i < 200; i++)
+     {
+        Termatt att;
+
+        if (i < 20)
+          cells[i].codepoint = 'a' + i;
+        else if (i < 110)
+          cells[i].codepoint = ' ';
+        else if (i < 150)
+          cells[i].codepoint = 0x4e00 + i;
+        else
+          cells[i].codepoint = 0x1f600 + (i % 3);
+        memset(&att, 0, sizeof(att));
+        att.fg = (i / 7) % 5;
+        att.bold = (i > 100);
+        att.autowrapped = (i == 199);
+        termpty_cell_att_set(&ty, &cells[i], &att);
+     }
+
+   /* packing picks the smallest codepoints able to hold them all */
+   p = _cells_pack(&ty, cells, 20);
+   assert(p && p->cp_shift == 0 && p->runs == 3);
+   memset(out, 0xff, sizeof(out));
+   _packed_unpack(&ty, p, out, 20);
+   assert(!memcmp(cells, out, 20 * sizeof(Termcell)));
+   _slab_free(&ty, p, p->size);
+
+   p = _cells_pack(&ty, cells, 200);
+   assert(p && p->cp_shift == 2);
+   assert(p->size < 200 * (sizeof(Eina_Unicode) + sizeof(Termatt)) / 2);
+   memset(out, 0xff, sizeof(out));
+   _packed_unpack(&ty, p, out, 200);
+   assert(!memcmp(cells, out, sizeof(cells)));
+
+   comp = _packed_compress(&ty, p, 200);
+   assert(comp);
+   assert(comp->size < p->size);
+   memset(out, 0xff, sizeof(out));
+   _comp_uncompress(&ty, comp, out, 200);
+   assert(!memcmp(cells, out, sizeof(cells)));
+   _slab_free(&ty, comp, comp->size);
+   _slab_free(&ty, p, p->size);
+
+   /* not worth it */
+   memset(cells, 0, sizeof(cells));
+   for (i = 0; i < 200; i++)
+     cells[i].codepoint = 0x4e00 + i;
+   p = _cells_pack(&ty, cells, 200);
+   assert(p);
+   assert(!_packed_compress(&ty, p, 200));
+   _slab_free(&ty, p, p->size);
+
+   _cache_flush(&ty);
+   _slab_flush(&ty);
+   termpty_atts_shutdown(&ty);
+   return 0;
+}
+
+int
+tytest_backlog_slab(void)
+{
+   Termpty ty;
+   void *a, *b, *c;
+   uint64_t mallocs;
+
+   memset(&ty, 0, sizeof(ty));
+
+   /* blocks of a class share a chunk */
+   a = _slab_alloc(&ty, 100);
+   b = _slab_alloc(&ty, 112);
+   assert(a && b && (a != b));
+   assert(_slab_chunk(a) == _slab_chunk(b));
+   assert(ty.stats.backlog_mallocs == 1);
+
+   /* freed blocks are given out again */
+   _slab_free(&ty, a, 100);
+   c = _slab_alloc(&ty, 97);
+   assert(c == a);
+
+   /* growing in the same class keeps the block */
+   assert(_slab_realloc(&ty, c, 97, 112) == c);
+   a = _slab_realloc(&ty, c, 112, 113);
+   assert(a && (a != c) && (_slab_chunk(a) != _slab_chunk(b)));
+
+   /* empty chunks are kept once */
+   mallocs = ty.stats.backlog_mallocs;
+   _slab_free(&ty, a, 113);
+   _slab_free(&ty, b, 112);
+   assert(ty.backlog_slab.empty);
+   a = _slab_alloc(&ty, 16);
+   assert(ty.stats.backlog_mallocs == mallocs);
+   assert(!ty.backlog_slab.empty);
+   _slab_free(&ty, a, 16);
+
+   /* large lines are left to malloc() */
+   a = _slab_alloc(&ty, SLAB_BLOCK_MAX + 1);
+   assert(a && (ty.stats.backlog_mallocs == mallocs + 1));
+   _slab_free(&ty, a, SLAB_BLOCK_MAX + 1);
+
+   _slab_flush(&ty);
+   return 0;
+}
+
+int
+tytest_backlog_index(void)
+{
+   Termpty ty;
+   Termcell cells[25];
+   /* widths by slot, the newest line being in slot 1 */
+   const int widths[4] = { 10, 25, 3, 11 };
+   const struct { unsigned int row, slot, offset; } expected[] = {
+        { 1, 1, 2 }, { 3, 1, 0 }, { 4, 0, 0 }, { 5, 3, 1 }, { 6, 3, 0 },
+        { 7, 2, 0 },
+   };
+   unsigned int i, offset;
+
+   memset(&ty, 0, sizeof(ty));
+   assert(termpty_atts_init(&ty));
+   memset(cells, 0, sizeof(cells));
+   ty.w = 10;
+   ty.backsize = 4;
+   ty.back = calloc(ty.backsize, sizeof(Termsave));
+   assert(ty.back);
+   for (i = 0; i < 4; i++)
+     assert(termpty_save_new(&ty, &ty.back[i], cells, widths[i]));
+   ty.backpos = 3;
+
+   /* totals do not need lines to be counted, rows only as far as found */
+   assert(termpty_backlog_length(&ty) == 7);
+   assert(!ty.backlog_rows.index[0].tree);
+   assert(termpty_backlog_row_find(&ty, 2, &offset) == &ty.back[1]);
+   assert(ty.backlog_rows.index[0].lines == 1);
+   for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+     {
+        assert(termpty_backlog_row_find(&ty, expected[i].row, &offset) ==
+               &ty.back[expected[i].slot]);
+        assert(offset == expected[i].offset);
+     }
+   assert(!termpty_backlog_row_find(&ty, 8, &offset));
+
+   /* kept up to date as lines change, for every width used */
+   termpty_save_free(&ty, &ty.back[2]);
+   assert(termpty_backlog_length(&ty) == 6);
+   ty.w = 5;
+   assert(termpty_backlog_length(&ty) == 10);
+   assert(termpty_backlog_row_find(&ty, 10, &offset) == &ty.back[3]);
+   assert(offset == 0);
+   assert(termpty_save_new(&ty, BACKLOG_ROW_GET(&ty, 0), cells, 12));
+   termpty_backlog_advance(&ty);
+   assert(termpty_backlog_length(&ty) == 13);
+   assert(termpty_backlog_row_find(&ty, 3, &offset) == &ty.back[2]);
+   assert(offset == 0);
+   ty.w = 10;
+   assert(ty.backlog_rows.index[0].w == 10);
+   assert(termpty_backlog_length(&ty) == 8);
+   assert(termpty_backlog_row_find(&ty, 1, &offset) == &ty.back[2]);
+   assert(offset == 1);
+   termpty_save_free(&ty, BACKLOG_ROW_GET(&ty, 1));
+   termpty_backlog_retreat(&ty);
+   assert(termpty_backlog_length(&ty) == 6);
+   assert(termpty_backlog_row_find(&ty, 1, &offset) == &ty.back[1]);
+   assert(offset == 2);
+
+   termpty_backlog_free(&ty);
+   termpty_atts_shutdown(&ty);
+   return 0;
+}
+
+/* Lines of that many cells take about 1/30 of a segment */
+#define TEST_DISK_W 30000
+
+static void
+_test_disk_line(Termcell *cells, unsigned int k)
+{
+   unsigned int i;
+
+   /* no repeated codepoints, which would compress them away */
+   cells[0].codepoint = 0x100 + k;
+   for (i = 1; i < TEST_DISK_W; i++)
+     cells[i].codepoint = 'a' + (i + k) % 26;
+}
+
+static void
+_test_disk_check(Termpty *ty, unsigned int k)
+{
+   const Termcell *cells = termpty_save_cells_get(ty, &ty->back[k]);
+
+   assert(cells);
+   assert(cells[0].codepoint == 0x100 + k);
+   assert(cells[TEST_DISK_W - 1].codepoint ==
+          (Eina_Unicode)('a' + (TEST_DISK_W - 1 + k) % 26));
+}
+
+int
+tytest_backlog_disk(void)
+{
+   Termpty ty;
+   Termsave_Disk *disk;
+   Termcell *cells;
+   unsigned int k, n, cur_first, first_seg;
+   uint64_t mapped;
+   int fd;
+
+   memset(&ty, 0, sizeof(ty));
+   assert(termpty_atts_init(&ty));
+   cells = calloc(TEST_DISK_W, sizeof(Termcell));
+   assert(cells);
+   ty.backsize = 1000;
+   ty.back = calloc(ty.backsize, sizeof(Termsave));
+   assert(ty.back);
+
+   /* lines go to the current segment, then to the next ones once full */
+   for (k = 0; (!ty.backlog_disk) ||
+        (ty.backlog_disk->nb_segments <= DISK_MAPS + 1); k++)
+     {
+        _test_disk_line(cells, k);
+        assert(termpty_save_new(&ty, &ty.back[k], cells, TEST_DISK_W));
+        assert(termpty_save_to_disk(&ty, &ty.back[k]));
+        assert(ty.back[k].disk);
+     }
+   n = k;
+   disk = ty.backlog_disk;
+   assert(ty.backlog_use.lines == 0);
+   assert(_disk_segment(&ty.back[0]) == 0);
+   assert(_disk_segment(&ty.back[n - 1]) == disk->cur);
+
+   /* read back across segments, at most DISK_MAPS of them being mapped */
+   for (k = 0; k < n; k++)
+     _test_disk_check(&ty, k);
+   assert(disk->nb_maps == DISK_MAPS);
+   first_seg = _disk_segment(&ty.back[0]);
+   assert(!disk->segments[first_seg].map);
+
+   /* their map was evicted, the first lines are mapped again */
+   mapped = ty.stats.backlog_mapped;
+   _test_disk_check(&ty, 0);
+   assert(disk->segments[first_seg].map);
+   assert(ty.stats.backlog_mapped == mapped + 1);
+   assert(disk->nb_maps == DISK_MAPS);
+
+   /* once a segment can not be written, the lines it held get back to
+    * memory and no more lines go to disk */
+   for (cur_first = n;
+        _disk_segment(&ty.back[cur_first - 1]) == disk->cur;
+        cur_first--)
+     ;
+   fd = open("/dev/null", O_RDONLY);
+   assert(fd >= 0);
+   assert(dup2(fd, disk->fd) == disk->fd);
+   close(fd);
+   for (k = n; !disk->failed; k++)
+     {
+        assert(k < ty.backsize);
+        _test_disk_line(cells, k);
+        assert(termpty_save_new(&ty, &ty.back[k], cells, TEST_DISK_W));
+        if (!termpty_save_to_disk(&ty, &ty.back[k]))
+          break;
+     }
+   assert(disk->failed);
+   assert(!ty.back[k].disk);
+   for (n = 0; n <= k; n++)
+     assert(ty.back[n].disk == (n < cur_first));
+   _test_disk_check(&ty, k);
+   _test_disk_check(&ty, k - 1);
+   _test_disk_check(&ty, 0);
+   assert(!termpty_save_to_disk(&ty, &ty.back[k]));
+
+   /* so do they once there is no segment left to start */
+   termpty_backlog_free(&ty);
+   ty.back = calloc(ty.backsize, sizeof(Termsave));
+   assert(ty.back);
+   _test_disk_line(cells, 0);
+   assert(termpty_save_new(&ty, &ty.back[0], cells, TEST_DISK_W));
+   assert(termpty_save_to_disk(&ty, &ty.back[0]));
+   disk = ty.backlog_disk;
+   disk->segments = realloc(disk->segments,
+                            DISK_SEGMENTS_MAX * sizeof(Termsave_Segment));
+   assert(disk->segments);
+   memset(disk->segments + 1, 0,
+          (DISK_SEGMENTS_MAX - 1) * sizeof(Termsave_Segment));
+   for (n = 1; n < DISK_SEGMENTS_MAX; n++)
+     disk->segments[n].lines = 1;
+   disk->nb_segments = DISK_SEGMENTS_MAX;
+   for (k = 1; !disk->failed; k++)
+     {
+        assert(k < ty.backsize);
+        _test_disk_line(cells, k);
+        assert(termpty_save_new(&ty, &ty.back[k], cells, TEST_DISK_W));
+        if (!termpty_save_to_disk(&ty, &ty.back[k]))
+          break;
+     }
+   assert(disk->failed);
+   assert(disk->len == 0);
+   assert(disk->cur == 0);
+   for (n = 0; n <= k; n++)
+     {
+        assert(!ty.back[n].disk);
+        _test_disk_check(&ty, n);
+     }
+   assert(!termpty_save_to_disk(&ty, &ty.back[k]));
+
+   free(cells);
+   termpty_backlog_free(&ty);
+   termpty_atts_shutdown(&ty);
+   return 0;
+}
+
+/* Lines with more distinct attributes than that can not go to disk */
+#define TEST_EVICT_W (DISK_ATTS_MAX + 1)
+
+/* Every 500th line can not be moved to disk, the others can */
+static void
+_test_evict_add(Termpty *ty, Termcell *cells, unsigned int from,
+                unsigned int to)
+{
+   unsigned int k;
+
+   for (k = from; k < to; k++)
+     {
+        cells[0].codepoint = 0x100 + k;
+        assert(termpty_save_new(ty, BACKLOG_ROW_GET(ty, 0), cells,
+                                (k % 500) ? 10 : TEST_EVICT_W));
+        termpty_backlog_advance(ty);
+     }
+}
+
+/* What is left is the newest of the @n lines added, without holes.
+ * Returns how many of them are on disk */
+static unsigned int
+_test_evict_check(Termpty *ty, unsigned int n)
+{
+   unsigned int disk = 0;
+   size_t y;
+
+   for (y = 1; (y <= ty->backsize) && (BACKLOG_ROW_GET(ty, y)->data); y++)
+     {
+        const Termsave *ts = BACKLOG_ROW_GET(ty, y);
+        const Termcell *c = termpty_save_cells_get(ty, ts);
+
+        assert(c);
+        assert(c[0].codepoint == 0x100 + n - y);
+        if (ts->disk)
+          disk++;
+     }
+   assert(y - 1 == n - ty->stats.backlog_evicted);
+   for (; y <= ty->backsize; y++)
+     assert(!BACKLOG_ROW_GET(ty, y)->data);
+   /* eviction goes on from where it stopped */
+   for (y = ty->backsize - ty->backlog_use.evicted + 1; y <= ty->backsize;
+        y++)
+     {
+        const Termsave *ts = BACKLOG_ROW_GET(ty, y);
+
+        assert((!ts->data) || (ts->disk));
+     }
+   return disk;
+}
+
+int
+tytest_backlog_evict(void)
+{
+   Termpty ty;
+   Config config;
+   Termcell cells[TEST_EVICT_W];
+   Termatt att;
+   unsigned int i;
+
+   memset(&ty, 0, sizeof(ty));
+   memset(&config, 0, sizeof(config));
+   config.scrollback_disk = 1;
+   ty.config = &config;
+   assert(termpty_atts_init(&ty));
+   ty.w = 80;
+   ty.backsize = 4000;
+   ty.back = calloc(ty.backsize, sizeof(Termsave));
+   assert(ty.back);
+   memset(&att, 0, sizeof(att));
+   for (i = 0; i < TEST_EVICT_W; i++)
+     {
+        att.fg = i % 256;
+        att.bg = i / 256;
+        cells[i].codepoint = 'a';
+        cells[i].att_id = termpty_att_id(&ty, &att);
+     }
+
+   _test_evict_add(&ty, cells, 0, 3000);
+   assert(_backlog_evict_oldest(&ty, 0) > 0);
+   assert(ty.stats.backlog_evicted > 0);
+   assert(ty.backlog_use.lines <= BACKLOG_EVICT_FLOOR);
+   assert(ty.backlog_use.evicted > 0);
+   assert(_test_evict_check(&ty, 3000) > 0);
+
+   /* again, once the ring wrapped around */
+   _test_evict_add(&ty, cells, 3000, 5000);
+   assert(_backlog_evict_oldest(&ty, 0) > 0);
+   assert(ty.backlog_use.lines <= BACKLOG_EVICT_FLOOR);
+   assert(_test_evict_check(&ty, 5000) > 0);
+
+   termpty_backlog_free(&ty);
+   termpty_atts_shutdown(&ty);
+   return 0;
+}
+#endif
+
@@ -3,8 +3,13 @@
 
 void termpty_save_register(Termpty *ty);
 void termpty_save_unregister(Termpty *ty);
-Termsave *termpty_save_extract(Termsave *ts);
-Termsave *termpty_save_new(Termpty *ty, Termsave *ts, int w);
+typedef void (*Termsave_Att_Cb)(const Termatt *att, void *data);
+
+void termpty_save_compress(Termpty *ty, Termsave *ts);
+Termcell *termpty_save_cells_get(Termpty *ty, const Termsave *ts);
+Eina_Bool termpty_save_autowrapped_get(Termpty *ty, const Termsave *ts);
+Eina_Bool termpty_save_to_disk(Termpty *ty, Termsave *ts);
+Termsave *termpty_save_new(Termpty *ty, Termsave *ts, Termcell *cells, int w);
 void termpty_save_free(Termpty *ty, Termsave *ts);
 Termsave *termpty_save_expand(Termpty *ty, Termsave *ts,
                               Termcell *cells, size_t delta);
@@ -20,11 +25,27 @@ void
 termpty_backlog_size_set(Termpty *ty, size_t size);
 ssize_t
 termpty_backlog_length(Termpty *ty);
+size_t
+termpty_backlog_atts_foreach(Termpty *ty, size_t y, size_t n,
+                             Termsave_Att_Cb cb, void *data);
+Termsave *
+termpty_backlog_row_find(Termpty *ty, unsigned int row, unsigned int *offset);
+void
+termpty_backlog_advance(Termpty *ty);
+void
+termpty_backlog_retreat(Termpty *ty);
 
 int64_t
 termpty_backlog_memory_get(void);
+uint64_t
+termpty_backlog_evicted_get(void);
+void
+termpty_backlog_evict(int64_t budget);
+
+/* lines each terminal keeps whatever the scrollback budget */
+#define BACKLOG_EVICT_FLOOR 1000
 
 #define BACKLOG_ROW_GET(Ty, Y) \
-   (&Ty->back[(Ty->backsize - 1 + ty->backpos - Y) % Ty->backsize])
+   (&(Ty)->back[((Ty)->backsize - 1 + (Ty)->backpos - (Y)) % (Ty)->backsize])
 
 #endif
@@ -1,8 +1,12 @@
 #include "private.h"
 #include <assert.h>
+#include <limits.h>
 #include <Elementary.h>
 #include "config.h"
 #include "colors.h"
+#if defined(BINARY_TYTEST)
+#include "unit_tests.h"
+#endif
 
 #define COLORSCHEMES_FILENAME "colorschemes.eet"
 #define COLORSCHEMES_VERSION  1
@@ -450,12 +454,255 @@ static Eet_Data_Descriptor *edd_cs = NULL;
 static Eet_Data_Descriptor *edd_cb = NULL;
 static Eet_Data_Descriptor *edd_color = NULL;
 
+/* {{{ Nearest color in a 256 colors palette
+ *
+ * The RGB space is cut in CUBE_SIDE^3 boxes.  For each box is kept the list
+ * of the palette colors that can be the nearest one to a color in that box:
+ * those whose distance to the box can be lower than the largest distance of
+ * the best color to the box.  Finding the nearest color is then an exact
+ * search among a handful of candidates.
+ *
+ * Cubes are shared between the textgrids using the same palette.
+ */
+
+#define CUBE_BITS 4
+#define CUBE_SIDE (1 << CUBE_BITS)
+#define CUBE_STEP (256 / CUBE_SIDE)
+#define CUBE_BOXES (CUBE_SIDE * CUBE_SIDE * CUBE_SIDE)
+
+struct _Color_Cube
+{
+   Color palette[256];
+   int refcount;
+   uint32_t offsets[CUBE_BOXES + 1];
+   uint8_t *candidates;
+};
+
+static Eina_List *_cubes = NULL;
+static Color_Cube *_default_cube = NULL;
+
+/* XXX: this is inacurate but should give good enough results.
+ * See https://en.wikipedia.org/wiki/Color_difference
+ */
+static inline int
+_color_distance(int r0, int g0, int b0, const Color *c)
+{
+   int red_mean = (r0 + c->r) / 2;
+   int delta_red_sq = (r0 - c->r) * (r0 - c->r);
+   int delta_green_sq = (g0 - c->g) * (g0 - c->g);
+   int delta_blue_sq = (b0 - c->b) * (b0 - c->b);
+
+   return 2 * delta_red_sq
+      + 4 * delta_green_sq
+      + 3 * delta_blue_sq
+      + ((red_mean) * (delta_red_sq - delta_blue_sq) / 256);
+}
+
+uint8_t
+colors_palette_nearest(const Color palette[256],
+                       uint8_t r, uint8_t g, uint8_t b)
+{
+   int c, distance_min = INT_MAX;
+   uint8_t chosen_color = 0;
+
+   for (c = 0; c < 256; c++)
+     {
+        int distance = _color_distance(r, g, b, &palette[c]);
+
+        if (distance < distance_min)
+          {
+             distance_min = distance;
+             chosen_color = c;
+          }
+     }
+   return chosen_color;
+}
+
+static inline int
+_axis_distance_min(int v, int lo, int hi)
+{
+   if (v < lo)
+     return lo - v;
+   if (v > hi)
+     return v - hi;
+   return 0;
+}
+
+static inline int
+_axis_distance_max(int v, int lo, int hi)
+{
+   return MAX(abs(v - lo), abs(v - hi));
+}
+
+static Eina_Bool
+_cube_build(Color_Cube *cube)
+{
+   size_t len = 0, size = CUBE_BOXES * 8;
+   int i, c;
+
+   cube->candidates = malloc(size);
+   if (!cube->candidates)
+     return EINA_FALSE;
+
+   for (i = 0; i < CUBE_BOXES; i++)
+     {
+        int r = (i / (CUBE_SIDE * CUBE_SIDE)) * CUBE_STEP;
+        int g = ((i / CUBE_SIDE) % CUBE_SIDE) * CUBE_STEP;
+        int b = (i % CUBE_SIDE) * CUBE_STEP;
+        int upper = INT_MAX;
+
+        /* The red mean term of the distance is within ]-db², dr²[ */
+        for (c = 0; c < 256; c++)
+          {
+             const Color *col = &cube->palette[c];
+             int dr = _axis_distance_max(col->r, r, r + CUBE_STEP - 1);
+             int dg = _axis_distance_max(col->g, g, g + CUBE_STEP - 1);
+             int db = _axis_distance_max(col->b, b, b + CUBE_STEP - 1);
+
+             upper = MIN(upper, 3 * dr * dr + 4 * dg * dg + 3 * db * db);
+          }
+        cube->offsets[i] = len;
+        for (c = 0; c < 256; c++)
+          {
+             const Color *col = &cube->palette[c];
+             int dr = _axis_distance_min(col->r, r, r + CUBE_STEP - 1);
+             int dg = _axis_distance_min(col->g, g, g + CUBE_STEP - 1);
+             int db = _axis_distance_min(col->b, b, b + CUBE_STEP - 1);
+
+             if (2 * dr * dr + 4 * dg * dg + 2 * db * db > upper)
+               continue;
+             if (len == size)
+               {
+                  uint8_t *candidates = realloc(cube->candidates, size * 2);
+
+                  if (!candidates)
+                    return EINA_FALSE;
+                  cube->candidates = candidates;
+                  size *= 2;
+               }
+             cube->candidates[len++] = c;
+          }
+     }
+   cube->offsets[CUBE_BOXES] = len;
+   return EINA_TRUE;
+}
+
+static Eina_Bool
+_palette_equal(const Color *p1, const Color *p2)
+{
+   int c;
+
+   for (c = 0; c < 256; c++)
+     {
+        if ((p1[c].r != p2[c].r) || (p1[c].g != p2[c].g) ||
+            (p1[c].b != p2[c].b))
+          return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+Color_Cube *
+colors_cube_ref(const Color palette[256])
+{
+   Color_Cube *cube;
+   Eina_List *l;
+
+   EINA_LIST_FOREACH(_cubes, l, cube)
+     {
+        if (_palette_equal(cube->palette, palette))
+          {
+             cube->refcount++;
+             return cube;
+          }
+     }
+
+   cube = calloc(1, sizeof(Color_Cube));
+   if (!cube)
+     return NULL;
+   memcpy(cube->palette, palette, sizeof(cube->palette));
+   if (!_cube_build(cube))
+     {
+        ERR("not enough memory to build a color cube");
+        free(cube->candidates);
+        free(cube);
+        return NULL;
+     }
+   cube->refcount = 1;
+   _cubes = eina_list_prepend(_cubes, cube);
+   return cube;
+}
+
+void
+colors_cube_unref(Color_Cube *cube)
+{
+   if (!cube)
+     return;
+   if (--cube->refcount > 0)
+     return;
+   _cubes = eina_list_remove(_cubes, cube);
+   free(cube->candidates);
+   free(cube);
+}
+
+uint8_t
+colors_cube_nearest(const Color_Cube *cube,
+                    uint8_t r, uint8_t g, uint8_t b)
+{
+   int i = (((r >> (8 - CUBE_BITS)) * CUBE_SIDE) + (g >> (8 - CUBE_BITS)))
+      * CUBE_SIDE + (b >> (8 - CUBE_BITS));
+   int distance_min = INT_MAX;
+   uint8_t chosen_color = 0;
+   uint32_t k;
+
+   for (k = cube->offsets[i]; k < cube->offsets[i + 1]; k++)
+     {
+        uint8_t c = cube->candidates[k];
+        int distance = _color_distance(r, g, b, &cube->palette[c]);
+
+        if (distance < distance_min)
+          {
+             distance_min = distance;
+             chosen_color = c;
+          }
+     }
+   return chosen_color;
+}
+
+static void
+_cb_textgrid_del(void *_data EINA_UNUSED,
+                 Evas *_e EINA_UNUSED,
+                 Evas_Object *textgrid,
+                 void *_event EINA_UNUSED)
+{
+   colors_cube_unref(evas_object_data_del(textgrid, "color_cube"));
+}
+
+/* Cube of the extended palette of that textgrid, or of the default one if
+ * colors_term_init() was not called on it */
+const Color_Cube *
+colors_term_cube_get(const Evas_Object *textgrid)
+{
+   const Color_Cube *cube = NULL;
+
+   if (textgrid)
+     cube = evas_object_data_get(textgrid, "color_cube");
+   if (cube)
+     return cube;
+   if (!_default_cube)
+     _default_cube = colors_cube_ref(default_colors256);
+   return _default_cube;
+}
+
+/* }}} */
+
 void
 colors_term_init(Evas_Object *textgrid,
                  const Color_Scheme *cs)
 {
    int c;
    int r, g , b, a;
+   Color palette[256];
+   Color_Cube *cube, *old_cube;
 
    if (!cs)
      cs = &default_colorscheme;
@@ -540,6 +787,7 @@ colors_term_init(Evas_Object *textgrid,
         evas_object_textgrid_palette_set(                  \
            textgrid, EVAS_TEXTGRID_PALETTE_EXTENDED, _c,   \
            r, g, b, a);                                    \
+        palette[_c] = cs->_F;                              \
    } while (0)
 
    CS_SET(0 /* black */,   normal.black);
@@ -569,8 +817,18 @@ colors_term_init(Evas_Object *textgrid,
         evas_object_textgrid_palette_set(
            textgrid, EVAS_TEXTGRID_PALETTE_EXTENDED, c,
            r, g, b, a);
+        palette[c] = default_colors256[c];
      }
 #undef CS_SET
+
+   cube = colors_cube_ref(palette);
+   old_cube = evas_object_data_get(textgrid, "color_cube");
+   if (old_cube)
+     colors_cube_unref(old_cube);
+   else
+     evas_object_event_callback_add(textgrid, EVAS_CALLBACK_DEL,
+                                    _cb_textgrid_del, NULL);
+   evas_object_data_set(textgrid, "color_cube", cube);
 }
 
 void
@@ -988,6 +1246,9 @@ colors_init(void)
 void
 colors_shutdown(void)
 {
+   colors_cube_unref(_default_cube);
+   _default_cube = NULL;
+
    eet_data_descriptor_free(edd_cs);
    edd_cs = NULL;
 
@@ -997,3 +1258,35 @@ colors_shutdown(void)
    eet_data_descriptor_free(edd_color);
    edd_color = NULL;
 }
+
+#if defined(BINARY_TYTEST)
+int
+tytest_color_cube(void)
+{
+   Color palette[256];
+   Color_Cube *cube, *cube2;
+   int r, g, b;
+
+   memcpy(palette, default_colors256, sizeof(palette));
+   /* a color scheme only changes the first 16 colors */
+   palette[1] = (Color){ .r = 0xdc, .g = 0x32, .b = 0x2f, .a = 0xff };
+   palette[4] = (Color){ .r = 0x26, .g = 0x8b, .b = 0xd2, .a = 0xff };
+
+   cube = colors_cube_ref(palette);
+   assert(cube);
+   cube2 = colors_cube_ref(palette);
+   assert(cube2 == cube);
+   colors_cube_unref(cube2);
+
+   for (r = 0; r < 256; r += 3)
+     for (g = 0; g < 256; g += 5)
+       for (b = 0; b < 256; b += 7)
+         assert(colors_cube_nearest(cube, r, g, b) ==
+                colors_palette_nearest(palette, r, g, b));
+   assert(colors_cube_nearest(cube, 255, 255, 255) ==
+          colors_palette_nearest(palette, 255, 255, 255));
+
+   colors_cube_unref(cube);
+   return 0;
+}
+#endif
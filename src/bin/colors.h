@@ -52,9 +52,23 @@ struct _Color_Scheme
    Color_Block brightfaint;
 };
 
+typedef struct _Color_Cube Color_Cube;
+
 void
 colors_term_init(Evas_Object *textgrid,
                  const Color_Scheme *cs);
+const Color_Cube *
+colors_term_cube_get(const Evas_Object *textgrid);
+Color_Cube *
+colors_cube_ref(const Color palette[256]);
+void
+colors_cube_unref(Color_Cube *cube);
+uint8_t
+colors_cube_nearest(const Color_Cube *cube,
+                    uint8_t r, uint8_t g, uint8_t b);
+uint8_t
+colors_palette_nearest(const Color palette[256],
+                       uint8_t r, uint8_t g, uint8_t b);
 void
 colors_standard_get(int set,
                     int col,
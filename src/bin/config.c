@@ -7,7 +7,7 @@
 #include "colors.h"
 #include "theme.h"
 
-#define CONF_VER 26
+#define CONF_VER 32
 #define CONFIG_KEY "config"
 
 #define LIM(v, min, max) {if (v >= max) v = max; else if (v <= min) v = min;}
@@ -111,8 +111,18 @@ config_init(void)
      (edd_base, Config, "background", background, EET_T_STRING);
    EET_DATA_DESCRIPTOR_ADD_BASIC
      (edd_base, Config, "scrollback", scrollback, EET_T_INT);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "scrollback_compress", scrollback_compress, EET_T_INT);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "scrollback_budget", scrollback_budget, EET_T_INT);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "scrollback_disk", scrollback_disk, EET_T_INT);
    EET_DATA_DESCRIPTOR_ADD_BASIC
      (edd_base, Config, "tab_zoom", tab_zoom, EET_T_DOUBLE);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "read_budget", read_budget, EET_T_DOUBLE);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "flood_fps", flood_fps, EET_T_INT);
    EET_DATA_DESCRIPTOR_ADD_BASIC
      (edd_base, Config, "vidmod", _vidmod, EET_T_INT); /* DEPRECATED */
    EET_DATA_DESCRIPTOR_ADD_BASIC
@@ -199,6 +209,8 @@ config_init(void)
      (edd_base, Config, "hide_cursor", hide_cursor, EET_T_DOUBLE);
    EET_DATA_DESCRIPTOR_ADD_BASIC
      (edd_base, Config, "group_all", group_all, EET_T_UCHAR);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "reader_thread", reader_thread, EET_T_UCHAR);
 }
 
 void
@@ -286,7 +298,12 @@ config_sync(const Config *config_src, Config *config)
    eina_stringshare_replace(&(config->theme), config_src->theme);
    eina_stringshare_replace(&(config->color_scheme_name), config_src->color_scheme_name);
    config->scrollback = config_src->scrollback;
+   config->scrollback_compress = config_src->scrollback_compress;
+   config->scrollback_budget = config_src->scrollback_budget;
+   config->scrollback_disk = config_src->scrollback_disk;
    config->tab_zoom = config_src->tab_zoom;
+   config->read_budget = config_src->read_budget;
+   config->flood_fps = config_src->flood_fps;
    config->hide_cursor = config_src->hide_cursor;
    config->jump_on_keypress = config_src->jump_on_keypress;
    config->jump_on_change = config_src->jump_on_change;
@@ -326,6 +343,7 @@ config_sync(const Config *config_src, Config *config)
    config->translucent = config_src->translucent;
    config->opacity = config_src->opacity;
    config->group_all = config_src->group_all;
+   config->reader_thread = config_src->reader_thread;
 }
 
 static void
@@ -550,10 +568,15 @@ config_new(void)
         config->helper.local.image = eina_stringshare_add("xdg-open");
         config->helper.inline_please = EINA_TRUE;
         config->scrollback = 2000;
+        config->scrollback_compress = 1000;
+        config->scrollback_budget = 0;
+        config->scrollback_disk = 0;
         config->theme = eina_stringshare_add("default.edj");
         config->color_scheme_name = eina_stringshare_add("Default");
         config->background = NULL;
         config->tab_zoom = 0.5;
+        config->read_budget = 0.5;
+        config->flood_fps = 10;
         config->opacity = 50;
         config->cg_width = 80;
         config->cg_height = 24;
@@ -605,6 +628,7 @@ config_new(void)
         config->shine = 255;
         config->hide_cursor = 5.0;
         config->group_all = EINA_FALSE;
+        config->reader_thread = EINA_FALSE;
         config_compute_color_scheme(config);
      }
    return config;
@@ -778,7 +802,31 @@ config_load(void)
                   config_compute_color_scheme(config);
                   EINA_FALLTHROUGH;
                   /*pass through*/
-                case CONF_VER: /* 26 */
+                case 26:
+                  config->reader_thread = EINA_FALSE;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case 27:
+                  config->read_budget = 0.5;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case 28:
+                  config->scrollback_compress = 1000;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case 29:
+                  config->scrollback_budget = 0;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case 30:
+                  config->scrollback_disk = 0;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case 31:
+                  config->flood_fps = 10;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case CONF_VER: /* 32 */
                   config->version = CONF_VER;
                   break;
                 default:
@@ -793,6 +841,9 @@ config_load(void)
                   /* do nothing in case the config is from a newer
                    * terminology, we don't want to remove it. */
                }
+             /* values edited by hand or from a broken file */
+             LIM(config->read_budget, 0.1, 2.0);
+             LIM(config->flood_fps, 0, 60);
           }
      }
    if (!config)
@@ -846,7 +897,12 @@ config_fork(const Config *config)
    config2->color_scheme = color_scheme_dup(config->color_scheme);
    SCPY(background);
    CPY(scrollback);
+   CPY(scrollback_compress);
+   CPY(scrollback_budget);
+   CPY(scrollback_disk);
    CPY(tab_zoom);
+   CPY(read_budget);
+   CPY(flood_fps);
    CPY(hide_cursor);
    CPY(jump_on_change);
    CPY(jump_on_keypress);
@@ -886,6 +942,7 @@ config_fork(const Config *config)
    CPY(emoji_dbl_width);
    CPY(shine);
    CPY(group_all);
+   CPY(reader_thread);
 
    EINA_LIST_FOREACH(config->keys, l, key)
      {
@@ -40,6 +40,9 @@ struct _Config
 {
    int               version;
    int               scrollback;
+   int               scrollback_compress; /* lines kept uncompressed, 0 for all of them */
+   int               scrollback_budget; /* MiB of lines for all terminals, 0 for no limit */
+   int               scrollback_disk; /* lines kept in memory before moving them to disk, 0 for never */
    struct {
       const char    *name;
       const char    *orig_name; /* not in EET */
@@ -63,6 +66,8 @@ struct _Config
    const Color_Scheme *color_scheme; /* not in EET */
    const char       *background;
    double            tab_zoom;
+   double            read_budget;
+   int               flood_fps; /* renders per second while flooded with output, 0 to never throttle */
    double            hide_cursor;
    int               _vidmod; /* DEPRECATED */
    int               opacity;
@@ -103,6 +108,7 @@ struct _Config
    Eina_Bool         changedir_to_current;
    Eina_Bool         emoji_dbl_width;
    Eina_Bool         group_all;
+   Eina_Bool         reader_thread;
    Color             colors[(4 * 12)];
    Eina_List        *keys;
 
@@ -81,47 +81,27 @@ struct _Miniview
 static Evas_Smart *_smart = NULL;
 
 static void
-_draw_cell(const Termpty *ty, unsigned int *pixel, const Termcell *cell, unsigned int *colors)
+_draw_cell(const Termpty *ty, unsigned int *pixel, const Termcell *cell,
+           const Evas_Textgrid_Cell *atts, unsigned int *colors)
 {
-   int fg, bg, fgext, bgext;
-   int inv = ty->termstate.reverse;
+   const Termatt *att = termpty_cell_att(ty, cell);
+   const Evas_Textgrid_Cell *ac = &atts[cell->att_id];
    Eina_Unicode codepoint;
 
    codepoint = cell->codepoint;
-   if ((codepoint == 0) || (cell->att.newline) || (cell->att.invisible))
+   if ((codepoint == 0) || (att->newline) || (att->invisible))
      {
         *pixel = 0;
         return;
      }
-   // colors
-   fg = cell->att.fg;
-   bg = cell->att.bg;
-   fgext = cell->att.fg256;
-   bgext = cell->att.bg256;
-
-   if ((fg == COL_DEF) && (cell->att.inverse ^ inv)) fg = COL_INVERSEBG;
-   if (bg == COL_DEF)
-     {
-        if (cell->att.inverse ^ inv) bg = COL_INVERSE;
-        else if (!bgext) bg = COL_INVIS;
-     }
-   if ((cell->att.fgintense) && (!fgext)) fg += 48;
-   if ((cell->att.bgintense) && (!bgext)) bg += 48;
-   if (cell->att.inverse ^ inv)
-     {
-        int t;
-        t = fgext; fgext = bgext; bgext = t;
-        t = fg; fg = bg; bg = t;
-     }
-   if ((cell->att.bold) && (!fgext)) fg += 12;
-   if ((cell->att.faint) && (!fgext)) fg += 24;
-
-   if (bgext) *pixel = colors[bg + 256];
-   else if (bg && ((bg % 12) != COL_INVIS)) *pixel = colors[bg];
+   if (ac->bg_extended) *pixel = colors[ac->bg + 256];
+   else if ((ac->bg >= TRUECOLOR_PALETTE_SLOT(1)) ||
+            ((ac->bg) && ((ac->bg % 12) != COL_INVIS)))
+     *pixel = colors[ac->bg];
    else if ((codepoint > 32) && (codepoint < 0x00110000))
      {
-        if (fgext) *pixel = colors[fg + 256];
-        else *pixel = colors[fg];
+        if (ac->fg_extended) *pixel = colors[ac->fg + 256];
+        else *pixel = colors[ac->fg];
      }
    else
      *pixel = 0;
@@ -129,13 +109,14 @@ _draw_cell(const Termpty *ty, unsigned int *pixel, const Termcell *cell, unsigne
 
 static void
 _draw_line(const Termpty *ty, unsigned int *pixels,
-           const Termcell *cells, int length, unsigned int *colors)
+           const Termcell *cells, int length,
+           const Evas_Textgrid_Cell *atts, unsigned int *colors)
 {
    int x;
 
    for (x = 0 ; x < length; x++)
      {
-        _draw_cell(ty, pixels + x, cells + x, colors);
+        _draw_cell(ty, pixels + x, cells + x, atts, colors);
      }
 }
 
@@ -520,6 +501,7 @@ _deferred_renderer(void *data)
    unsigned int *pixels, y;
    Termpty *ty;
    unsigned int colors[512];
+   const Evas_Textgrid_Cell *atts;
    double bottom_bound;
 
    if (!mv) return EINA_FALSE;
@@ -559,7 +541,11 @@ _deferred_renderer(void *data)
 
         if (!cells)
           break;
-        _draw_line(ty, &pixels[y * mv->cols], cells, wret, colors);
+        /* after the row, reading the backlog may intern attributes */
+        atts = termio_atts_textgrid_get(mv->termio);
+        if (!atts)
+          break;
+        _draw_line(ty, &pixels[y * mv->cols], cells, wret, atts, colors);
      }
    evas_object_image_data_set(mv->img, pixels);
    evas_object_image_pixels_dirty_set(mv->img, EINA_FALSE);
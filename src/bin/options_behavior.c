@@ -20,6 +20,7 @@ typedef struct _Behavior_Ctx {
      Evas_Object *op_h;
      Evas_Object *op_wh_current;
      Evas_Object *backlock_label;
+     Evas_Object *sback_slider;
      char *backlog_msg;
 } Behavior_Ctx;
 
@@ -41,14 +42,23 @@ OPTIONS_CB(Behavior_Ctx, ty_escapes, 0);
 OPTIONS_CB(Behavior_Ctx, changedir_to_current, 0);
 OPTIONS_CB(Behavior_Ctx, emoji_dbl_width, 0);
 OPTIONS_CB(Behavior_Ctx, group_all, 0);
+OPTIONS_CB(Behavior_Ctx, reader_thread, 0);
+
+/* The ring of a scrollback takes 16 bytes a line, even once the lines went
+ * to disk: only then can it hold up to 4M lines */
+static double
+sback_max_get(const Config *config)
+{
+    return (config->scrollback_disk > 0) ? 22.0 : 17.0;
+}
 
 static unsigned int
 sback_double_to_expo_int(double d)
 {
     if (d < 1.0)
         return 0;
-    if (d >= 17.0)
-        d = 17.0;
+    if (d >= 22.0)
+        d = 22.0;
     return 1 << (unsigned char) d;
 }
 
@@ -68,6 +78,7 @@ _update_backlog_title(Behavior_Ctx *ctx)
 {
    char *factor = " KMG";
    double amount = termpty_backlog_memory_get();
+   unsigned long long evicted = termpty_backlog_evicted_get();
 
    while (amount > 1024.0 && factor[1] != '\0')
      {
@@ -75,9 +86,14 @@ _update_backlog_title(Behavior_Ctx *ctx)
         factor++;
      }
    eina_stringshare_del(ctx->backlog_msg);
-   ctx->backlog_msg = (char*) eina_stringshare_printf(
-      _("Scrollback (current memory usage: %'.2f%cB):"),
-      amount, factor[0]);
+   if (evicted)
+     ctx->backlog_msg = (char*) eina_stringshare_printf(
+        _("Scrollback (current memory usage: %'.2f%cB, %'llu lines evicted):"),
+        amount, factor[0], evicted);
+   else
+     ctx->backlog_msg = (char*) eina_stringshare_printf(
+        _("Scrollback (current memory usage: %'.2f%cB):"),
+        amount, factor[0]);
    elm_object_text_set(ctx->backlock_label, ctx->backlog_msg);
 }
 
@@ -95,6 +111,55 @@ _cb_op_behavior_sback_chg(void *data,
    config_save(config);
 }
 
+static void
+_cb_op_behavior_sback_compress_chg(void *data,
+                                   Evas_Object *obj,
+                                   void *_event EINA_UNUSED)
+{
+   Behavior_Ctx *ctx = data;
+   Config *config = ctx->config;
+
+   config->scrollback_compress = round(elm_slider_value_get(obj));
+   termio_config_update(ctx->term);
+   config_save(config);
+}
+
+static void
+_cb_op_behavior_sback_disk_chg(void *data,
+                               Evas_Object *obj,
+                               void *_event EINA_UNUSED)
+{
+   Behavior_Ctx *ctx = data;
+   Config *config = ctx->config;
+   double max;
+
+   config->scrollback_disk = round(elm_slider_value_get(obj));
+   max = sback_max_get(config);
+   elm_slider_min_max_set(ctx->sback_slider, 0.0, max);
+   if (config->scrollback > (int)sback_double_to_expo_int(max))
+     {
+        config->scrollback = sback_double_to_expo_int(max);
+        elm_slider_value_set(ctx->sback_slider, max);
+     }
+   termio_config_update(ctx->term);
+   _update_backlog_title(ctx);
+   config_save(config);
+}
+
+static void
+_cb_op_behavior_sback_budget_chg(void *data,
+                                 Evas_Object *obj,
+                                 void *_event EINA_UNUSED)
+{
+   Behavior_Ctx *ctx = data;
+   Config *config = ctx->config;
+
+   config->scrollback_budget = round(elm_slider_value_get(obj));
+   termio_config_update(ctx->term);
+   _update_backlog_title(ctx);
+   config_save(config);
+}
+
 static void
 _cb_op_behavior_tab_zoom_slider_chg(void *data,
                                     Evas_Object *obj,
@@ -108,6 +173,32 @@ _cb_op_behavior_tab_zoom_slider_chg(void *data,
    config_save(config);
 }
 
+static void
+_cb_op_behavior_read_budget_slider_chg(void *data,
+                                       Evas_Object *obj,
+                                       void *_event EINA_UNUSED)
+{
+   Behavior_Ctx *ctx = data;
+   Config *config = ctx->config;
+
+   config->read_budget = round(elm_slider_value_get(obj)) / 100.0;
+   termio_config_update(ctx->term);
+   config_save(config);
+}
+
+static void
+_cb_op_behavior_flood_fps_slider_chg(void *data,
+                                     Evas_Object *obj,
+                                     void *_event EINA_UNUSED)
+{
+   Behavior_Ctx *ctx = data;
+   Config *config = ctx->config;
+
+   config->flood_fps = round(elm_slider_value_get(obj));
+   termio_config_update(ctx->term);
+   config_save(config);
+}
+
 static void
 _cb_op_behavior_custom_geometry_current_set(void *data,
                                 Evas_Object *obj EINA_UNUSED,
@@ -416,6 +507,7 @@ options_behavior(Evas_Object *opbox, Evas_Object *term)
    OPTIONS_CX(_("Enable special Terminology escape codes"), ty_escapes, 0);
    OPTIONS_CX(_("Treat Emojis as double-width characters"), emoji_dbl_width, 0);
    OPTIONS_CX(_("When grouping input, do it on all terminals and not just the visible ones"), group_all, 0);
+   OPTIONS_CX(_("Read output of new terminals in a separate thread"), reader_thread, 0);
 
    OPTIONS_SEPARATOR;
 
@@ -510,8 +602,9 @@ options_behavior(Evas_Object *opbox, Evas_Object *term)
    } u;
    u.v = config->scrollback;
    u.c = (u.c >> 23) - 127;
-   elm_slider_min_max_set(o, 0.0, 17.0);
+   elm_slider_min_max_set(o, 0.0, sback_max_get(config));
    elm_slider_value_set(o, u.c);
+   ctx->sback_slider = o;
    evas_object_size_hint_weight_set(o, EVAS_HINT_EXPAND, 0.0);
    evas_object_size_hint_align_set(o, EVAS_HINT_FILL, 0.0);
    elm_box_pack_end(bx, o);
@@ -519,6 +612,88 @@ options_behavior(Evas_Object *opbox, Evas_Object *term)
    evas_object_smart_callback_add(o, "delay,changed",
                                   _cb_op_behavior_sback_chg, ctx);
 
+   o = elm_label_add(bx);
+   evas_object_size_hint_weight_set(o, 0.0, 0.0);
+   evas_object_size_hint_align_set(o, 0.0, 0.5);
+   tooltip = _("Older lines take less memory<br>"
+       "but have to be decompressed<br>"
+       "to be shown again.<br>"
+       "0 never compresses them");
+   elm_object_tooltip_text_set(o, tooltip);
+   elm_object_text_set(o, _("Compress scrollback lines older than:"));
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+
+   o = elm_slider_add(bx);
+   evas_object_size_hint_weight_set(o, EVAS_HINT_EXPAND, 0.0);
+   evas_object_size_hint_align_set(o, EVAS_HINT_FILL, 0.0);
+   elm_slider_span_size_set(o, 40);
+   elm_slider_step_set(o, 100.0 / 10000.0);
+   elm_slider_unit_format_set(o, _("%1.0f lines"));
+   elm_slider_indicator_format_set(o, _("%1.0f lines"));
+   elm_slider_min_max_set(o, 0.0, 10000.0);
+   elm_slider_value_set(o, config->scrollback_compress);
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+   evas_object_smart_callback_add(o, "delay,changed",
+                                  _cb_op_behavior_sback_compress_chg, ctx);
+
+   o = elm_label_add(bx);
+   evas_object_size_hint_weight_set(o, 0.0, 0.0);
+   evas_object_size_hint_align_set(o, 0.0, 0.5);
+   tooltip = _("Older lines are kept in a file<br>"
+       "of the cache directory, removed<br>"
+       "when the terminal closes.<br>"
+       "The scrollback can then hold up<br>"
+       "to 4M lines, each still taking<br>"
+       "16 bytes of memory per terminal.<br>"
+       "0 keeps them all in memory");
+   elm_object_tooltip_text_set(o, tooltip);
+   elm_object_text_set(o, _("Move scrollback lines to disk past:"));
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+
+   o = elm_slider_add(bx);
+   evas_object_size_hint_weight_set(o, EVAS_HINT_EXPAND, 0.0);
+   evas_object_size_hint_align_set(o, EVAS_HINT_FILL, 0.0);
+   elm_slider_span_size_set(o, 40);
+   elm_slider_step_set(o, 100.0 / 10000.0);
+   elm_slider_unit_format_set(o, _("%1.0f lines"));
+   elm_slider_indicator_format_set(o, _("%1.0f lines"));
+   elm_slider_min_max_set(o, 0.0, 10000.0);
+   elm_slider_value_set(o, config->scrollback_disk);
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+   evas_object_smart_callback_add(o, "delay,changed",
+                                  _cb_op_behavior_sback_disk_chg, ctx);
+
+   o = elm_label_add(bx);
+   evas_object_size_hint_weight_set(o, 0.0, 0.0);
+   evas_object_size_hint_align_set(o, 0.0, 0.5);
+   tooltip = _("Once the lines in the scrollback of<br>"
+       "all terminals take more, the oldest<br>"
+       "lines of the terminals not seen nor<br>"
+       "written to for the longest are dropped.<br>"
+       "0 sets no limit");
+   elm_object_tooltip_text_set(o, tooltip);
+   elm_object_text_set(o, _("Memory for the scrollback of all terminals:"));
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+
+   o = elm_slider_add(bx);
+   evas_object_size_hint_weight_set(o, EVAS_HINT_EXPAND, 0.0);
+   evas_object_size_hint_align_set(o, EVAS_HINT_FILL, 0.0);
+   elm_slider_span_size_set(o, 40);
+   elm_slider_step_set(o, 16.0 / 4096.0);
+   elm_slider_unit_format_set(o, _("%1.0f MiB"));
+   elm_slider_indicator_format_set(o, _("%1.0f MiB"));
+   elm_slider_min_max_set(o, 0.0, 4096.0);
+   elm_slider_value_set(o, config->scrollback_budget);
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+   evas_object_smart_callback_add(o, "delay,changed",
+                                  _cb_op_behavior_sback_budget_chg, ctx);
+
    OPTIONS_SEPARATOR;
 
    o = elm_label_add(bx);
@@ -546,6 +721,63 @@ options_behavior(Evas_Object *opbox, Evas_Object *term)
    evas_object_smart_callback_add(o, "delay,changed",
                                   _cb_op_behavior_tab_zoom_slider_chg, ctx);
 
+   OPTIONS_SEPARATOR;
+
+   o = elm_label_add(bx);
+   evas_object_size_hint_weight_set(o, 0.0, 0.0);
+   evas_object_size_hint_align_set(o, 0.0, 0.5);
+   tooltip = _("Share of a frame spent on handling<br>"
+       "the output of a terminal before<br>"
+       "getting back to input and rendering.<br>"
+       "Higher values favor throughput,<br>"
+       "lower values favor responsiveness");
+   elm_object_tooltip_text_set(o, tooltip);
+   elm_object_text_set(o, _("Time spent on terminal output per frame:"));
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+
+   o = elm_slider_add(bx);
+   evas_object_size_hint_weight_set(o, EVAS_HINT_EXPAND, 0.0);
+   evas_object_size_hint_align_set(o, EVAS_HINT_FILL, 0.0);
+   elm_slider_span_size_set(o, 40);
+   elm_slider_unit_format_set(o, _("%1.0f%%"));
+   elm_slider_indicator_format_set(o, _("%1.0f%%"));
+   elm_slider_min_max_set(o, 10.0, 200.0);
+   elm_slider_value_set(o, config->read_budget * 100.0);
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+   evas_object_smart_callback_add(o, "delay,changed",
+                                  _cb_op_behavior_read_budget_slider_chg, ctx);
+
+   OPTIONS_SEPARATOR;
+
+   o = elm_label_add(bx);
+   evas_object_size_hint_weight_set(o, 0.0, 0.0);
+   evas_object_size_hint_align_set(o, 0.0, 0.5);
+   tooltip = _("While a terminal gets output faster<br>"
+       "than it can be shown and jumps to<br>"
+       "the bottom on changes, only render<br>"
+       "it that many times per second.<br>"
+       "0 always renders every frame");
+   elm_object_tooltip_text_set(o, tooltip);
+   elm_object_text_set(o, _("Renders per second when flooded with output:"));
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+
+   o = elm_slider_add(bx);
+   evas_object_size_hint_weight_set(o, EVAS_HINT_EXPAND, 0.0);
+   evas_object_size_hint_align_set(o, EVAS_HINT_FILL, 0.0);
+   elm_slider_span_size_set(o, 40);
+   elm_slider_step_set(o, 1.0 / 60.0);
+   elm_slider_unit_format_set(o, _("%1.0f"));
+   elm_slider_indicator_format_set(o, _("%1.0f"));
+   elm_slider_min_max_set(o, 0.0, 60.0);
+   elm_slider_value_set(o, config->flood_fps);
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+   evas_object_smart_callback_add(o, "delay,changed",
+                                  _cb_op_behavior_flood_fps_slider_chg, ctx);
+
    evas_object_size_hint_weight_set(opbox, EVAS_HINT_EXPAND, EVAS_HINT_EXPAND);
    evas_object_size_hint_align_set(opbox, EVAS_HINT_FILL, EVAS_HINT_FILL);
    evas_object_show(o);
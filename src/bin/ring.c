@@ -0,0 +1,127 @@
+#include "private.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ring.h"
+
+#if defined(BINARY_TYTEST)
+#include "unit_tests.h"
+#endif
+
+int
+ty_ring_init(struct ty_ring *ring, size_t size)
+{
+   /* round up to a power of 2 so that positions wrap with a mask */
+   size_t s = 1;
+
+   while (s < size)
+     s <<= 1;
+   ring->buf = malloc(s);
+   if (!ring->buf)
+     return -1;
+   ring->size = s;
+   ring->head = ring->tail = 0;
+   return 0;
+}
+
+void
+ty_ring_free(struct ty_ring *ring)
+{
+   free(ring->buf);
+   ring->buf = NULL;
+   ring->size = ring->head = ring->tail = 0;
+}
+
+size_t
+ty_ring_used(const struct ty_ring *ring)
+{
+   return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+      __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Producer side: get the contiguous free space */
+char *
+ty_ring_write_ptr(struct ty_ring *ring, size_t *len)
+{
+   size_t head = ring->head;
+   size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+   size_t pos = head & (ring->size - 1);
+   size_t room = ring->size - (head - tail);
+
+   *len = MIN(room, ring->size - pos);
+   return ring->buf + pos;
+}
+
+/* Producer side: publish len bytes written at ty_ring_write_ptr() */
+void
+ty_ring_write_commit(struct ty_ring *ring, size_t len)
+{
+   __atomic_store_n(&ring->head, ring->head + len, __ATOMIC_SEQ_CST);
+}
+
+/* Consumer side: copy up to len bytes out of the ring.
+ * Returns the number of bytes copied */
+size_t
+ty_ring_read(struct ty_ring *ring, char *dst, size_t len)
+{
+   size_t tail = ring->tail;
+   size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+   size_t pos = tail & (ring->size - 1);
+   size_t n, first;
+
+   n = MIN(len, head - tail);
+   first = MIN(n, ring->size - pos);
+   memcpy(dst, ring->buf + pos, first);
+   memcpy(dst + first, ring->buf, n - first);
+   __atomic_store_n(&ring->tail, tail + n, __ATOMIC_SEQ_CST);
+   return n;
+}
+
+#if defined(BINARY_TYTEST)
+int
+tytest_ring(void)
+{
+   struct ty_ring ring;
+   char buf[16];
+   char *w;
+   size_t len;
+
+   assert(ty_ring_init(&ring, 10) == 0);
+   assert(ring.size == 16);
+   assert(ty_ring_used(&ring) == 0);
+   assert(ty_ring_read(&ring, buf, sizeof(buf)) == 0);
+
+   w = ty_ring_write_ptr(&ring, &len);
+   assert(len == 16);
+   memcpy(w, "0123456789", 10);
+   ty_ring_write_commit(&ring, 10);
+   assert(ty_ring_used(&ring) == 10);
+   assert(ty_ring_read(&ring, buf, 8) == 8);
+   assert(strncmp(buf, "01234567", 8) == 0);
+
+   /* free space up to the end of the buffer only */
+   w = ty_ring_write_ptr(&ring, &len);
+   assert(len == 6);
+   memcpy(w, "abcdef", 6);
+   ty_ring_write_commit(&ring, 6);
+   w = ty_ring_write_ptr(&ring, &len);
+   assert(len == 8);
+   memcpy(w, "ghijklmn", 8);
+   ty_ring_write_commit(&ring, 8);
+   /* full */
+   w = ty_ring_write_ptr(&ring, &len);
+   assert(len == 0);
+   assert(ty_ring_used(&ring) == 16);
+
+   /* read across the end of the buffer */
+   assert(ty_ring_read(&ring, buf, sizeof(buf)) == 16);
+   assert(strncmp(buf, "89abcdefghijklmn", 16) == 0);
+   assert(ty_ring_used(&ring) == 0);
+
+   ty_ring_free(&ring);
+   return 0;
+}
+#endif
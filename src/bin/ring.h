@@ -0,0 +1,22 @@
+#ifndef _RING_H__
+#define _RING_H__
+
+#include <stddef.h>
+
+/* Single producer, single consumer byte ring buffer.
+ * One thread may write while another one reads, without any lock */
+struct ty_ring {
+   char *buf;
+   size_t size; /* power of 2 */
+   size_t head; /* written so far, only moved by the producer */
+   size_t tail; /* read so far, only moved by the consumer */
+};
+
+int ty_ring_init(struct ty_ring *ring, size_t size);
+void ty_ring_free(struct ty_ring *ring);
+size_t ty_ring_used(const struct ty_ring *ring);
+char *ty_ring_write_ptr(struct ty_ring *ring, size_t *len);
+void ty_ring_write_commit(struct ty_ring *ring, size_t len);
+size_t ty_ring_read(struct ty_ring *ring, char *dst, size_t len);
+
+#endif
@@ -493,6 +493,15 @@ termio_textgrid_get(const Evas_Object *obj)
    return sd->grid.obj;
 }
 
+const Evas_Textgrid_Cell *
+termio_atts_textgrid_get(const Evas_Object *obj)
+{
+   Termio *sd = evas_object_smart_data_get(obj);
+   EINA_SAFETY_ON_NULL_RETURN_VAL(sd, NULL);
+
+   return termio_internal_atts_sync(sd);
+}
+
 Evas_Object *
 termio_win_get(const Evas_Object *obj)
 {
@@ -1759,7 +1768,8 @@ _hyperlink_mouseover(Termio *sd,
         for (x = 0; x < w; x++)
           {
              Termcell *c = cells + x;
-             if (term_link_eq(sd->pty, hl, c->att.link_id))
+             if (term_link_eq(sd->pty, hl,
+                              termpty_cell_link_id(sd->pty, c)))
                {
                   if (!o)
                     {
@@ -2590,10 +2600,10 @@ _smart_mouseover_apply(Termio *sd)
         return;
      }
 
-   if (cell->att.link_id)
+   if (termpty_cell_link_id(sd->pty, cell))
      {
         if (config->active_links_escape)
-          _hyperlink_mouseover(sd, cell->att.link_id);
+          _hyperlink_mouseover(sd, termpty_cell_link_id(sd->pty, cell));
         return;
      }
 
@@ -3319,8 +3329,10 @@ termio_sel_set(Termio *sd, Eina_Bool enable)
         evas_object_smart_callback_call(sd->win, "selection,off", NULL);
         sd->pty->selection.by_word = EINA_FALSE;
         sd->pty->selection.by_line = EINA_FALSE;
-        free(sd->pty->selection.codepoints);
-        sd->pty->selection.codepoints = NULL;
+        sd->pty->selection.gen = 0;
+        free(sd->pty->selection.rows);
+        sd->pty->selection.rows = NULL;
+        sd->pty->selection.nb_rows = 0;
      }
 }
 
@@ -3448,9 +3460,11 @@ _smart_del(Evas_Object *obj)
    if (sd->anim) ecore_animator_del(sd->anim);
    if (sd->delayed_size_timer) ecore_timer_del(sd->delayed_size_timer);
    if (sd->link_do_timer) ecore_timer_del(sd->link_do_timer);
+   if (sd->flood.timer) ecore_timer_del(sd->flood.timer);
    if (sd->mouse_move_job) ecore_job_del(sd->mouse_move_job);
    if (sd->mouseover_delay) ecore_timer_del(sd->mouseover_delay);
    eina_stringshare_del(sd->font.name);
+   free(sd->atts.cells);
    if (sd->pty) termpty_free(sd->pty);
    eina_stringshare_del(sd->link.string);
    if (sd->glayer) evas_object_del(sd->glayer);
@@ -3570,6 +3584,75 @@ _smart_init(void)
    _smart = evas_smart_class_new(&sc);
 }
 
+/* how long reads have to keep stopping on their deadline to throttle */
+#define FLOOD_DELAY 0.25
+
+static void
+_flood_stop(Termio *sd)
+{
+   sd->flood.start = 0.0;
+   if (!sd->flood.active)
+     return;
+   sd->flood.active = EINA_FALSE;
+   if (sd->flood.timer)
+     ecore_timer_del(sd->flood.timer);
+   sd->flood.timer = NULL;
+   termio_smart_update_queue(sd);
+   evas_object_smart_callback_call(sd->self, "flood,off", NULL);
+}
+
+static Eina_Bool
+_smart_cb_flood(void *data)
+{
+   Termio *sd = data;
+
+   /* no output since the last tick, it was rendered then */
+   if ((!sd->flood.changed) || (!sd->jump_on_change) ||
+       (sd->config->flood_fps <= 0))
+     {
+        sd->flood.timer = NULL;
+        _flood_stop(sd);
+        return ECORE_CALLBACK_CANCEL;
+     }
+   sd->flood.changed = EINA_FALSE;
+   ecore_timer_interval_set(sd->flood.timer, 1.0 / sd->config->flood_fps);
+   termio_smart_update_queue(sd);
+   return ECORE_CALLBACK_RENEW;
+}
+
+/* Whether renders are to be paced by the flood timer, as output keeps
+ * coming faster than it could be shown anyway */
+static Eina_Bool
+_flood_check(Termio *sd)
+{
+   double now;
+
+   if ((!sd->jump_on_change) || (sd->config->flood_fps <= 0) ||
+       (!sd->pty->read_saturated))
+     {
+        _flood_stop(sd);
+        return EINA_FALSE;
+     }
+   if (sd->flood.active)
+     {
+        sd->flood.changed = EINA_TRUE;
+        return EINA_TRUE;
+     }
+   now = ecore_loop_time_get();
+   if (sd->flood.start <= 0.0)
+     sd->flood.start = now;
+   if ((now - sd->flood.start) < FLOOD_DELAY)
+     return EINA_FALSE;
+   sd->flood.timer = ecore_timer_add(1.0 / sd->config->flood_fps,
+                                     _smart_cb_flood, sd);
+   if (!sd->flood.timer)
+     return EINA_FALSE;
+   sd->flood.active = EINA_TRUE;
+   sd->flood.changed = EINA_FALSE;
+   evas_object_smart_callback_call(sd->self, "flood,on", NULL);
+   return EINA_FALSE;
+}
+
 static void
 _smart_pty_change(void *data)
 {
@@ -3578,6 +3661,8 @@ _smart_pty_change(void *data)
 
 // if scroll to bottom on updates
    if (sd->jump_on_change) sd->scroll = 0;
+   if (_flood_check(sd))
+     return;
    termio_smart_update_queue(sd);
 }
 
@@ -3611,6 +3696,7 @@ _smart_pty_cancel_sel(void *data)
    Termio *sd = evas_object_smart_data_get(obj);
 
    EINA_SAFETY_ON_NULL_RETURN(sd);
+   termpty_scroll_flush(sd->pty);
    if (sd->pty->selection.is_active)
      {
         termio_sel_set(sd, EINA_FALSE);
@@ -4260,6 +4346,7 @@ termio_key_down(Evas_Object *termio,
    Termio *sd = evas_object_smart_data_get(termio);
 
    EINA_SAFETY_ON_NULL_RETURN(sd);
+   _flood_stop(sd);
    if (sd->jump_on_keypress && !action_handled)
      {
         if (!key_is_modifier(ev->key))
@@ -76,7 +76,8 @@ termio_selection_get(Termio *sd,
 
         for (x = start_x; x <= end_x; x++)
           {
-             if ((cells[x].codepoint == 0) && (cells[x].att.dblwidth))
+             if ((cells[x].codepoint == 0) &&
+                 (termpty_cell_att(sd->pty, &cells[x])->dblwidth))
                {
                   if (x < end_x)
                     x++;
@@ -85,7 +86,7 @@ termio_selection_get(Termio *sd,
                }
              if (x >= w)
                break;
-             if (cells[x].att.tab_inserted)
+             if (termpty_cell_att(sd->pty, &cells[x])->tab_inserted)
                {
                   /* There was a tab inserted.
                    * Only output it if there were spaces/empty cells "below"
@@ -94,7 +95,7 @@ termio_selection_get(Termio *sd,
                   while ((is_tab) && (x < end_x))
                     {
                        if (((cells[x].codepoint == 0) ||
-                            (cells[x].att.invisible == 1) ||
+                            (termpty_cell_att(sd->pty, &cells[x])->invisible) ||
                             (cells[x].codepoint == ' ')))
                          {
                               x++;
@@ -103,7 +104,7 @@ termio_selection_get(Termio *sd,
                          {
                             is_tab = EINA_FALSE;
                          }
-                       if (cells[x].att.tab_last)
+                       if (termpty_cell_att(sd->pty, &cells[x])->tab_last)
                          {
                             SB_ADD("\t", 1);
                             if (is_tab)
@@ -115,7 +116,7 @@ termio_selection_get(Termio *sd,
                          }
                     }
                }
-             if (cells[x].att.newline)
+             if (termpty_cell_att(sd->pty, &cells[x])->newline)
                {
                   last0 = -1;
                   if ((y != c2y) || (x != end_x))
@@ -153,7 +154,7 @@ termio_selection_get(Termio *sd,
                   if ((x == (w - 1)) &&
                       ((x != c2x) || (y != c2y)))
                     {
-                       if (!cells[x].att.autowrapped)
+                       if (!termpty_cell_att(sd->pty, &cells[x])->autowrapped)
                          {
                             RTRIM();
                             SB_ADD("\n", 1);
@@ -172,7 +173,7 @@ termio_selection_get(Termio *sd,
                   for (x = end_x + 1; x < w; x++)
                     {
                        if ((cells[x].codepoint == 0) &&
-                           (cells[x].att.dblwidth))
+                           (termpty_cell_att(sd->pty, &cells[x])->dblwidth))
                          {
                             if (x < (w - 1))
                               x++;
@@ -181,7 +182,7 @@ termio_selection_get(Termio *sd,
                          }
                        if (((cells[x].codepoint != 0) &&
                             (cells[x].codepoint != ' ')) ||
-                           (cells[x].att.newline))
+                           (termpty_cell_att(sd->pty, &cells[x])->newline))
                          {
                             have_more = EINA_TRUE;
                             break;
@@ -197,7 +198,7 @@ termio_selection_get(Termio *sd,
                        for (x = last0; x <= end_x; x++)
                          {
                             if ((cells[x].codepoint == 0) &&
-                                (cells[x].att.dblwidth))
+                                (termpty_cell_att(sd->pty, &cells[x])->dblwidth))
                               {
                                  if (x < (w - 1))
                                    x++;
@@ -230,146 +231,127 @@ err:
 }
 
 
-struct Codepoints_Buf {
-   Eina_Unicode *codepoints;
-   size_t len;
-   size_t size;
-};
-
-static int
-_codepoint_buf_append(struct Codepoints_Buf *buf,
-                      Eina_Unicode u)
+/* Columns of the selection on its row @y */
+static void
+_sel_row_range(const Termio *sd, int y, int start_x, int start_y,
+               int end_x, int end_y, int *x1, int *x2)
 {
-   if (EINA_UNLIKELY(buf->len == buf->size))
-     {
-        buf->size *= 2;
-        Eina_Unicode *codepoints = realloc(buf->codepoints,
-                                           buf->size * sizeof(Eina_Unicode));
-        if (EINA_UNLIKELY(!codepoints))
-          {
-             free(buf->codepoints);
-             buf->len = buf->size = 0;
-             return -1;
-          }
-        buf->codepoints = codepoints;
-     }
-   buf->codepoints[buf->len++] = u;
-   return 0;
+   *x1 = start_x;
+   *x2 = end_x;
+   if ((sd->pty->selection.is_box) || (start_y == end_y))
+     return;
+   if (y != start_y)
+     *x1 = 0;
+   if (y != end_y)
+     *x2 = sd->grid.w - 1;
 }
 
-static void
-_sel_codepoints_get(const Termio *sd,
-                    struct Codepoints_Buf *buf,
-                    int c1x, int c1y, int c2x, int c2y)
+/* Hash of the codepoints shown in columns @x1 to @x2 of row @y, blanks and
+ * cells past the end of the line count as spaces */
+static uint32_t
+_sel_row_hash(Termio *sd, int y, int x1, int x2)
 {
-   int x, y;
-
-#define TRY(ACTION) do {               \
-     if (EINA_UNLIKELY(ACTION < 0))    \
-       {                               \
-          goto err;                    \
-       }                               \
-} while (0)
+   Termcell *cells;
+   ssize_t w = 0;
+   uint32_t hash = 2166136261u;
+   int x;
 
-   termpty_backlog_lock();
-   for (y = c1y; y <= c2y; y++)
+   cells = termpty_cellrow_get(sd->pty, y, &w);
+   if (!cells)
+     w = 0;
+   for (x = x1; x <= x2; x++)
      {
-        Termcell *cells;
-        ssize_t w = 0;
-        int start_x, end_x;
-
-        cells = termpty_cellrow_get(sd->pty, y, &w);
-        if (!cells || !w || (y == c1y && c1x >= w))
-          {
-             w = 0;
-          }
+        Eina_Unicode u = ' ';
 
-        /* Compute @start_x, @end_x */
-        start_x = c1x;
-        end_x = c2x;
-        if (c1y != c2y)
-          {
-             if (y == c1y)
-               {
-                  end_x = sd->grid.w - 1;
-               }
-             else if (y == c2y)
-               {
-                  start_x = 0;
-               }
-             else
-               {
-                  start_x = 0;
-                  end_x = sd->grid.w - 1;
-               }
-          }
-        /* Lookup every cell in that line */
-        for (x = start_x; x <= end_x; x++)
-          {
-             if (x >= w)
-               {
-                  /* Selection outside of current line of "text" */
-                  TRY(_codepoint_buf_append(buf, ' '));
-               }
-             else if (!cells || cells[x].codepoint == 0)
-               {
-                  TRY(_codepoint_buf_append(buf, ' '));
-               }
-             else
-               {
-                  TRY(_codepoint_buf_append(buf, cells[x].codepoint));
-               }
-          }
+        if ((x < w) && (cells[x].codepoint != 0))
+          u = cells[x].codepoint;
+        hash = (hash ^ u) * 16777619u;
      }
-err:
-   termpty_backlog_unlock();
+   return hash;
 }
 
+/* Remember what the rows of the selection show, it is dropped once they
+ * show something else, see _sel_rows_changed() */
 static void
-_sel_fill_in_codepoints_array(Termio *sd)
+_sel_changes_mark(Termio *sd)
 {
-   int start_x = 0, start_y = 0, end_x = 0, end_y = 0;
-   struct Codepoints_Buf buf = {
-        .codepoints = NULL,
-        .len = 0,
-        .size = 256,
-   };
-
-   free(sd->pty->selection.codepoints);
-   sd->pty->selection.codepoints = NULL;
-
-   if (!sd->pty->selection.is_active)
-     return;
+   Termpty *ty = sd->pty;
+   int start_x, start_y, end_x, end_y, y, x1, x2;
 
-   buf.codepoints = malloc(sizeof(Eina_Unicode) * buf.size);
-   if (!buf.codepoints)
+   free(ty->selection.rows);
+   ty->selection.rows = NULL;
+   ty->selection.nb_rows = 0;
+   ty->selection.gen = 0;
+   if (!ty->selection.is_active)
      return;
 
-   start_x = sd->pty->selection.start.x;
-   start_y = sd->pty->selection.start.y;
-   end_x = sd->pty->selection.end.x;
-   end_y = sd->pty->selection.end.y;
-
-   if (!sd->pty->selection.is_top_to_bottom)
+   start_x = ty->selection.start.x;
+   start_y = ty->selection.start.y;
+   end_x = ty->selection.end.x;
+   end_y = ty->selection.end.y;
+   if (!ty->selection.is_top_to_bottom)
      {
         INT_SWAP(start_y, end_y);
         INT_SWAP(start_x, end_x);
      }
+   ty->selection.rows = malloc((end_y - start_y + 1) *
+                               sizeof(*ty->selection.rows));
+   if (!ty->selection.rows)
+     return;
+   /* rows written from now on have a generation of at least that one */
+   if (termpty_changes_next(ty) == 0)
+     sd->render.since = 0;
+   ty->selection.gen = ty->changes.gen;
+   ty->selection.nb_rows = end_y - start_y + 1;
 
-   if (sd->pty->selection.is_box)
+   termpty_backlog_lock();
+   for (y = start_y; y <= end_y; y++)
      {
-        int i;
+        _sel_row_range(sd, y, start_x, start_y, end_x, end_y, &x1, &x2);
+        ty->selection.rows[y - start_y].hash = _sel_row_hash(sd, y, x1, x2);
+        ty->selection.rows[y - start_y].gen = ty->selection.gen;
+     }
+   termpty_backlog_unlock();
+}
 
-        for (i = start_y; i <= end_y; i++)
-          {
-             _sel_codepoints_get(sd, &buf, start_x, i, end_x, i);
-          }
+/* Whether rows of the selection show other codepoints than when it was
+ * made. Only the rows written to since they were last checked are looked
+ * at, lines of the backlog only change when it is rewritten or when they
+ * fall off its end. */
+static Eina_Bool
+_sel_rows_changed(Termio *sd)
+{
+   Termpty *ty = sd->pty;
+   int start_x, start_y, end_x, end_y, y, x1, x2;
+
+   start_x = ty->selection.start.x;
+   start_y = ty->selection.start.y;
+   end_x = ty->selection.end.x;
+   end_y = ty->selection.end.y;
+   if (!ty->selection.is_top_to_bottom)
+     {
+        INT_SWAP(start_y, end_y);
+        INT_SWAP(start_x, end_x);
      }
-   else
+   if (end_y - start_y + 1 != (int)ty->selection.nb_rows)
+     return EINA_TRUE;
+   /* the oldest lines get overwritten once the backlog is full */
+   if (start_y < -termpty_backlog_length(ty))
+     return EINA_TRUE;
+   for (y = start_y; y <= end_y; y++)
      {
-        _sel_codepoints_get(sd, &buf, start_x, start_y, end_x, end_y);
+        Termpty_Sel_Row *row = &ty->selection.rows[y - start_y];
+
+        if ((ty->changes.rewritten < row->gen) &&
+            ((y < 0) || (y >= ty->h) ||
+             (termpty_screen_row_info(ty, y)->written < row->gen)))
+          continue;
+        _sel_row_range(sd, y, start_x, start_y, end_x, end_y, &x1, &x2);
+        if (_sel_row_hash(sd, y, x1, x2) != row->hash)
+          return EINA_TRUE;
+        row->gen = ty->changes.gen;
      }
-   sd->pty->selection.codepoints = buf.codepoints;
+   return EINA_FALSE;
 }
 
 const char *
@@ -479,7 +461,8 @@ _sel_line(Termio *sd, int cy)
    for (;;)
      {
         cells = termpty_cellrow_get(sd->pty, y - 1, &w);
-        if (!cells || w <= 0 || !cells[w-1].att.autowrapped)
+        if (!cells || w <= 0 ||
+            !termpty_cell_att(sd->pty, &cells[w-1])->autowrapped)
           break;
         y--;
      }
@@ -490,7 +473,7 @@ _sel_line(Termio *sd, int cy)
    for (;;)
      {
         cells = termpty_cellrow_get(sd->pty, y, &w);
-        if (!cells || !cells[w-1].att.autowrapped)
+        if (!cells || !termpty_cell_att(sd->pty, &cells[w-1])->autowrapped)
           {
              sd->pty->selection.end.x = w - 1;
              break;
@@ -499,9 +482,10 @@ _sel_line(Termio *sd, int cy)
      }
    /* Right trim */
    x = sd->pty->selection.end.x;
-   while ((x > 0) && (cells != NULL) && ((cells[x].codepoint == 0) ||
-                                         (cells[x].codepoint == ' ') ||
-                                         (cells[x].att.newline)))
+   while ((x > 0) && (cells != NULL) &&
+          ((cells[x].codepoint == 0) ||
+           (cells[x].codepoint == ' ') ||
+           (termpty_cell_att(sd->pty, &cells[x])->newline)))
      {
         x--;
      }
@@ -936,7 +920,8 @@ _sel_word(Termio *sd, int cx, int cy)
      {
         for (; x >= 0; x--)
           {
-             if ((cells[x].codepoint == 0) && (cells[x].att.dblwidth) &&
+             if ((cells[x].codepoint == 0) &&
+                 (termpty_cell_att(sd->pty, &cells[x])->dblwidth) &&
                  (x > 0))
                {
                   x--;
@@ -955,7 +940,8 @@ _sel_word(Termio *sd, int cx, int cy)
              size_t old_w = w;
 
              cells = termpty_cellrow_get(sd->pty, y - 1, &w);
-             if ((!cells) || (w == 0) || (!cells[w-1].att.autowrapped))
+             if ((!cells) || (w == 0) ||
+                 (!termpty_cell_att(sd->pty, &cells[w-1])->autowrapped))
                {
                   x = cx;
                   cells = old_cells;
@@ -988,7 +974,8 @@ _sel_word(Termio *sd, int cx, int cy)
      {
         for (; x < w; x++)
           {
-             if ((cells[x].codepoint == 0) && (cells[x].att.dblwidth) &&
+             if ((cells[x].codepoint == 0) &&
+                 (termpty_cell_att(sd->pty, &cells[x])->dblwidth) &&
                  (x < (w - 1)))
                {
                   sd->pty->selection.end.x = x;
@@ -1004,7 +991,7 @@ _sel_word(Termio *sd, int cx, int cy)
           }
         if (!done)
           {
-             if (!cells[w - 1].att.autowrapped)
+             if (!termpty_cell_att(sd->pty, &cells[w - 1])->autowrapped)
                {
                   goto end;
                }
@@ -1388,7 +1375,7 @@ termio_selection_dbl_fix(Termio *sd)
              if (end_x < (w - 1))
                {
                   if ((cells[end_x].codepoint != 0) &&
-                      (cells[end_x].att.dblwidth))
+                      (termpty_cell_att(sd->pty, &cells[end_x])->dblwidth))
                     end_x++;
                }
           }
@@ -1398,7 +1385,7 @@ termio_selection_dbl_fix(Termio *sd)
              if (end_x > 0)
                {
                   if ((cells[end_x].codepoint == 0) &&
-                      (cells[end_x].att.dblwidth))
+                      (termpty_cell_att(sd->pty, &cells[end_x])->dblwidth))
                     end_x--;
                }
           }
@@ -1414,7 +1401,7 @@ termio_selection_dbl_fix(Termio *sd)
              if ((start_x > 0) && (start_x < w))
                {
                   if ((cells[start_x].codepoint == 0) &&
-                      (cells[start_x].att.dblwidth))
+                      (termpty_cell_att(sd->pty, &cells[start_x])->dblwidth))
                     start_x--;
                }
           }
@@ -1424,7 +1411,7 @@ termio_selection_dbl_fix(Termio *sd)
              if (start_x < (w - 1))
                {
                   if ((cells[start_x].codepoint != 0) &&
-                      (cells[start_x].att.dblwidth))
+                      (termpty_cell_att(sd->pty, &cells[start_x])->dblwidth))
                     start_x++;
                }
           }
@@ -1680,7 +1667,7 @@ termio_internal_mouse_down(Termio *sd,
                   termio_take_selection(sd->self, ELM_SEL_TYPE_PRIMARY);
                }
              sd->didclick = EINA_TRUE;
-             _sel_fill_in_codepoints_array(sd);
+             _sel_changes_mark(sd);
           }
         else if (ev->flags & EVAS_BUTTON_DOUBLE_CLICK)
           {
@@ -1704,7 +1691,7 @@ termio_internal_mouse_down(Termio *sd,
                     }
                }
              sd->didclick = EINA_TRUE;
-             _sel_fill_in_codepoints_array(sd);
+             _sel_changes_mark(sd);
           }
         else
           {
@@ -1936,7 +1923,7 @@ termio_internal_mouse_up(Termio *sd,
                   sd->pty->selection.last_click = time(NULL);
                   sd->pty->selection.by_line = EINA_FALSE;
                   sd->pty->selection.by_word = EINA_FALSE;
-                  _sel_fill_in_codepoints_array(sd);
+                  _sel_changes_mark(sd);
                   termio_smart_update_queue(sd);
                   return;
                }
@@ -1974,7 +1961,7 @@ termio_internal_mouse_up(Termio *sd,
              termio_selection_dbl_fix(sd);
              _selection_newline_extend_fix(sd);
              termio_take_selection(sd->self, ELM_SEL_TYPE_PRIMARY);
-             _sel_fill_in_codepoints_array(sd);
+             _sel_changes_mark(sd);
              sd->pty->selection.makesel = EINA_FALSE;
              termio_smart_update_queue(sd);
           }
@@ -2278,8 +2265,8 @@ termio_internal_mouse_wheel(Termio *sd,
 
 
 static void
-_termio_scroll_selection(Termio *sd, Termpty *ty,
-                         int direction, int start_y, int end_y)
+_termio_scroll_selection(Termio *sd, Termpty *ty, int direction,
+                         const Termpty_Scrolled *scrolled)
 {
    if (!ty->selection.is_active)
      return;
@@ -2289,8 +2276,10 @@ _termio_scroll_selection(Termio *sd, Termpty *ty,
    int sel_end_x = ty->selection.end.x;
    int sel_end_y = ty->selection.end.y;
 
-   int left_margin = ty->termstate.left_margin;
-   int right_margin = ty->termstate.right_margin;
+   int start_y = scrolled->start_y;
+   int end_y = scrolled->end_y;
+   int left_margin = scrolled->left_margin;
+   int right_margin = scrolled->right_margin;
 
    if (!ty->selection.is_top_to_bottom)
      {
@@ -2301,7 +2290,7 @@ _termio_scroll_selection(Termio *sd, Termpty *ty,
    if (start_y <= sel_start_y &&
        sel_end_y <= end_y)
      {
-        if (ty->termstate.left_margin)
+        if (left_margin)
           {
              if ((ty->selection.is_box) || (sel_start_y == sel_end_y))
                {
@@ -2340,7 +2329,7 @@ _termio_scroll_selection(Termio *sd, Termpty *ty,
    else if (!((start_y > sel_end_y) ||
               (end_y < sel_start_y)))
      {
-        if (ty->termstate.left_margin)
+        if (left_margin)
           {
              if ((ty->selection.is_box) || (sel_start_y == sel_end_y))
                {
@@ -2363,30 +2352,205 @@ _termio_scroll_selection(Termio *sd, Termpty *ty,
 }
 
 
+/* Follow the lines scrolled, up when negative, if the view is not at the
+ * bottom */
+static void
+_termio_scroll_view(Termio *sd, int lines)
+{
+   Evas_Object *mv;
+
+   if ((sd->jump_on_change) || // if scroll to bottom on updates
+       (sd->scroll <= 0))
+     return;
+   /* scrolling down stops at the bottom */
+   if (lines > sd->scroll)
+     lines = sd->scroll;
+   mv = term_miniview_get(sd->term);
+   if (mv)
+     miniview_position_offset(mv, lines, EINA_FALSE);
+   // adjust scroll position for added scrollback
+   sd->scroll -= lines;
+}
+
 void
-termio_scroll(Evas_Object *obj, int direction,
-              int start_y, int end_y)
+termio_scroll(Evas_Object *obj, const Termpty_Scrolled *scrolled)
 {
    Termio *sd = termio_get_from_obj(obj);
-   Termpty *ty;
+   int direction, n;
 
    EINA_SAFETY_ON_NULL_RETURN(sd);
 
-   ty = sd->pty;
+   direction = (scrolled->lines < 0) ? -1 : 1;
+   n = abs(scrolled->lines);
+   /* the selection can leave or enter the region on any of the lines */
+   for (; (n > 0) && (sd->pty->selection.is_active); n--)
+     {
+        _termio_scroll_view(sd, direction);
+        _termio_scroll_selection(sd, sd->pty, direction, scrolled);
+     }
+   if (n > 0)
+     _termio_scroll_view(sd, direction * n);
+}
+
+/* Set the true colors that appeared since last render in the palette */
+static void
+_truecolor_palette_sync(Termio *sd)
+{
+   Termpty_Truecolors *tc = &sd->pty->truecolor;
+   int idx;
+
+   for (idx = 1; idx <= TRUECOLOR_MAX; idx++)
+     {
+        uint32_t rgb;
+
+        if (!(tc->dirty[idx / 8] & (1 << (idx % 8))))
+          continue;
+        rgb = tc->rgb[idx];
+        evas_object_textgrid_palette_set(sd->grid.obj,
+                                         EVAS_TEXTGRID_PALETTE_STANDARD,
+                                         TRUECOLOR_PALETTE_SLOT(idx),
+                                         (rgb >> 16) & 0xff,
+                                         (rgb >> 8) & 0xff,
+                                         rgb & 0xff,
+                                         0xff);
+     }
+   memset(tc->dirty, 0, sizeof(tc->dirty));
+   tc->has_dirty = 0;
+}
+
+/* Textgrid colors and styles of an attribute, the codepoint is left to 0 */
+void
+termio_internal_att_textgrid(const Termatt *att, int inv, Eina_Bool bolditalic,
+                             Evas_Textgrid_Cell *tc)
+{
+   int fg, bg, fgext, bgext;
+
+   fg = att->fg;
+   bg = att->bg;
+   fgext = att->fg256;
+   bgext = att->bg256;
+
+   if (EINA_UNLIKELY(att->fgtrue))
+     fg = TRUECOLOR_PALETTE_SLOT(fg);
+   else
+     {
+        if ((fg == COL_DEF) && (att->inverse ^ inv))
+          fg = COL_INVERSEBG;
+        if (!fgext)
+          {
+             if ((att->fgintense) || (att->bold))
+               fg += 12;
+             if (att->faint)
+               fg += 2 * 12;
+          }
+     }
+
+   if (EINA_UNLIKELY(att->bgtrue))
+     bg = TRUECOLOR_PALETTE_SLOT(bg);
+   else
+     {
+        if (bg == COL_DEF)
+          {
+             if (att->inverse ^ inv)
+               bg = COL_INVERSE;
+             else if (!bgext)
+               bg = COL_INVIS;
+          }
+        if ((att->bgintense) && (!bgext))
+          bg += 12;
+     }
+
+   if (att->inverse ^ inv)
+     {
+        int t;
+        t = fgext; fgext = bgext; bgext = t;
+        t = fg; fg = bg; bg = t;
+     }
+
+   memset(tc, 0, sizeof(*tc));
+   tc->fg = fg;
+   tc->bg = bg;
+   tc->fg_extended = fgext;
+   tc->bg_extended = bgext;
+   tc->underline = att->underline;
+   tc->strikethrough = att->strike;
+   /* if font does not have bolditalic, bright/bold color is still applied */
+   if (bolditalic)
+     {
+        tc->bold = att->bold;
+        tc->italic = att->italic;
+     }
+   tc->double_width = att->dblwidth;
+}
+
+/* Translate the attributes interned since the last call, or all of them
+ * when they got renumbered or the reverse mode or the config changed.
+ * Returns the translations by attribute index, NULL if out of memory */
+const Evas_Textgrid_Cell *
+termio_internal_atts_sync(Termio *sd)
+{
+   const Termpty_Atts *ta = &sd->pty->atts;
+   int inv = !!sd->pty->termstate.reverse;
+   int bolditalic = !!sd->config->font.bolditalic;
+   unsigned int i;
 
-   if ((!sd->jump_on_change) && // if NOT scroll to bottom on updates
-       (sd->scroll > 0))
+   if ((ta->gen != sd->atts.gen) || (inv != sd->atts.inv) ||
+       (bolditalic != sd->atts.bolditalic))
+     {
+        sd->atts.count = 0;
+        sd->atts.gen = ta->gen;
+        sd->atts.inv = inv;
+        sd->atts.bolditalic = bolditalic;
+     }
+   if (ta->count > sd->atts.size)
      {
-        Evas_Object *mv = term_miniview_get(sd->term);
-        if (mv)
+        Evas_Textgrid_Cell *cells;
+
+        cells = realloc(sd->atts.cells, ta->size * sizeof(Evas_Textgrid_Cell));
+        if (!cells)
           {
-             miniview_position_offset(mv, direction, EINA_FALSE);
+             ERR("Allocation of %u attributes failed: %s",
+                 ta->size, strerror(errno));
+             return NULL;
           }
-        // adjust scroll position for added scrollback
-        sd->scroll -= direction;
+        sd->atts.cells = cells;
+        sd->atts.size = ta->size;
      }
+   for (i = sd->atts.count; i < ta->count; i++)
+     termio_internal_att_textgrid(&ta->atts[i], inv, bolditalic,
+                                  &sd->atts.cells[i]);
+   sd->atts.count = ta->count;
+   return sd->atts.cells;
+}
 
-   _termio_scroll_selection(sd, ty, direction, start_y, end_y);
+/* Whether rows not changed on the terminal since the last render may
+ * still show differently, and every visible row has to be looked at */
+static Eina_Bool
+_render_full_get(const Termio *sd, int inv)
+{
+   const Termpty *ty = sd->pty;
+
+   if ((sd->render.since == 0) || (ty->changes.all >= sd->render.since))
+     return EINA_TRUE;
+   /* rows of the backlog are not tracked */
+   if ((sd->scroll != 0) || (sd->render.scroll != 0))
+     return EINA_TRUE;
+   if ((sd->grid.w != sd->render.w) || (sd->grid.h != sd->render.h))
+     return EINA_TRUE;
+   if ((!!inv != sd->render.inv) ||
+       (!!sd->config->font.bolditalic != sd->render.bolditalic))
+     return EINA_TRUE;
+   /* blocks are only kept active when seen, preedit drew over the grid */
+   if ((ty->block.active) || (sd->render.preedit))
+     return EINA_TRUE;
+   if ((ty->selection.gen != sd->render.sel_gen) ||
+       (ty->selection.is_box != sd->render.sel_box) ||
+       (ty->selection.start.x != sd->render.sel_start.x) ||
+       (ty->selection.start.y != sd->render.sel_start.y) ||
+       (ty->selection.end.x != sd->render.sel_end.x) ||
+       (ty->selection.end.y != sd->render.sel_end.y))
+     return EINA_TRUE;
+   return EINA_FALSE;
 }
 
 void
@@ -2397,9 +2561,11 @@ termio_internal_render(Termio *sd,
    int x, y, ch1 = 0, ch2 = 0, inv = 0, preedit_x = 0, preedit_y = 0;
    const char *preedit_str;
    ssize_t w;
-   int sel_start_x = 0, sel_start_y = 0, sel_end_x = 0, sel_end_y = 0;
    Termblock *blk;
    Eina_List *l;
+   Eina_Bool full;
+   const Evas_Textgrid_Cell *atts;
+   double t0 = ecore_time_get();
 
    EINA_LIST_FOREACH(sd->pty->block.active, l, blk)
      {
@@ -2408,76 +2574,44 @@ termio_internal_render(Termio *sd,
      }
 
    inv = sd->pty->termstate.reverse;
+   termpty_scroll_flush(sd->pty);
    termpty_backlog_lock();
+   sd->pty->backlog_use.viewed = ecore_loop_time_get();
+   full = sd->pty->truecolor.has_dirty;
+   if (sd->pty->truecolor.has_dirty)
+     _truecolor_palette_sync(sd);
    termpty_backscroll_adjust(sd->pty, &sd->scroll);
-
-   /* Make selection bottom to top */
-   sel_start_x = sd->pty->selection.start.x;
-   sel_start_y = sd->pty->selection.start.y;
-   sel_end_x = sd->pty->selection.end.x;
-   sel_end_y = sd->pty->selection.end.y;
-   if (!sd->pty->selection.is_top_to_bottom)
-     {
-        INT_SWAP(sel_start_y, sel_end_y);
-        INT_SWAP(sel_start_x, sel_end_x);
-     }
+   if ((sd->pty->selection.is_active) && (sd->pty->selection.rows) &&
+       (!sd->pty->selection.makesel) && (_sel_rows_changed(sd)))
+     termio_sel_set(sd, EINA_FALSE);
+   full = full || _render_full_get(sd, inv);
 
    /* Look at every visible line */
    for (y = 0; y < sd->grid.h; y++)
      {
         Termcell *cells;
         Evas_Textgrid_Cell *tc;
-        Eina_Unicode *cp = NULL;
-        int cur_sel_start_x = -1, cur_sel_end_x = -1;
         int rel_y = y - sd->scroll;
         int l1 = -1, l2 = -1;
 
+        /* not full, so that row is on the screen */
+        if ((!full) && (rel_y < sd->pty->h) &&
+            (termpty_screen_row_info(sd->pty, rel_y)->changed <
+             sd->render.since))
+          {
+             sd->pty->stats.rows_skipped++;
+             continue;
+          }
         w = 0;
         cells = termpty_cellrow_get(sd->pty, rel_y, &w);
         if (!cells)
           continue;
+        /* after the row, reading the backlog may intern attributes */
+        atts = termio_internal_atts_sync(sd);
         tc = evas_object_textgrid_cellrow_get(sd->grid.obj, y);
         if (!tc)
           continue;
 
-        /* Compute @cur_sel_start_x, @cur_sel_end_x */
-        if (sd->pty->selection.codepoints)
-          {
-             cp = sd->pty->selection.codepoints;
-             if (sel_start_y <= rel_y && rel_y <= sel_end_y)
-               {
-                  if (sd->pty->selection.is_box)
-                    {
-                       cp += (rel_y - sel_start_y) * (sel_end_x - sel_start_x + 1);
-                       cur_sel_start_x = sel_start_x;
-                       cur_sel_end_x = sel_end_x;
-                    }
-                  else
-                    {
-                       cp += (rel_y - sel_start_y) * sd->pty->w;
-                       cur_sel_start_x = sel_start_x;
-                       cur_sel_end_x = sel_end_x;
-                       if (sel_start_y != sel_end_y)
-                         {
-                            if (rel_y == sel_start_y)
-                              {
-                                 cur_sel_end_x = sd->grid.w - 1;
-                              }
-                            else if (rel_y == sel_end_y)
-                              {
-                                 cp -= sel_start_x;
-                                 cur_sel_start_x = 0;
-                              }
-                            else
-                              {
-                                 cp -= sel_start_x;
-                                 cur_sel_start_x = 0;
-                                 cur_sel_end_x = sd->grid.w - 1;
-                              }
-                         }
-                    }
-               }
-          }
         if (EINA_UNLIKELY(sd->link.objs != NULL))
           {
              if (sd->link.y1 == sd->link.y2)
@@ -2512,11 +2646,6 @@ termio_internal_render(Termio *sd,
         /* Look at every cell in that line */
         for (x = 0; x < sd->grid.w; x++)
           {
-             Eina_Unicode *u = NULL;
-
-             if (cp && cur_sel_start_x <= x && x <= cur_sel_end_x)
-               u = cp++;
-
              if ((!cells) || (x >= w))
                {
                   if ((tc[x].codepoint != 0) ||
@@ -2536,11 +2665,6 @@ termio_internal_render(Termio *sd,
                   tc[x].italic = 0;
                   tc[x].double_width = 0;
 
-                  if (u && *u != ' ' && *u)
-                    {
-                       termio_sel_set(sd, EINA_FALSE);
-                       u = cp = NULL;
-                    }
                   if (EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                     {
                        termio_remove_links(sd);
@@ -2549,6 +2673,7 @@ termio_internal_render(Termio *sd,
                }
              else
                {
+                  const Termatt *att = termpty_cell_att(sd->pty, &cells[x]);
                   int bid, bx = 0, by = 0;
 
                   bid = termpty_block_id_get(&(cells[x]), &bx, &by);
@@ -2580,18 +2705,13 @@ termio_internal_render(Termio *sd,
                                                blk->w * sd->font.chw,
                                                blk->h * sd->font.chh);
                          }
-                       if (u && *u != ' ' && *u)
-                         {
-                            termio_sel_set(sd, EINA_FALSE);
-                            u = cp = NULL;
-                         }
                        if (EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                          {
                             termio_remove_links(sd);
                             l1 = l2 = -1;
                          }
                     }
-                  else if (cells[x].att.invisible)
+                  else if (att->invisible)
                     {
                        if ((tc[x].codepoint != 0) ||
                            (tc[x].bg != COL_INVIS) ||
@@ -2608,15 +2728,10 @@ termio_internal_render(Termio *sd,
                        tc[x].strikethrough = 0;
                        tc[x].bold = 0;
                        tc[x].italic = 0;
-                       tc[x].double_width = cells[x].att.dblwidth;
+                       tc[x].double_width = att->dblwidth;
                        if ((tc[x].double_width) && (tc[x].codepoint == 0) &&
                            (ch2 == x - 1))
                          ch2 = x;
-                       if (u && *u != ' ' && *u)
-                         {
-                            termio_sel_set(sd, EINA_FALSE);
-                            u = cp = NULL;
-                         }
                        if (EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                          {
                             termio_remove_links(sd);
@@ -2625,107 +2740,45 @@ termio_internal_render(Termio *sd,
                     }
                   else
                     {
-                       int fg, bg, fgext, bgext, bold, italic;
-                       Eina_Unicode codepoint;
-
-                       // colors
-                       fg = cells[x].att.fg;
-                       bg = cells[x].att.bg;
-                       fgext = cells[x].att.fg256;
-                       bgext = cells[x].att.bg256;
-                       codepoint = cells[x].codepoint;
-
-                       if ((fg == COL_DEF) && (cells[x].att.inverse ^ inv))
-                         fg = COL_INVERSEBG;
-                       if (bg == COL_DEF)
-                         {
-                            if (cells[x].att.inverse ^ inv)
-                              bg = COL_INVERSE;
-                            else if (!bgext)
-                              bg = COL_INVIS;
-                         }
-
-                       if ((cells[x].att.bgintense) && (!bgext))
-                         bg += 12;
-
-                       if (!fgext)
-                         {
-                            if ((cells[x].att.fgintense) || (cells[x].att.bold))
-                              fg += 12;
-                            if (cells[x].att.faint)
-                              fg += 2 * 12;
-                         }
-
-                       if (cells[x].att.inverse ^ inv)
-                         {
-                            int t;
-                            t = fgext; fgext = bgext; bgext = t;
-                            t = fg; fg = bg; bg = t;
-                         }
+                       const Evas_Textgrid_Cell *ac;
+                       Evas_Textgrid_Cell tmp;
+                       Eina_Unicode codepoint = cells[x].codepoint;
 
-                       /* if font does not have bolditalic, bright/bold
-                        * color is still applied
-                        */
-                       if (sd->config->font.bolditalic)
-                         {
-                            bold = cells[x].att.bold;
-                            italic = cells[x].att.italic;
-                         }
+                       if (EINA_LIKELY(atts != NULL))
+                         ac = &atts[cells[x].att_id];
                        else
                          {
-                            bold = 0;
-                            italic = 0;
+                            termio_internal_att_textgrid(
+                               att, inv, sd->config->font.bolditalic, &tmp);
+                            ac = &tmp;
                          }
-
                        if ((tc[x].codepoint != codepoint) ||
-                           (tc[x].bold != bold) ||
-                           (tc[x].italic != italic) ||
-                           (tc[x].fg != fg) ||
-                           (tc[x].bg != bg) ||
-                           (tc[x].fg_extended != fgext) ||
-                           (tc[x].bg_extended != bgext) ||
-                           (tc[x].underline != cells[x].att.underline) ||
-                           (tc[x].strikethrough != cells[x].att.strike))
+                           (tc[x].bold != ac->bold) ||
+                           (tc[x].italic != ac->italic) ||
+                           (tc[x].fg != ac->fg) ||
+                           (tc[x].bg != ac->bg) ||
+                           (tc[x].fg_extended != ac->fg_extended) ||
+                           (tc[x].bg_extended != ac->bg_extended) ||
+                           (tc[x].underline != ac->underline) ||
+                           (tc[x].strikethrough != ac->strikethrough))
                          {
                             if (ch1 < 0)
                               ch1 = x;
                             ch2 = x;
                          }
-                       tc[x].fg_extended = fgext;
-                       tc[x].bg_extended = bgext;
-                       tc[x].underline = cells[x].att.underline;
-                       tc[x].strikethrough = cells[x].att.strike;
-                       if (sd->config->font.bolditalic)
-                         {
-                            tc[x].bold = cells[x].att.bold;
-                            tc[x].italic = cells[x].att.italic;
-                         }
-                       else
-                         {
-                            tc[x].bold = 0;
-                            tc[x].italic = 0;
-                         }
-                       tc[x].double_width = cells[x].att.dblwidth;
-                       tc[x].fg = fg;
-                       tc[x].bg = bg;
                        if (tc[x].codepoint != codepoint &&
                            EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                          {
                             termio_remove_links(sd);
                             l1 = l2 = -1;
                          }
+                       tc[x] = *ac;
                        tc[x].codepoint = codepoint;
                        if ((tc[x].double_width) && (tc[x].codepoint == 0) &&
                            (ch2 == x - 1))
                          ch2 = x;
-                       // cells[x].att.blink
-                       // cells[x].att.blink2
-                       if (u && (*u != codepoint) &&
-                           !(*u == 0x20 && codepoint == 0))
-                         {
-                            termio_sel_set(sd, EINA_FALSE);
-                            u = cp = NULL;
-                         }
+                       // att->blink
+                       // att->blink2
                     }
                }
           }
@@ -2733,8 +2786,11 @@ termio_internal_render(Termio *sd,
         /* only bothering to keep 1 change span per row - not worth doing
          * more really */
         if (ch1 >= 0)
-          evas_object_textgrid_update_add(sd->grid.obj, ch1, y,
-                                          ch2 - ch1 + 1, 1);
+          {
+             evas_object_textgrid_update_add(sd->grid.obj, ch1, y,
+                                             ch2 - ch1 + 1, 1);
+             sd->pty->stats.cells_rendered += ch2 - ch1 + 1;
+          }
      }
 
    preedit_str = term_preedit_str_get(sd->term);
@@ -2816,7 +2872,23 @@ termio_internal_render(Termio *sd,
         preedit_x = x - sd->cursor.x;
         preedit_y = y - sd->cursor.y;
      }
+
+   sd->render.scroll = sd->scroll;
+   sd->render.w = sd->grid.w;
+   sd->render.h = sd->grid.h;
+   sd->render.inv = !!inv;
+   sd->render.bolditalic = !!sd->config->font.bolditalic;
+   sd->render.preedit = (preedit_str && preedit_str[0]);
+   sd->render.sel_gen = sd->pty->selection.gen;
+   sd->render.sel_box = sd->pty->selection.is_box;
+   sd->render.sel_start.x = sd->pty->selection.start.x;
+   sd->render.sel_start.y = sd->pty->selection.start.y;
+   sd->render.sel_end.x = sd->pty->selection.end.x;
+   sd->render.sel_end.y = sd->pty->selection.end.y;
+   sd->render.since = termpty_changes_next(sd->pty);
    termpty_backlog_unlock();
    *preedit_xp = preedit_x;
    *preedit_yp = preedit_y;
+   sd->pty->stats.renders++;
+   sd->pty->stats.render_time += ecore_time_get() - t0;
 }
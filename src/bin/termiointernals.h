@@ -27,6 +27,28 @@ struct _Termio
       int x, y;
       Cursor_Shape shape;
    } cursor;
+   struct {
+      /* what the textgrid showed at the last render */
+      unsigned int since; // 0 forces a full render
+      int scroll, w, h;
+      struct {
+         int x, y;
+      } sel_start, sel_end;
+      unsigned int sel_gen;
+      unsigned char inv        : 1;
+      unsigned char bolditalic : 1;
+      unsigned char sel_box    : 1;
+      unsigned char preedit    : 1;
+   } render;
+   struct {
+      /* textgrid colors and styles of the attributes of the terminal, by
+       * their index, see termio_internal_atts_sync() */
+      Evas_Textgrid_Cell *cells;
+      unsigned int count, size;
+      unsigned int gen; /* of the indexes of the attributes */
+      unsigned char inv        : 1;
+      unsigned char bolditalic : 1;
+   } atts;
    struct {
       int cx, cy;
       int button;
@@ -80,6 +102,14 @@ struct _Termio
    Ecore_Timer *mouse_selection_scroll_timer;
    Ecore_Job *mouse_move_job;
    Ecore_Timer *mouseover_delay;
+   struct {
+      /* while output comes faster than it is shown, renders are paced by
+       * the timer instead of following every read */
+      Ecore_Timer *timer;
+      double start; /* since when reads stop on their deadline, 0 if not */
+      unsigned char active  : 1;
+      unsigned char changed : 1; /* since the last tick of the timer */
+   } flood;
    Evas_Object *win, *theme, *glayer;
    Config *config;
    const char *sel_str;
@@ -146,11 +176,16 @@ termio_selection_get(Termio *sd,
                      struct ty_sb *sb,
                      Eina_Bool rtrim);
 void
-termio_scroll(Evas_Object *obj, int direction, int start_y, int end_y);
+termio_scroll(Evas_Object *obj, const Termpty_Scrolled *scrolled);
 void
 termio_cursor_to_xy(Termio *sd, Evas_Coord x, Evas_Coord y,
                     int *cx, int *cy);
 void
+termio_internal_att_textgrid(const Termatt *att, int inv, Eina_Bool bolditalic,
+                             Evas_Textgrid_Cell *tc);
+const Evas_Textgrid_Cell *
+termio_internal_atts_sync(Termio *sd);
+void
 termio_internal_render(Termio *sd,
                        Evas_Coord ox, Evas_Coord oy,
                        int *preedit_xp, int *preedit_yp);
@@ -253,7 +253,7 @@ _txt_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp, int *codepointp)
    if ((*x >= w))
      goto empty;
    cell = cells[*x];
-   if ((cell.codepoint == 0) && (cell.att.dblwidth))
+   if ((cell.codepoint == 0) && (termpty_cell_att(ty, &cell)->dblwidth))
      {
         (*x)--;
         if (*x < 0)
@@ -261,14 +261,14 @@ _txt_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp, int *codepointp)
         cell = cells[*x];
      }
 
-   if (cell.att.tab_inserted)
+   if (termpty_cell_att(ty, &cell)->tab_inserted)
      {
         *txtlenp = 1;
         *codepointp = '\t';
         txt[0] = '\t';
         return 0;
      }
-   if ((cell.codepoint == 0) || (cell.att.link_id))
+   if ((cell.codepoint == 0) || (termpty_cell_att(ty, &cell)->link_id))
      goto empty;
 
    *txtlenp = codepoint_to_utf8(cell.codepoint, txt);
@@ -310,7 +310,7 @@ _txt_prev_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         /* Either the cell is in the normal screen and needs to have
          * autowrapped flag or is in the backlog and its length is larger than
          * the screen, spanning multiple lines */
-        if (((!cell.att.autowrapped) && (*y) >= 0)
+        if (((!termpty_cell_att(ty, &cell)->autowrapped) && (*y) >= 0)
             || (w < ty->w))
           goto empty;
      }
@@ -324,7 +324,7 @@ _txt_prev_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
 
         cell = cells[*x];
      }
-   if ((cell.codepoint == 0) && (cell.att.dblwidth))
+   if ((cell.codepoint == 0) && (termpty_cell_att(ty, &cell)->dblwidth))
      {
         (*x)--;
         if (*x < 0)
@@ -332,9 +332,9 @@ _txt_prev_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         cell = cells[*x];
      }
 
-   if (cell.att.tab_last)
+   if (termpty_cell_att(ty, &cell)->tab_last)
      {
-        while (*x >= 0 && !cells[*x].att.tab_inserted)
+        while (*x >= 0 && !termpty_cell_att(ty, &cells[*x])->tab_inserted)
           (*x)--;
         if (*x < 0)
           goto bad;
@@ -343,7 +343,7 @@ _txt_prev_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         txt[0] = '\t';
         return 0;
      }
-   if ((cell.codepoint == 0) || (cell.att.link_id))
+   if ((cell.codepoint == 0) || (termpty_cell_att(ty, &cell)->link_id))
      goto empty;
 
    *txtlenp = codepoint_to_utf8(cell.codepoint, txt);
@@ -381,7 +381,7 @@ _txt_next_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         if ((*x) <= ty->w)
           {
              cell = cells[w-1];
-             if (!cell.att.autowrapped)
+             if (!termpty_cell_att(ty, &cell)->autowrapped)
                goto empty;
           }
 
@@ -392,13 +392,13 @@ _txt_next_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
      }
 
    cell = cells[*x];
-   if ((cell.codepoint == 0) && (cell.att.dblwidth))
+   if ((cell.codepoint == 0) && (termpty_cell_att(ty, &cell)->dblwidth))
      {
         (*x)++;
         if (*x >= w)
           {
              cell = cells[w-1];
-             if (!cell.att.autowrapped && w == ty->w)
+             if (!termpty_cell_att(ty, &cell)->autowrapped && w == ty->w)
                goto empty;
              (*y)++;
              *x = 0;
@@ -410,9 +410,9 @@ _txt_next_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
      }
 
    cell = cells[*x];
-   if (cell.att.tab_inserted)
+   if (termpty_cell_att(ty, &cell)->tab_inserted)
      {
-        while (*x < w && !cells[*x].att.tab_last)
+        while (*x < w && !termpty_cell_att(ty, &cells[*x])->tab_last)
           (*x)++;
         if (*x >= w)
           goto bad;
@@ -421,7 +421,7 @@ _txt_next_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         txt[0] = '\t';
         return 0;
      }
-   if ((cell.codepoint == 0) || (cell.att.link_id))
+   if ((cell.codepoint == 0) || (termpty_cell_att(ty, &cell)->link_id))
      goto empty;
 
    *txtlenp = codepoint_to_utf8(cell.codepoint, txt);
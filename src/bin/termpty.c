@@ -8,6 +8,9 @@
 #include "termptyops.h"
 #include "backlog.h"
 #include "keyin.h"
+#include "utf8.h"
+#include "ring.h"
+#include "unit_tests.h"
 #if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
 # include "win.h"
 #endif
@@ -27,6 +30,8 @@
 # include <stropts.h>
 #endif
 #include <assert.h>
+#include <poll.h>
+#include <pthread.h>
 
 /* specific log domain to help debug only terminal code parser */
 int _termpty_log_dom = -1;
@@ -81,133 +86,165 @@ termpty_can_handle_key(const Termpty *ty,
 
 
 
-void
-termpty_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len)
+/* Upkeep of the tables the cells refer to, done once per read rather than
+ * while parsing */
+static void
+_handle_read_upkeep(Termpty *ty)
+{
+   if (EINA_UNLIKELY(ty->atts.count >= ty->atts.compact_at))
+     termpty_atts_compact(ty);
+   if (EINA_UNLIKELY(ty->truecolor.sweeping))
+     termpty_truecolor_sweep(ty);
+}
+
+static void
+_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len)
 {
-   Eina_Unicode *c, *ce, *c2, *b, *d;
-   int n, bytes;
+   const Eina_Unicode *c, *ce;
+   int n;
 
-   c = (Eina_Unicode *)codepoints;
+   c = codepoints;
    ce = &(c[len]);
+   ty->stats.codepoints += len;
 
-   if (ty->buf)
+   if (ty->seq.state)
+     c += termpty_seq_resume(ty, c, ce);
+   while (c < ce)
      {
-        bytes = (ty->buflen + len + 1) * sizeof(int);
-        b = realloc(ty->buf, bytes);
-        if (!b)
+        n = termpty_handle_seq(ty, c, ce);
+        if (n == 0)
           {
-             ERR(_("memerr: %s"), strerror(errno));
-             return;
+             termpty_seq_suspend(ty, c, ce);
+             break;
           }
-        DBG("realloc add %i + %i", (int)(ty->buflen * sizeof(int)), (int)(len * sizeof(int)));
-        if (!ty->buf_have_zero)
+        c += n;
+     }
+}
+
+void
+termpty_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len)
+{
+   _handle_read_upkeep(ty);
+   _handle_buf(ty, codepoints, len);
+}
+
+/* Printable ASCII runs shorter than this are left within the codepoint
+ * chunk given to _handle_buf(), they are most likely escape sequence
+ * arguments */
+#define ASCII_RUN_MIN 16
+#define CODEPOINTS_CHUNK 1024
+
+static void
+_handle_ascii_run(Termpty *ty, const char *s, size_t len)
+{
+   Eina_Unicode codepoints[CODEPOINTS_CHUNK];
+
+   ty->stats.codepoints += len;
+   ty->stats.ascii += len;
+   while (len > 0)
+     {
+        size_t n = MIN(len, (size_t)CODEPOINTS_CHUNK);
+
+        utf8_ascii_widen(s, codepoints, n);
+        termpty_text_append(ty, codepoints, n);
+        ty->last_char = codepoints[n - 1];
+        s += n;
+        len -= n;
+     }
+}
+
+/* Feed raw UTF-8 from the pty.
+ * Runs of printable ASCII outside of any escape sequence go straight to the
+ * screen, everything else is decoded to codepoints, multibyte characters
+ * only being decoded where they occur. A pending escape sequence is ended
+ * first, for the text following it to go straight to the screen as well.
+ * An incomplete trailing character is kept in ty->oldbuf. */
+void
+termpty_handle_utf8(Termpty *ty, const char *buf, int len)
+{
+   /* nul-terminated, the sequence parsers peek at the end of the buffer */
+   Eina_Unicode codepoints[CODEPOINTS_CHUNK + 1];
+   size_t i = 0, n;
+   int j;
+
+   _handle_read_upkeep(ty);
+   while (i < (size_t)len)
+     {
+        if (ty->seq.state)
           {
-             d = &(b[ty->buflen]);
-             ce = (Eina_Unicode *)codepoints + len;
-             for (c = (Eina_Unicode *)codepoints; c < ce; c++, d++)
+             n = utf8_printable_ascii_span(buf + i, len - i);
+             if (n > 0)
                {
-                  *d = *c;
-                  if (*c == 0x0)
-                    {
-                       ty->buf_have_zero = EINA_TRUE;
-                       break;
-                    }
+                  n = MIN(n, (size_t)CODEPOINTS_CHUNK);
+                  utf8_ascii_widen(buf + i, codepoints, n);
+                  codepoints[n] = 0;
+                  n = termpty_seq_resume(ty, codepoints, codepoints + n);
+                  ty->stats.codepoints += n;
+                  i += n;
+                  continue;
                }
-             for (; c < ce; c++, d++) *d = *c;
-          }
-        else
-          {
-             bytes = len * sizeof(Eina_Unicode);
-             memcpy(&(b[ty->buflen]), codepoints, bytes);
           }
-        ty->buf = b;
-        ty->buflen += len;
-        ty->buf[ty->buflen] = 0;
-        c = ty->buf;
-        ce = c + ty->buflen;
-        while (c < ce)
+        else if (!((ty->block.expecting) && (ty->block.on)))
           {
-             n = termpty_handle_seq(ty, c, ce);
-             if (n == 0)
+             n = utf8_printable_ascii_span(buf + i, len - i);
+             if (n > 0)
                {
-                  Eina_Unicode *tmp = ty->buf;
-                  ty->buf = NULL;
-                  ty->buflen = 0;
-                  bytes = ((char *)ce - (char *)c) + sizeof(Eina_Unicode);
-                  DBG("malloc till %i", (int)(bytes - sizeof(Eina_Unicode)));
-                  ty->buf = malloc(bytes);
-                  if (!ty->buf)
-                    {
-                       ERR(_("memerr: %s"), strerror(errno));
-                       return;
-                    }
-                  ty->buf_have_zero = EINA_FALSE;
-                  for (d = ty->buf, c2 = c; c2 < ce; c2++, d++)
-                    {
-                       *d = *c2;
-                       if (*c2 == 0x0)
-                         {
-                            ty->buf_have_zero = EINA_TRUE;
-                            break;
-                         }
-                    }
-                  for (; c2 < ce; c2++, d++) *d = *c2;
-                  bytes = (char *)ce - (char *)c;
-                  ty->buflen = bytes / sizeof(Eina_Unicode);
-                  ty->buf[ty->buflen] = 0;
-                  free(tmp);
-                  break;
+                  _handle_ascii_run(ty, buf + i, n);
+                  i += n;
+                  continue;
                }
-             c += n;
           }
-        if (c == ce)
+
+        j = 0;
+        while ((i < (size_t)len) && (j < CODEPOINTS_CHUNK))
           {
-             if (ty->buf)
+             unsigned char c = buf[i];
+
+             if ((c >= 0x20) && (c < 0x7f))
                {
-                  ty->buf_have_zero = EINA_FALSE;
-                  free(ty->buf);
-                  ty->buf = NULL;
+                  n = utf8_printable_ascii_span(buf + i, len - i);
+                  if ((n >= ASCII_RUN_MIN) && (j > 0))
+                    break;
+                  n = MIN(n, (size_t)(CODEPOINTS_CHUNK - j));
+                  utf8_ascii_widen(buf + i, codepoints + j, n);
+                  j += n;
+                  i += n;
                }
-             ty->buflen = 0;
-          }
-     }
-   else
-     {
-        ty->buf_have_zero = EINA_TRUE;
-        while (c < ce)
-          {
-             n = termpty_handle_seq(ty, c, ce);
-             if (n == 0)
+             else if (c < 0x80)
                {
-                  bytes = ((char *)ce - (char *)c) + sizeof(Eina_Unicode);
-                  ty->buf_have_zero = EINA_FALSE;
-                  ty->buf = malloc(bytes);
-                  DBG("malloc %i", (int)(bytes - sizeof(Eina_Unicode)));
-                  if (!ty->buf)
-                    {
-                       ERR(_("memerr: %s"), strerror(errno));
-                    }
-                  else
+                  codepoints[j++] = c;
+                  i++;
+               }
+             else
+               {
+                  size_t prev_i = i;
+                  Eina_Unicode g;
+
+                  g = utf8_codepoint_next_get(buf, len, &i);
+                  if ((0xdc80 <= g) && (g <= 0xdcff) &&
+                      (len - prev_i) <= sizeof(ty->oldbuf))
                     {
-                       ty->buf_have_zero = EINA_FALSE;
-                       for (d = ty->buf, c2 = c; c2 < ce; c2++, d++)
+                       unsigned int k;
+
+                       for (k = 0;
+                            (k < (unsigned int)sizeof(ty->oldbuf)) &&
+                            (k < (unsigned int)(len - prev_i));
+                            k++)
                          {
-                            *d = *c2;
-                            if (*c2 == 0x0)
-                              {
-                                 ty->buf_have_zero = EINA_TRUE;
-                                 break;
-                              }
+                            ty->oldbuf[k] = buf[prev_i+k];
                          }
-                       for (; c2 < ce; c2++, d++) *d = *c2;
-                       bytes = (char *)ce - (char *)c;
-                       ty->buflen = bytes / sizeof(Eina_Unicode);
-                       ty->buf[ty->buflen] = 0;
+                       DBG("failure at %d/%d/%d", (int)prev_i, (int)i, len);
+                       codepoints[j] = 0;
+                       if (j > 0)
+                         _handle_buf(ty, codepoints, j);
+                       return;
                     }
-                  break;
+                  codepoints[j++] = g;
                }
-             c += n;
           }
+        codepoints[j] = 0;
+        if (j > 0)
+          _handle_buf(ty, codepoints, j);
      }
 }
 
@@ -225,19 +262,290 @@ _pty_size(Termpty *ty)
        ERR(_("Size set ioctl failed: %s"), strerror(errno));
 }
 
+#if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
+/* Optional thread reading the pty.
+ * It fills a ring buffer with large reads and wakes the main loop up through
+ * an Ecore_Pipe, once per batch: it only writes to the pipe again once the
+ * main loop started consuming what was notified.  Parsing still happens in
+ * the main loop, from _handle_read() */
+
+#define READER_RING_SIZE (1024 * 1024)
+
+struct _Termpty_Reader
+{
+   pthread_t thread;
+   Ecore_Pipe *pipe;
+   int quit[2];
+   struct ty_ring ring;
+   /* only used to sleep while the ring is full */
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   /* shared with the thread, accessed atomically */
+   int notified;
+   int waiting;
+   int stop;
+   int done;
+   int error;
+   Eina_Bool joined;
+};
+
+static Eina_Bool _handle_read(Termpty *ty, Eina_Bool false_on_empty);
+
+static void
+_reader_notify(Termpty_Reader *rd)
+{
+   char c = 0;
+
+   if (!__atomic_exchange_n(&rd->notified, 1, __ATOMIC_SEQ_CST))
+     ecore_pipe_write(rd->pipe, &c, sizeof(c));
+}
+
+static void *
+_reader_thread(void *data)
+{
+   Termpty *ty = data;
+   Termpty_Reader *rd = ty->reader;
+   struct pollfd fds[2];
+
+   fds[0].fd = ty->fd;
+   fds[0].events = POLLIN;
+   fds[1].fd = rd->quit[0];
+   fds[1].events = POLLIN;
+   while (!__atomic_load_n(&rd->stop, __ATOMIC_SEQ_CST))
+     {
+        ssize_t len;
+        size_t room;
+        char *buf;
+
+        buf = ty_ring_write_ptr(&rd->ring, &room);
+        if (room == 0)
+          {
+             pthread_mutex_lock(&rd->lock);
+             __atomic_store_n(&rd->waiting, 1, __ATOMIC_SEQ_CST);
+             while ((ty_ring_used(&rd->ring) == rd->ring.size) &&
+                    (!__atomic_load_n(&rd->stop, __ATOMIC_SEQ_CST)))
+               pthread_cond_wait(&rd->cond, &rd->lock);
+             __atomic_store_n(&rd->waiting, 0, __ATOMIC_SEQ_CST);
+             pthread_mutex_unlock(&rd->lock);
+             continue;
+          }
+
+        if (poll(fds, 2, -1) < 0)
+          {
+             if (errno == EINTR)
+               continue;
+             rd->error = errno;
+             break;
+          }
+        if (fds[1].revents)
+          break;
+
+        len = read(ty->fd, buf, room);
+        if (len < 0)
+          {
+             if ((errno == EAGAIN) || (errno == EINTR))
+               continue;
+             rd->error = errno;
+             break;
+          }
+        if (len == 0)
+          break;
+        ty_ring_write_commit(&rd->ring, len);
+        _reader_notify(rd);
+     }
+   __atomic_store_n(&rd->done, 1, __ATOMIC_SEQ_CST);
+   _reader_notify(rd);
+   return NULL;
+}
+
+/* Behaves like read() on the pty */
+static ssize_t
+_reader_read(Termpty_Reader *rd, char *buf, size_t len)
+{
+   size_t n;
+
+   n = ty_ring_read(&rd->ring, buf, len);
+   if ((n > 0) && (__atomic_load_n(&rd->waiting, __ATOMIC_SEQ_CST)))
+     {
+        pthread_mutex_lock(&rd->lock);
+        pthread_cond_signal(&rd->cond);
+        pthread_mutex_unlock(&rd->lock);
+     }
+   if (n > 0)
+     return n;
+   if (!__atomic_load_n(&rd->done, __ATOMIC_SEQ_CST))
+     {
+        errno = EAGAIN;
+        return -1;
+     }
+   /* the thread may have pushed more data before being done */
+   n = ty_ring_read(&rd->ring, buf, len);
+   if (n > 0)
+     return n;
+   errno = rd->error;
+   return rd->error ? -1 : 0;
+}
+
+static void
+_cb_reader(void *data,
+           void *buf EINA_UNUSED,
+           unsigned int len EINA_UNUSED)
+{
+   Termpty *ty = data;
+   Termpty_Reader *rd = ty->reader;
+
+   if (!rd)
+     return;
+   __atomic_store_n(&rd->notified, 0, __ATOMIC_SEQ_CST);
+   if (!_handle_read(ty, EINA_FALSE))
+     return;
+   /* _handle_read() reads a limited amount per call */
+   if ((ty->reader) && (ty_ring_used(&rd->ring) > 0))
+     _reader_notify(rd);
+}
+
+static void
+_reader_stop(Termpty_Reader *rd)
+{
+   char c = 0;
+
+   if (rd->joined)
+     return;
+   __atomic_store_n(&rd->stop, 1, __ATOMIC_SEQ_CST);
+   if (write(rd->quit[1], &c, sizeof(c)) < 0)
+     ERR("could not stop reader thread: %s", strerror(errno));
+   pthread_mutex_lock(&rd->lock);
+   pthread_cond_signal(&rd->cond);
+   pthread_mutex_unlock(&rd->lock);
+   pthread_join(rd->thread, NULL);
+   rd->joined = EINA_TRUE;
+}
+
+static void
+_reader_free(Termpty *ty)
+{
+   Termpty_Reader *rd = ty->reader;
+
+   if (!rd)
+     return;
+   ty->reader = NULL;
+   _reader_stop(rd);
+   ecore_pipe_del(rd->pipe);
+   close(rd->quit[0]);
+   close(rd->quit[1]);
+   pthread_cond_destroy(&rd->cond);
+   pthread_mutex_destroy(&rd->lock);
+   ty_ring_free(&rd->ring);
+   free(rd);
+}
+
+static Eina_Bool
+_reader_start(Termpty *ty)
+{
+   Termpty_Reader *rd;
+   sigset_t mask, oldmask;
+   int ret;
+
+   rd = calloc(1, sizeof(Termpty_Reader));
+   if (!rd)
+     return EINA_FALSE;
+   if (ty_ring_init(&rd->ring, READER_RING_SIZE) < 0)
+     goto err_ring;
+   if (pipe(rd->quit) < 0)
+     goto err_pipe;
+   rd->pipe = ecore_pipe_add(_cb_reader, ty);
+   if (!rd->pipe)
+     goto err_ecore_pipe;
+   pthread_mutex_init(&rd->lock, NULL);
+   pthread_cond_init(&rd->cond, NULL);
+   ty->reader = rd;
+   /* signals are for the main loop, the thread inherits this mask */
+   sigfillset(&mask);
+   pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+   ret = pthread_create(&rd->thread, NULL, _reader_thread, ty);
+   pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+   if (ret != 0)
+     {
+        ty->reader = NULL;
+        pthread_cond_destroy(&rd->cond);
+        pthread_mutex_destroy(&rd->lock);
+        ecore_pipe_del(rd->pipe);
+        goto err_ecore_pipe;
+     }
+   return EINA_TRUE;
+
+err_ecore_pipe:
+   close(rd->quit[0]);
+   close(rd->quit[1]);
+err_pipe:
+   ty_ring_free(&rd->ring);
+err_ring:
+   ERR("could not start reader thread: %s", strerror(errno));
+   free(rd);
+   return EINA_FALSE;
+}
+#endif
+
+static Ecore_Fd_Handler_Flags
+_fd_flags(const Termpty *ty)
+{
+   if (ty->reader)
+     return ECORE_FD_ERROR;
+   return ECORE_FD_ERROR | ECORE_FD_READ;
+}
+
+/* Bounds of the size of a single read from the pty */
+#define READ_MIN 4096
+#define READ_MAX (64 * 1024)
+
+/* How long to spend on handling output from the pty, per main loop
+ * iteration */
+static double
+_read_budget_get(const Termpty *ty)
+{
+   double budget = 0.5;
+
+   if (ty->config)
+     budget = ty->config->read_budget;
+   if (budget < 0.1)
+     budget = 0.1;
+   return budget * ecore_animator_frametime_get();
+}
+
+/* Read as much as should be parsed until the deadline, from the average
+ * time it took to handle a byte so far */
+static int
+_read_size_get(const Termpty *ty, double remaining)
+{
+   double size;
+
+   if (ty->read_cost <= 0.0)
+     return READ_MIN;
+   size = remaining / ty->read_cost;
+   if (size < READ_MIN)
+     return READ_MIN;
+   if (size > READ_MAX)
+     return READ_MAX;
+   return size;
+}
+
 static Eina_Bool
 _handle_read(Termpty *ty, Eina_Bool false_on_empty)
 {
-   int len, reads;
+   char buf[READ_MAX + 1];
+   double t, t2, deadline;
+   int len, size = READ_MIN;
 
-   // read up to 64 * 4096 bytes
-   for (reads = 0; reads < 64; reads++)
+   // read until the budget is spent, the remaining bytes will be read on the
+   // next main loop iteration
+   ty->stats.wakeups++;
+   t = ecore_time_get();
+   deadline = t + _read_budget_get(ty);
+   for (;;)
      {
-        Eina_Unicode codepoint[4097];
-        char buf[4097];
         char *rbuf = buf;
-        int i, j;
-        len = sizeof(buf) - 1;
+        int i;
+        len = size;
 
         for (i = 0; i < (int)sizeof(ty->oldbuf) && ty->oldbuf[i] & 0x80; i++)
           {
@@ -246,7 +554,12 @@ _handle_read(Termpty *ty, Eina_Bool false_on_empty)
              len--;
           }
         errno = 0;
-        len = read(ty->fd, rbuf, len);
+#if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
+        if (ty->reader)
+          len = _reader_read(ty->reader, rbuf, len);
+        else
+#endif
+          len = read(ty->fd, rbuf, len);
         if ((len < 0 && !(errno == EAGAIN || errno == EINTR)) ||
             (len == 0 && errno != 0))
           {
@@ -255,6 +568,9 @@ _handle_read(Termpty *ty, Eina_Bool false_on_empty)
                {
                   ERR("error while reading from tty slave fd: %s", strerror(errno));
                }
+#if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
+             _reader_free(ty);
+#endif
              close(ty->fd);
              ty->fd = -1;
              if (ty->hand_fd)
@@ -263,6 +579,8 @@ _handle_read(Termpty *ty, Eina_Bool false_on_empty)
              return ECORE_CALLBACK_CANCEL;
           }
         if (len <= 0) break;
+        ty->stats.reads++;
+        ty->stats.bytes += len;
 
         for (i = 0; i < (int)sizeof(ty->oldbuf); i++)
           ty->oldbuf[i] = 0;
@@ -282,43 +600,20 @@ _handle_read(Termpty *ty, Eina_Bool false_on_empty)
         printf("\n");
         */
         buf[len] = 0;
-        // convert UTF8 to codepoint integers
-        j = 0;
-        for (i = 0; i < len;)
-          {
-             Eina_Unicode g = 0, prev_i = i;
+        termpty_handle_utf8(ty, buf, len);
 
-             if (buf[i])
-               {
-                  g = eina_unicode_utf8_next_get(buf, &i);
-                  if ((0xdc80 <= g) && (g <= 0xdcff) &&
-                      (len - (int)prev_i) <= (int)sizeof(ty->oldbuf))
-                    {
-                       unsigned int k;
-
-                       for (k = 0;
-                            (k < (unsigned int)sizeof(ty->oldbuf)) &&
-                            (k < (unsigned int)(len - prev_i));
-                            k++)
-                         {
-                            ty->oldbuf[k] = buf[prev_i+k];
-                         }
-                       DBG("failure at %d/%d/%d", (int)prev_i, (int)i, len);
-                       break;
-                    }
-               }
-             else
-               {
-                  g = 0;
-                  i++;
-               }
-             codepoint[j] = g;
-             j++;
-          }
-        codepoint[j] = 0;
-//        DBG("---------------- handle buf %i", j);
-        termpty_handle_buf(ty, codepoint, j);
-     }
+        t2 = ecore_time_get();
+        if (ty->read_cost <= 0.0)
+          ty->read_cost = (t2 - t) / len;
+        else
+          ty->read_cost = (ty->read_cost * 7 + (t2 - t) / len) / 8;
+        t = t2;
+        if (t >= deadline)
+          break;
+        size = _read_size_get(ty, deadline - t);
+     }
+   ty->read_saturated = (len > 0);
+   termpty_scroll_flush(ty);
    if (ty->cb.change.func)
      ty->cb.change.func(ty->cb.change.data);
 #if defined(BINARY_TYFUZZ) || defined(BINARY_TYTEST)
@@ -365,9 +660,7 @@ _handle_write(Termpty *ty)
    ty_sb_lskip(sb, len);
 
    if (!sb->len && ty->hand_fd)
-     ecore_main_fd_handler_active_set(ty->hand_fd,
-                                      ECORE_FD_ERROR |
-                                      ECORE_FD_READ);
+     ecore_main_fd_handler_active_set(ty->hand_fd, _fd_flags(ty));
 
    return ECORE_CALLBACK_RENEW;
 }
@@ -437,6 +730,15 @@ _cb_exe_exit(void *data,
    ty->hand_exe_exit = NULL;
 
    /* Read everything till the end */
+#if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
+   if (ty->reader)
+     {
+        _reader_stop(ty->reader);
+        while (ty->reader && ty_ring_used(&ty->reader->ring) > 0)
+          _handle_read(ty, EINA_TRUE);
+        _reader_free(ty);
+     }
+#endif
    res = ECORE_CALLBACK_PASS_ON;
    while (ty->hand_fd && res != ECORE_CALLBACK_CANCEL)
      {
@@ -473,6 +775,20 @@ _limit_coord(Termpty *ty)
    TERMPTY_RESTRICT_FIELD(ty->cursor_save[0].cy, 0, ty->h);
    TERMPTY_RESTRICT_FIELD(ty->cursor_save[1].cx, 0, ty->w);
    TERMPTY_RESTRICT_FIELD(ty->cursor_save[1].cy, 0, ty->h);
+
+   /* margins not fitting anymore are reset, as DECSTBM/DECSLRM would */
+   if ((ty->termstate.top_margin >= ty->h) ||
+       (ty->termstate.bottom_margin > ty->h))
+     {
+        ty->termstate.top_margin = 0;
+        ty->termstate.bottom_margin = 0;
+     }
+   if ((ty->termstate.left_margin >= ty->w) ||
+       (ty->termstate.right_margin > ty->w))
+     {
+        ty->termstate.left_margin = 0;
+        ty->termstate.right_margin = 0;
+     }
 }
 
 void
@@ -570,6 +886,31 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
             "screen2", ty->w, ty->h, strerror(errno));
         goto err;
      }
+   ty->screen_rows = malloc(sizeof(Termcell *) * ty->h);
+   ty->screen2_rows = malloc(sizeof(Termcell *) * ty->h);
+   if ((!ty->screen_rows) || (!ty->screen2_rows))
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "screen rows", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
+   termpty_screen_rows_set(ty->screen_rows, ty->screen, ty->w, ty->h);
+   termpty_screen_rows_set(ty->screen2_rows, ty->screen2, ty->w, ty->h);
+   ty->screen_info = calloc(ty->h, sizeof(Termrow));
+   ty->screen2_info = calloc(ty->h, sizeof(Termrow));
+   if ((!ty->screen_info) || (!ty->screen2_info))
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "screen info", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
+   ty->changes.gen = 1;
+   if (!termpty_atts_init(ty))
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "attributes", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
 
    ty->hl.bitmap = calloc(1, HL_LINKS_MAX / 8); /* bit map for 1 << 16 elements */
    if (!ty->hl.bitmap)
@@ -585,8 +926,6 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
 
    termpty_reset_state(ty);
 
-   ty->circular_offset = 0;
-
 #if defined(BINARY_TYFUZZ) || defined(BINARY_TYTEST)
    ty->fd = STDIN_FILENO;
    ty->hand_fd = ecore_main_fd_handler_add(ty->fd,
@@ -813,11 +1152,16 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
    close(ty->slavefd);
    ty->slavefd = -1;
 
-   ty->hand_fd = ecore_main_fd_handler_add(ty->fd, ECORE_FD_READ,
+#if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
+   if (config->reader_thread)
+     _reader_start(ty);
+#endif
+   ty->hand_fd = ecore_main_fd_handler_add(ty->fd, _fd_flags(ty),
                                            _cb_fd, ty,
                                            NULL, NULL);
    /* ensure we're not missing a read */
-   _cb_fd(ty, ty->hand_fd);
+   if (!ty->reader)
+     _cb_fd(ty, ty->hand_fd);
 
    _pty_size(ty);
    termpty_save_register(ty);
@@ -825,6 +1169,11 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
 err:
    free(ty->screen);
    free(ty->screen2);
+   free(ty->screen_rows);
+   free(ty->screen2_rows);
+   free(ty->screen_info);
+   free(ty->screen2_info);
+   termpty_atts_shutdown(ty);
    free(ty->hl.bitmap);
    if (ty->fd >= 0) close(ty->fd);
    if (ty->slavefd >= 0) close(ty->slavefd);
@@ -842,6 +1191,9 @@ termpty_free(Termpty *ty)
    if (ty->block.blocks) eina_hash_free(ty->block.blocks);
    if (ty->block.chid_map) eina_hash_free(ty->block.chid_map);
    if (ty->block.active) eina_list_free(ty->block.active);
+#if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
+   _reader_free(ty);
+#endif
    if (ty->fd >= 0)
      {
         close(ty->fd);
@@ -893,6 +1245,12 @@ termpty_free(Termpty *ty)
    termpty_backlog_free(ty);
    free(ty->screen);
    free(ty->screen2);
+   free(ty->screen_rows);
+   free(ty->screen2_rows);
+   free(ty->screen_info);
+   free(ty->screen2_info);
+   free(ty->selection.rows);
+   termpty_atts_shutdown(ty);
    if (ty->hl.links)
      {
         uint16_t i;
@@ -906,7 +1264,7 @@ termpty_free(Termpty *ty)
        free(ty->hl.links);
      }
    free(ty->hl.bitmap);
-   free(ty->buf);
+   free(ty->seq.buf);
    free(ty->tabs);
    ty_sb_free(&ty->write_buffer);
    free(ty);
@@ -920,33 +1278,33 @@ termpty_config_update(Termpty *ty, Config *config)
 }
 
 static Eina_Bool
-_termpty_cell_is_empty(const Termcell *cell)
+_termpty_cell_is_empty(const Termpty *ty, const Termcell *cell)
 {
+   const Termatt *att = termpty_cell_att(ty, cell);
+
    return ((cell->codepoint == 0) ||
-           (cell->att.invisible) ||
-           (cell->att.fg == COL_INVIS)) &&
-      ((cell->att.bg == COL_INVIS) || (cell->att.bg == COL_DEF));
+           (att->invisible) ||
+           ((att->fg == COL_INVIS) && (!att->fgtrue))) &&
+      (((att->bg == COL_INVIS) || (att->bg == COL_DEF)) &&
+       (!att->bgtrue));
 }
 
-static Eina_Bool
-_termpty_line_is_empty(const Termcell *cells, ssize_t nb_cells)
-{
-   ssize_t len;
 
-   for (len = nb_cells - 1; len >= 0; len--)
-     {
-        const Termcell *cell = cells + len;
-
-        if (!_termpty_cell_is_empty(cell))
-          return EINA_FALSE;
-     }
+/* TERMROW_* flags of what @cells hold */
+static unsigned char
+_cells_flags(const Termpty *ty, const Termcell *cells, ssize_t nb_cells)
+{
+   unsigned char flags = 0;
+   ssize_t i;
 
-   return EINA_TRUE;
+   for (i = 0; i < nb_cells; i++)
+     flags |= termpty_cell_flags(ty, &cells[i]);
+   return flags;
 }
 
-
 ssize_t
-termpty_line_length(const Termcell *cells, ssize_t nb_cells)
+termpty_line_length(const Termpty *ty, const Termcell *cells,
+                    ssize_t nb_cells)
 {
    ssize_t len;
 
@@ -957,19 +1315,34 @@ termpty_line_length(const Termcell *cells, ssize_t nb_cells)
      {
         const Termcell *cell = cells + len;
 
-        if (!_termpty_cell_is_empty(cell))
+        if (!_termpty_cell_is_empty(ty, cell))
           return len + 1;
      }
 
    return 0;
 }
 
+/* termpty_line_length(), cached for the rows of the screen */
+static ssize_t
+_cells_length(Termpty *ty, const Termcell *cells, ssize_t nb_cells)
+{
+   Termrow *row;
+
+   if ((nb_cells != ty->w) || (!termpty_cells_on_screen(ty, cells)) ||
+       ((cells - ty->screen) % ty->w))
+     return termpty_line_length(ty, cells, nb_cells);
+   row = &ty->screen_info[(cells - ty->screen) / ty->w];
+   if (row->len < 0)
+     row->len = termpty_line_length(ty, cells, nb_cells);
+   return row->len;
+}
 
 void
 termpty_text_save_top(Termpty *ty, Termcell *cells, ssize_t w_max)
 {
    Termsave *ts;
    ssize_t w, i;
+   uint32_t from = 0, to = 0;
 
    if (ty->backsize == 0)
      return;
@@ -977,44 +1350,65 @@ termpty_text_save_top(Termpty *ty, Termcell *cells, ssize_t w_max)
 
    termpty_backlog_lock();
 
-   w = termpty_line_length(cells, w_max);
+   w = _cells_length(ty, cells, w_max);
    for (i = 0; i < w - 1; i++)
      {
-        cells[i].att.autowrapped = 1;
+        /* runs of cells share their attributes */
+        if ((i == 0) || (cells[i].att_id != from))
+          {
+             Termatt att = *termpty_cell_att(ty, &cells[i]);
+
+             from = cells[i].att_id;
+             att.autowrapped = 1;
+             to = termpty_att_id(ty, &att);
+          }
+        cells[i].att_id = to;
      }
    if (ty->backsize > 0)
      {
         ts = BACKLOG_ROW_GET(ty, 1);
-        if (!ts->cells)
+        if (!ts->data)
           goto add_new_ts;
-        /* TODO: RESIZE uncompress ? */
-        if (ts->w && ts->cells[ts->w - 1].att.autowrapped)
+        if (termpty_save_autowrapped_get(ty, ts))
           {
-             int old_len = ts->w;
+             /* a line that keeps wrapping grows against the budget too */
              termpty_save_expand(ty, ts, cells, w);
-             ty->backlog_beacon.screen_y += (ts->w + ty->w - 1) / ty->w
-                                          - (old_len + ty->w - 1) / ty->w;
-             return;
+             goto end;
           }
      }
 
 add_new_ts:
    ts = BACKLOG_ROW_GET(ty, 0);
-   ts = termpty_save_new(ty, ts, w);
+   ts = termpty_save_new(ty, ts, cells, w);
    if (!ts)
      return;
-   TERMPTY_CELL_COPY(ty, cells, ts->cells, w);
-   ty->backpos++;
-   if (ty->backpos >= ty->backsize)
-     ty->backpos = 0;
+   ty->stats.backlog_added++;
+   termpty_backlog_advance(ty);
+   /* the line that just got that old is not going to change anymore */
+   if ((ty->config) && (ty->config->scrollback_compress > 0))
+     {
+        size_t age = ty->config->scrollback_compress + 1;
+
+        if (age < ty->backsize)
+          termpty_save_compress(ty, BACKLOG_ROW_GET(ty, age));
+     }
+   if ((ty->config) && (ty->config->scrollback_disk > 0))
+     {
+        size_t age = ty->config->scrollback_disk + 1;
+
+        if (age < ty->backsize)
+          termpty_save_to_disk(ty, BACKLOG_ROW_GET(ty, age));
+     }
+end:
    termpty_backlog_unlock();
 
-   ty->backlog_beacon.screen_y++;
-   ty->backlog_beacon.backlog_y++;
-   if (ty->backlog_beacon.backlog_y >= (int)ty->backsize)
+   ty->backlog_use.written = ecore_loop_time_get();
+   if ((ty->config) && (ty->config->scrollback_budget > 0))
      {
-        ty->backlog_beacon.screen_y = 0;
-        ty->backlog_beacon.backlog_y = 0;
+        termpty_backlog_lock();
+        termpty_backlog_evict((int64_t)ty->config->scrollback_budget
+                              * 1024 * 1024);
+        termpty_backlog_unlock();
      }
 }
 
@@ -1027,128 +1421,42 @@ termpty_row_length(Termpty *ty, int y)
 
    if (!cells)
      return 0;
-   if (y >= 0)
-     return termpty_line_length(cells, ty->w);
    return wret;
 }
 
 void
 termpty_backscroll_adjust(Termpty *ty, int *scroll)
 {
-   int backlog_y = ty->backlog_beacon.backlog_y;
-   int screen_y = ty->backlog_beacon.screen_y;
+   ssize_t len;
 
    if ((ty->backsize == 0) || (*scroll <= 0))
      {
         *scroll = 0;
         return;
      }
-   if (*scroll < screen_y)
-     {
-        return;
-     }
-
-   backlog_y++;
-   while (42)
-     {
-        int nb_lines;
-        Termsave *ts;
-
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells || backlog_y >= (int)ty->backsize)
-          {
-             *scroll = ty->backlog_beacon.screen_y;
-             return;
-          }
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-        screen_y += nb_lines;
-        ty->backlog_beacon.screen_y = screen_y;
-        ty->backlog_beacon.backlog_y = backlog_y;
-        backlog_y++;
-        if (*scroll <= screen_y)
-          {
-             return;
-          }
-     }
+   len = termpty_backlog_length(ty);
+   if (*scroll > len)
+     *scroll = len;
 }
 
 /* @requested_y unit is in visual lines on the screen */
 static Termcell*
-_termpty_cellrow_from_beacon_get(Termpty *ty, int requested_y, ssize_t *wret)
+_termpty_cellrow_from_backlog_get(Termpty *ty, int requested_y, ssize_t *wret)
 {
-   int backlog_y = ty->backlog_beacon.backlog_y;
-   int screen_y = ty->backlog_beacon.screen_y;
    Termsave *ts;
-   int nb_lines;
-   int first_loop = EINA_TRUE;
-
-   requested_y = -requested_y;
-
-   /* check if going from 0,0 is faster than using the beacon */
-   if (screen_y - requested_y > requested_y)
-     {
-        ty->backlog_beacon.backlog_y = 0;
-        ty->backlog_beacon.screen_y = 0;
-     }
-
-   /* going upward */
-   while (requested_y >= screen_y)
-     {
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells || backlog_y >= (int)ty->backsize)
-          {
-             return NULL;
-          }
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-
-        /* Only update the beacon if working on different line than the one
-         * from the beacon */
-        if (!first_loop)
-          {
-             screen_y += nb_lines;
-             ty->backlog_beacon.screen_y = screen_y;
-             ty->backlog_beacon.backlog_y = backlog_y;
-          }
-
-        if ((screen_y - nb_lines < requested_y) && (requested_y <= screen_y))
-          {
-             /* found the line */
-             int delta = screen_y - requested_y;
-             *wret = ts->w - delta * ty->w;
-             if (*wret > ty->w)
-               *wret = ty->w;
-             return &ts->cells[delta * ty->w];
-          }
-        backlog_y++;
-        first_loop = EINA_FALSE;
-     }
-   /* else, going downward */
-   while (requested_y <= screen_y)
-     {
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells)
-          {
-             return NULL;
-          }
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-
-        ty->backlog_beacon.screen_y = screen_y;
-        ty->backlog_beacon.backlog_y = backlog_y;
-
-        if ((screen_y - nb_lines < requested_y) && (requested_y <= screen_y))
-          {
-             /* found the line */
-             int delta = screen_y - requested_y;
-             *wret = ts->w - delta * ty->w;
-             if (*wret > ty->w)
-               *wret = ty->w;
-             return &ts->cells[delta * ty->w];
-          }
-        screen_y -= nb_lines;
-        backlog_y--;
-     }
+   Termcell *cells;
+   unsigned int offset;
 
-   return NULL;
+   ts = termpty_backlog_row_find(ty, -requested_y, &offset);
+   if (!ts)
+     return NULL;
+   cells = termpty_save_cells_get(ty, ts);
+   if (!cells)
+     return NULL;
+   *wret = ts->w - offset * ty->w;
+   if (*wret > ty->w)
+     *wret = ty->w;
+   return &cells[offset * ty->w];
 }
 
 /* @requested_y unit is in visual lines on the screen */
@@ -1157,17 +1465,18 @@ termpty_cellrow_get(Termpty *ty, int y_requested, ssize_t *wret)
 {
    if (y_requested >= 0)
      {
-        Termcell *cells = &(TERMPTY_SCREEN(ty, 0, y_requested));
+        Termcell *cells;
+
         if (y_requested >= ty->h)
           return NULL;
-
-        *wret = termpty_line_length(cells, ty->w);
+        cells = &(TERMPTY_SCREEN(ty, 0, y_requested));
+        *wret = _cells_length(ty, cells, ty->w);
         return cells;
      }
    if (!ty->back)
      return NULL;
 
-   return _termpty_cellrow_from_beacon_get(ty, y_requested, wret);
+   return _termpty_cellrow_from_backlog_get(ty, y_requested, wret);
 }
 
 /* @requested_y unit is in visual lines on the screen */
@@ -1188,7 +1497,7 @@ termpty_cell_get(Termpty *ty, int y_requested, int x_requested)
    if (!ty->back)
      return NULL;
 
-   cells = _termpty_cellrow_from_beacon_get(ty, y_requested, &wret);
+   cells = _termpty_cellrow_from_backlog_get(ty, y_requested, &wret);
    if (!cells || x_requested >= wret)
      return NULL;
    return cells + x_requested;
@@ -1209,26 +1518,23 @@ termpty_write(Termpty *ty, const char *input, int len)
    else if (ty->hand_fd)
      {
         ecore_main_fd_handler_active_set(ty->hand_fd,
-                                         ECORE_FD_ERROR |
-                                         ECORE_FD_READ |
-                                         ECORE_FD_WRITE);
+                                         _fd_flags(ty) | ECORE_FD_WRITE);
      }
 }
 
 struct screen_info
 {
-   Termcell *screen;
+   Termcell **rows;
    int w;
    int h;
    int x;
    int y;
    int cy;
    int cx;
-   int circular_offset;
 };
 
 #define SCREEN_INFO_GET_CELLS(Tsi, X, Y) \
-  Tsi->screen[X + (((Y + Tsi->circular_offset) % Tsi->h) * Tsi->w)]
+  Tsi->rows[Y][X]
 
 static void
 _check_screen_info(Termpty *ty, struct screen_info *si)
@@ -1241,9 +1547,8 @@ _check_screen_info(Termpty *ty, struct screen_info *si)
         termpty_text_save_top(ty, cells, si->w);
         termpty_cells_clear(ty, cells, si->w);
 
-        si->circular_offset++;
-        if (si->circular_offset >= si->h)
-          si->circular_offset = 0;
+        memmove(si->rows, si->rows + 1, (si->h - 1) * sizeof(Termcell *));
+        si->rows[si->h - 1] = cells;
 
         si->cy--;
      }
@@ -1269,7 +1574,7 @@ _termpty_line_rewrap(Termpty *ty, Termcell *src_cells, int len,
         return;
      }
 
-   autowrapped = src_cells[len-1].att.autowrapped;
+   autowrapped = termpty_cell_att(ty, &src_cells[len-1])->autowrapped;
 
    while (len > 0)
      {
@@ -1300,7 +1605,8 @@ _termpty_line_rewrap(Termpty *ty, Termcell *src_cells, int len,
              if ((len > 0) || (len == 0 && autowrapped))
                {
                   dst_cells = &SCREEN_INFO_GET_CELLS(si, 0, si->y);
-                  dst_cells[si->w - 1].att.autowrapped = 1;
+                  TERMPTY_CELL_ATT_SET(ty, &dst_cells[si->w - 1],
+                                       autowrapped, 1);
                }
              si->y++;
              si->x = 0;
@@ -1322,31 +1628,25 @@ _backlog_remove_latest_nolock(Termpty *ty)
    if (ty->backsize == 0)
      return;
    ts = BACKLOG_ROW_GET(ty, 1);
-
-   if (ty->backpos == 0)
-     ty->backpos = ty->backsize - 1;
-   else
-     ty->backpos--;
-
-   /* reset beacon */
-   ty->backlog_beacon.screen_y = 0;
-   ty->backlog_beacon.backlog_y = 0;
-
    termpty_save_free(ty, ts);
+   termpty_backlog_retreat(ty);
 }
 
 void
 termpty_resize(Termpty *ty, int new_w, int new_h)
 {
    Termcell *new_screen = NULL;
+   Termcell **new_screen_rows = NULL, **new_screen2_rows = NULL;
+   Termrow *new_info = NULL, *new_info2 = NULL;
    int old_y = 0,
        old_w = ty->w,
        old_h = ty->h,
        effective_old_h;
    int altbuf = 0;
-   struct screen_info new_si = {.screen = NULL};
+   struct screen_info new_si = {.rows = NULL};
    if ((ty->w == new_w) && (ty->h == new_h)) return;
 
+   termpty_scroll_flush(ty);
    termpty_backlog_lock();
 
    if (ty->altbuf)
@@ -1358,12 +1658,28 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
    new_screen = calloc(1, sizeof(Termcell) * new_w * new_h);
    if (!new_screen)
      goto bad;
+   new_info = calloc(new_h, sizeof(Termrow));
+   new_info2 = calloc(new_h, sizeof(Termrow));
+   if ((!new_info) || (!new_info2))
+     goto bad;
+   new_screen_rows = malloc(sizeof(Termcell *) * new_h);
+   new_screen2_rows = malloc(sizeof(Termcell *) * new_h);
+   if ((!new_screen_rows) || (!new_screen2_rows))
+     goto bad;
+   termpty_screen_rows_set(new_screen_rows, new_screen, new_w, new_h);
    free(ty->screen2);
    ty->screen2 = calloc(1, sizeof(Termcell) * new_w * new_h);
    if (!ty->screen2)
      goto bad;
-
-   new_si.screen = new_screen;
+   termpty_screen_rows_set(new_screen2_rows, ty->screen2, new_w, new_h);
+   free(ty->screen2_rows);
+   ty->screen2_rows = new_screen2_rows;
+   new_screen2_rows = NULL;
+   free(ty->screen2_info);
+   ty->screen2_info = new_info2;
+   new_info2 = NULL;
+
+   new_si.rows = new_screen_rows;
    new_si.w = new_w;
    new_si.h = new_h;
 
@@ -1372,7 +1688,7 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
    for (old_y = old_h -1; old_y >= 0; old_y--)
      {
         Termcell *cells = &(TERMPTY_SCREEN(ty, 0, old_y));
-        if (!_termpty_line_is_empty(cells, old_w))
+        if (_cells_length(ty, cells, old_w) > 0)
           {
              effective_old_h = old_y + 1;
              break;
@@ -1390,19 +1706,21 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
      {
         Termsave *ts;
         ts = BACKLOG_ROW_GET(ty, 1);
-        ts = termpty_save_extract(ts);
-        if (ts->cells && ts->w && ts->cells[ts->w - 1].att.autowrapped)
+        if (termpty_save_autowrapped_get(ty, ts))
           {
              Termcell *cells = &(TERMPTY_SCREEN(ty, 0, old_y)),
-                      *new_cells;
+                      *new_cells, *ts_cells;
              int len;
 
-             len = termpty_line_length(cells, old_w);
+             len = _cells_length(ty, cells, old_w);
 
+             ts_cells = termpty_save_cells_get(ty, ts);
+             if (!ts_cells)
+               goto bad;
              new_cells = malloc((ts->w + len) * sizeof(Termcell));
              if (!new_cells)
                goto bad;
-             memcpy(new_cells, ts->cells, ts->w * sizeof(Termcell));
+             memcpy(new_cells, ts_cells, ts->w * sizeof(Termcell));
              memcpy(new_cells + ts->w, cells, len * sizeof(Termcell));
 
              len+= ts->w;
@@ -1423,18 +1741,28 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
         Termcell *cells = &(TERMPTY_SCREEN(ty, 0, old_y));
         int len;
 
-        len = termpty_line_length(cells, old_w);
+        len = _cells_length(ty, cells, old_w);
         _termpty_line_rewrap(ty, cells, len, &new_si,
                              old_y == ty->cursor_state.cy);
      }
 
    free(ty->screen);
    ty->screen = new_screen;
+   free(ty->screen_rows);
+   ty->screen_rows = new_screen_rows;
+   for (old_y = 0; old_y < new_h; old_y++)
+     {
+        new_info[old_y].len = -1;
+        new_info[old_y].flags = _cells_flags(ty,
+                                             &new_screen[old_y * new_w],
+                                             new_w);
+     }
+   free(ty->screen_info);
+   ty->screen_info = new_info;
+   termpty_screen_rewritten(ty);
 
    ty->cursor_state.cy = (new_si.cy >= 0) ? new_si.cy : 0;
    ty->cursor_state.cx = (new_si.cx >= 0) ? new_si.cx : 0;
-   ty->circular_offset = new_si.circular_offset;
-   ty->circular_offset2 = 0;
 
    ty->w = new_w;
    ty->h = new_h;
@@ -1444,19 +1772,21 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
      termpty_screen_swap(ty);
 
    _limit_coord(ty);
+   termpty_truecolor_sweep_restart(ty);
 
    _pty_size(ty);
 
    termpty_backlog_unlock();
 
-   ty->backlog_beacon.backlog_y = 0;
-   ty->backlog_beacon.screen_y = 0;
-
    return;
 
 bad:
    termpty_backlog_unlock();
    free(new_screen);
+   free(new_screen_rows);
+   free(new_screen2_rows);
+   free(new_info);
+   free(new_info2);
 }
 
 pid_t
@@ -1606,21 +1936,36 @@ termpty_handle_block_codepoint_overwrite_heavy(Termpty *ty, int oldc, int newc)
      }
 }
 
+void
+termpty_screen_rows_set(Termcell **rows, Termcell *cells, int w, int h)
+{
+   int y;
+
+   for (y = 0; y < h; y++)
+     rows[y] = &cells[y * w];
+}
+
 void
 termpty_screen_swap(Termpty *ty)
 {
    Termcell *tmp_screen;
-   int tmp_circular_offset;
+   Termcell **tmp_rows;
+   Termrow *tmp_info;
 
    tmp_screen = ty->screen;
    ty->screen = ty->screen2;
    ty->screen2 = tmp_screen;
 
-   tmp_circular_offset = ty->circular_offset;
-   ty->circular_offset = ty->circular_offset2;
-   ty->circular_offset2 = tmp_circular_offset;
+   tmp_rows = ty->screen_rows;
+   ty->screen_rows = ty->screen2_rows;
+   ty->screen2_rows = tmp_rows;
+
+   tmp_info = ty->screen_info;
+   ty->screen_info = ty->screen2_info;
+   ty->screen2_info = tmp_info;
 
    ty->altbuf = !ty->altbuf;
+   termpty_screen_rewritten(ty);
 
    if (ty->cb.cancel_sel.func)
      ty->cb.cancel_sel.func(ty->cb.cancel_sel.data);
@@ -1631,6 +1976,8 @@ termpty_cells_set_content(Termpty *ty, Termcell *cells,
                           Eina_Unicode codepoint, int count)
 {
    int i;
+
+   termpty_cells_changed(ty, cells, count);
    for (i = 0; i < count; i++)
      {
         HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, cells[i].codepoint, codepoint);
@@ -1643,28 +1990,43 @@ termpty_cells_att_fill_preserve_colors(Termpty *ty, Termcell *cells,
                                        Eina_Unicode codepoint, int count)
 {
    int i;
-   Termcell local = { .codepoint = codepoint, .att = ty->termstate.att};
+   Termcell local = { .codepoint = codepoint,
+      .att_id = termpty_att_id(ty, &ty->termstate.att) };
+   unsigned char flags = termpty_cells_flags_get(ty, cells, count) |
+      termpty_cell_flags(ty, &local);
+   uint16_t link_id = ty->termstate.att.link_id;
 
-   if (EINA_UNLIKELY(local.att.link_id))
-     term_link_refcount_inc(ty, local.att.link_id, count);
+   if (EINA_UNLIKELY(link_id))
+     term_link_refcount_inc(ty, link_id, count);
 
+   termpty_cells_set(ty, cells, count, termpty_cell_flags(ty, &local));
    for (i = 0; i < count; i++)
      {
-        Termatt att = cells[i].att;
-        HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, cells[i].codepoint, codepoint);
-        if (EINA_UNLIKELY(cells[i].att.link_id))
-          term_link_refcount_dec(ty, cells[i].att.link_id, 1);
+        Termatt att = *termpty_cell_att(ty, &cells[i]);
+
+        if (EINA_UNLIKELY(flags))
+          {
+             HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, cells[i].codepoint,
+                                              codepoint);
+             if (EINA_UNLIKELY(att.link_id))
+               term_link_refcount_dec(ty, att.link_id, 1);
+          }
 
         cells[i] = local;
         if (ty->termstate.att.fg == 0 && ty->termstate.att.bg == 0)
           {
-             cells[i].att.fg = att.fg;
-             cells[i].att.fg256 = att.fg256;
-             cells[i].att.fgintense = att.fgintense;
-
-             cells[i].att.bg = att.bg;
-             cells[i].att.bg256 = att.bg256;
-             cells[i].att.bgintense = att.bgintense;
+             Termatt preserved = ty->termstate.att;
+
+             preserved.fg = att.fg;
+             preserved.fg256 = att.fg256;
+             preserved.fgtrue = att.fgtrue;
+             preserved.fgintense = att.fgintense;
+
+             preserved.bg = att.bg;
+             preserved.bg256 = att.bg256;
+             preserved.bgtrue = att.bgtrue;
+             preserved.bgintense = att.bgintense;
+             termpty_cell_att_set(ty, &cells[i], &preserved);
           }
      }
 }
@@ -1674,20 +2036,28 @@ void
 termpty_cell_codepoint_att_fill(Termpty *ty, Eina_Unicode codepoint,
                                 Termatt att, Termcell *dst, int n)
 {
-   Termcell local = { .codepoint = codepoint, .att = att };
+   Termcell local = { .codepoint = codepoint,
+      .att_id = termpty_att_id(ty, &att) };
+   unsigned char flags = termpty_cells_flags_get(ty, dst, n) |
+      termpty_cell_flags(ty, &local);
    int i;
 
-   if (EINA_UNLIKELY(local.att.link_id))
-     term_link_refcount_inc(ty, local.att.link_id, n);
+   if (EINA_UNLIKELY(att.link_id))
+     term_link_refcount_inc(ty, att.link_id, n);
 
-   for (i = 0; i < n; i++)
+   termpty_cells_set(ty, dst, n, termpty_cell_flags(ty, &local));
+   if (EINA_UNLIKELY(flags))
      {
-        HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint, codepoint);
-        if (EINA_UNLIKELY(dst[i].att.link_id))
-          term_link_refcount_dec(ty, dst[i].att.link_id, 1);
-
-        dst[i] = local;
+        for (i = 0; i < n; i++)
+          {
+             HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint, codepoint);
+             if (EINA_UNLIKELY(termpty_cell_link_id(ty, &dst[i])))
+               term_link_refcount_dec(ty, termpty_cell_link_id(ty, &dst[i]),
+                                      1);
+          }
      }
+   for (i = 0; i < n; i++)
+     dst[i] = local;
 }
 
 /* 0 means error here */
@@ -1803,3 +2173,449 @@ term_link_free(Termpty *ty, Term_Link *link)
    /* Remove from bitmap */
    hl_bitmap_clear_bit(ty, id);
 }
+
+static inline unsigned int
+_truecolor_hash(uint32_t rgb)
+{
+   return (rgb * 2654435761U) >> 23;
+}
+
+static void
+_truecolor_att_mark(const Termatt *att, void *data)
+{
+   uint8_t *used = data;
+
+   if (EINA_LIKELY(!att->fgtrue && !att->bgtrue))
+     return;
+   if (att->fgtrue)
+     used[att->fg / 8] |= 1 << (att->fg % 8);
+   if (att->bgtrue)
+     used[att->bg / 8] |= 1 << (att->bg % 8);
+}
+
+static void
+_truecolor_mark(const Termpty *ty, uint8_t *used,
+                const Termcell *cells, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+     {
+        if (cells[i].att_id)
+          _truecolor_att_mark(termpty_cell_att(ty, &cells[i]), used);
+     }
+}
+
+/* Marks what the screens and the cursor refer to. Lines may go from there
+ * to the part of the backlog already swept */
+static void
+_truecolor_sweep_screens(Termpty *ty)
+{
+   Termpty_Truecolors *tc = &ty->truecolor;
+
+   _truecolor_mark(ty, tc->marked, ty->screen, ty->w * ty->h);
+   _truecolor_mark(ty, tc->marked, ty->screen2, ty->w * ty->h);
+   _truecolor_att_mark(&ty->termstate.att, tc->marked);
+}
+
+/* Forget the true colors no cell refers to anymore. The backlog is gone
+ * through TRUECOLOR_SWEEP_LINES lines per read, not to stall parsing, while
+ * the table stays full */
+void
+termpty_truecolor_sweep(Termpty *ty)
+{
+   Termpty_Truecolors *tc = &ty->truecolor;
+   unsigned int idx, freed = 0;
+
+   if (ty->back)
+     {
+        tc->sweep_y = termpty_backlog_atts_foreach(ty, tc->sweep_y,
+                                                   TRUECOLOR_SWEEP_LINES,
+                                                   _truecolor_att_mark,
+                                                   tc->marked);
+        if (tc->sweep_y)
+          return;
+     }
+   _truecolor_sweep_screens(ty);
+
+   memset(tc->hash, 0, sizeof(tc->hash));
+   for (idx = 1; idx <= TRUECOLOR_MAX; idx++)
+     {
+        unsigned int h;
+
+        if (!(tc->marked[idx / 8] & (1 << (idx % 8))))
+          {
+             if (tc->used[idx / 8] & (1 << (idx % 8)))
+               freed++;
+             continue;
+          }
+        h = _truecolor_hash(tc->rgb[idx]);
+        while (tc->hash[h])
+          h = (h + 1) % TRUECOLOR_HASH_SIZE;
+        tc->hash[h] = idx;
+     }
+   memcpy(tc->used, tc->marked, sizeof(tc->used));
+   tc->count -= freed;
+   tc->sweeping = 0;
+
+   /* sweeping goes through the whole backlog, do it less and less
+    * often while most colors are still in use */
+   if (freed < TRUECOLOR_MAX / 4)
+     {
+        tc->backoff_len = MIN(MAX(tc->backoff_len * 2, TRUECOLOR_MAX / 4),
+                              TRUECOLOR_BACKOFF_MAX);
+        tc->backoff = tc->backoff_len;
+     }
+   else
+     tc->backoff_len = 0;
+}
+
+/* The backlog was rearranged, go through it again */
+void
+termpty_truecolor_sweep_restart(Termpty *ty)
+{
+   if (!ty->truecolor.sweeping)
+     return;
+   ty->truecolor.sweep_y = 0;
+   _truecolor_sweep_screens(ty);
+}
+
+/* Returns the index of that color in the terminal's true colors, 0 if there
+ * is no room left for it */
+int
+termpty_truecolor_get(Termpty *ty, uint8_t r, uint8_t g, uint8_t b)
+{
+   Termpty_Truecolors *tc = &ty->truecolor;
+   uint32_t rgb = (r << 16) | (g << 8) | b;
+   unsigned int h, idx;
+
+   for (h = _truecolor_hash(rgb); tc->hash[h];
+        h = (h + 1) % TRUECOLOR_HASH_SIZE)
+     {
+        if (tc->rgb[tc->hash[h]] == rgb)
+          {
+             idx = tc->hash[h];
+             /* in use again, maybe from where the sweep is done with */
+             if (tc->sweeping)
+               tc->marked[idx / 8] |= 1 << (idx % 8);
+             return idx;
+          }
+     }
+
+   if (tc->count >= TRUECOLOR_MAX)
+     {
+        /* approximated until the next reads sweep the table */
+        if (tc->sweeping)
+          return 0;
+        if (tc->backoff > 0)
+          {
+             tc->backoff--;
+             return 0;
+          }
+        memset(tc->marked, 0, sizeof(tc->marked));
+        tc->sweeping = 1;
+        tc->sweep_y = 0;
+        _truecolor_sweep_screens(ty);
+        return 0;
+     }
+
+   for (idx = 1; idx <= TRUECOLOR_MAX; idx++)
+     {
+        if (!(tc->used[idx / 8] & (1 << (idx % 8))))
+          break;
+     }
+   tc->used[idx / 8] |= 1 << (idx % 8);
+   tc->dirty[idx / 8] |= 1 << (idx % 8);
+   tc->has_dirty = 1;
+   tc->rgb[idx] = rgb;
+   tc->hash[h] = idx;
+   tc->count++;
+   return idx;
+}
+
+static inline unsigned int
+_att_hash(const Termatt *att)
+{
+   const unsigned char *p = (const unsigned char *)att;
+   unsigned int h = 2166136261U, i;
+
+   for (i = 0; i < sizeof(Termatt); i++)
+     h = (h ^ p[i]) * 16777619U;
+   return h;
+}
+
+static void
+_atts_hash_add(Termpty_Atts *ta, uint32_t idx)
+{
+   unsigned int h;
+
+   for (h = _att_hash(&ta->atts[idx]) & ta->hash_mask; ta->hash[h];
+        h = (h + 1) & ta->hash_mask)
+     ;
+   ta->hash[h] = idx;
+}
+
+Eina_Bool
+termpty_atts_init(Termpty *ty)
+{
+   Termpty_Atts *ta = &ty->atts;
+
+   ta->size = 64;
+   ta->atts = calloc(ta->size, sizeof(Termatt));
+   ta->hash_mask = 2 * ta->size - 1;
+   ta->hash = calloc(ta->hash_mask + 1, sizeof(uint32_t));
+   ta->count = 1;
+   ta->last = 0;
+   ta->compact_at = TERMPTY_ATTS_COMPACT_MIN;
+   return (ta->atts) && (ta->hash);
+}
+
+void
+termpty_atts_shutdown(Termpty *ty)
+{
+   free(ty->atts.atts);
+   free(ty->atts.hash);
+   memset(&ty->atts, 0, sizeof(ty->atts));
+}
+
+/* Returns the index of @att in the terminal's attributes, the default one
+ * if there is no memory left for it */
+uint32_t
+termpty_att_intern(Termpty *ty, const Termatt *att)
+{
+   Termpty_Atts *ta = &ty->atts;
+   Termatt a = *att; /* @att may be in the table about to move */
+   unsigned int h;
+   uint32_t idx;
+
+   if (!memcmp(&a, &ta->atts[0], sizeof(Termatt)))
+     return ta->last = 0;
+   for (h = _att_hash(&a) & ta->hash_mask; ta->hash[h];
+        h = (h + 1) & ta->hash_mask)
+     {
+        if (!memcmp(&ta->atts[ta->hash[h]], &a, sizeof(Termatt)))
+          return ta->last = ta->hash[h];
+     }
+
+   if (ta->count == ta->size)
+     {
+        Termatt *atts = realloc(ta->atts, 2 * ta->size * sizeof(Termatt));
+
+        if (!atts)
+          {
+             ERR("Allocation of %u attributes failed", 2 * ta->size);
+             return 0;
+          }
+        ta->atts = atts;
+        ta->size *= 2;
+     }
+   if (2 * (ta->count + 1) > ta->hash_mask + 1)
+     {
+        uint32_t *hash = calloc(2 * (ta->hash_mask + 1), sizeof(uint32_t));
+
+        if (!hash)
+          {
+             ERR("Allocation of %u attributes failed", 2 * ta->size);
+             return 0;
+          }
+        free(ta->hash);
+        ta->hash = hash;
+        ta->hash_mask = 2 * ta->hash_mask + 1;
+        for (idx = 1; idx < ta->count; idx++)
+          _atts_hash_add(ta, idx);
+     }
+   idx = ta->count++;
+   ta->atts[idx] = a;
+   _atts_hash_add(ta, idx);
+   return ta->last = idx;
+}
+
+static void
+_atts_mark(uint32_t *remap, const Termcell *cells, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+     remap[cells[i].att_id] = 1;
+}
+
+static void
+_atts_remap(const uint32_t *remap, Termcell *cells, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+     cells[i].att_id = remap[cells[i].att_id];
+}
+
+/* Drop the attributes no cell uses anymore, renumbering the others. Only
+ * the screens and the backlog cache hold cells for longer than a read. */
+void
+termpty_atts_compact(Termpty *ty)
+{
+   Termpty_Atts *ta = &ty->atts;
+   Termsave_Cache *cache = &ty->backlog_cache;
+   size_t n = ty->w * ty->h;
+   uint32_t *remap, idx, count = 1;
+   unsigned int i;
+
+   remap = calloc(ta->count, sizeof(uint32_t));
+   if (!remap)
+     return;
+   _atts_mark(remap, ty->screen, n);
+   _atts_mark(remap, ty->screen2, n);
+   for (i = 0; i < BACKLOG_CACHE_SIZE; i++)
+     {
+        if (cache->lines[i].ts)
+          _atts_mark(remap, cache->lines[i].cells, cache->lines[i].ts->w);
+     }
+
+   memset(ta->hash, 0, (ta->hash_mask + 1) * sizeof(uint32_t));
+   remap[0] = 0;
+   for (idx = 1; idx < ta->count; idx++)
+     {
+        if (!remap[idx])
+          continue;
+        ta->atts[count] = ta->atts[idx];
+        remap[idx] = count;
+        _atts_hash_add(ta, count);
+        count++;
+     }
+   _atts_remap(remap, ty->screen, n);
+   _atts_remap(remap, ty->screen2, n);
+   for (i = 0; i < BACKLOG_CACHE_SIZE; i++)
+     {
+        if (cache->lines[i].ts)
+          _atts_remap(remap, cache->lines[i].cells, cache->lines[i].ts->w);
+     }
+   free(remap);
+
+   ta->count = count;
+   ta->last = 0;
+   ta->compact_at = MAX(2 * count, TERMPTY_ATTS_COMPACT_MIN);
+   ta->gen++;
+}
+
+#if defined(BINARY_TYTEST)
+int
+tytest_atts(void)
+{
+   Termpty ty;
+   Termcell cells[8];
+   Termatt att;
+   uint32_t a, b;
+   int i;
+
+   memset(&ty, 0, sizeof(ty));
+   memset(cells, 0, sizeof(cells));
+   assert(termpty_atts_init(&ty));
+   ty.w = 4;
+   ty.h = 1;
+   ty.screen = cells;
+   ty.screen2 = cells + 4;
+
+   /* the default attributes are at index 0, others are interned once */
+   memset(&att, 0, sizeof(att));
+   assert(termpty_att_id(&ty, &att) == 0);
+   att.bold = 1;
+   a = termpty_att_id(&ty, &att);
+   att.fg = 3;
+   b = termpty_att_id(&ty, &att);
+   assert(a && b && (a != b));
+   att.fg = 0;
+   assert(termpty_att_id(&ty, &att) == a);
+   for (i = 0; i < 1000; i++)
+     {
+        att.fg = i % 256;
+        att.bg = i / 256;
+        termpty_att_id(&ty, &att);
+     }
+   assert(ty.atts.count == 1001);
+
+   /* compacting keeps the attributes the cells use, renumbered */
+   cells[1].att_id = b;
+   cells[6].att_id = a;
+   termpty_atts_compact(&ty);
+   assert(ty.atts.count == 3);
+   assert(cells[0].att_id == 0);
+   assert(termpty_cell_att(&ty, &cells[1])->fg == 3);
+   assert(termpty_cell_att(&ty, &cells[1])->bold);
+   assert(termpty_cell_att(&ty, &cells[6])->fg == 0);
+   assert(termpty_cell_att(&ty, &cells[6])->bold);
+   att.fg = 3;
+   att.bg = 0;
+   assert(termpty_att_id(&ty, &att) == cells[1].att_id);
+
+   termpty_atts_shutdown(&ty);
+   return 0;
+}
+
+#define TEST_ASCII_W 40
+
+int
+tytest_ascii_run(void)
+{
+   Termpty ty;
+   Termcell cells[2 * 2 * TEST_ASCII_W];
+   Termcell *rows[2], *rows2[2];
+   Termrow info[2], info2[2];
+   const char *text = "0123456789abcdefghij";
+   Termatt att;
+   int i;
+
+   memset(&ty, 0, sizeof(ty));
+   memset(cells, 0, sizeof(cells));
+   memset(info, 0, sizeof(info));
+   memset(info2, 0, sizeof(info2));
+   assert(termpty_atts_init(&ty));
+   ty.w = TEST_ASCII_W;
+   ty.h = 2;
+   termpty_resize_tabs(&ty, 0, ty.w);
+   termpty_reset_state(&ty);
+   ty.screen = cells;
+   ty.screen2 = cells + 2 * TEST_ASCII_W;
+   ty.screen_rows = rows;
+   ty.screen2_rows = rows2;
+   ty.screen_info = info;
+   ty.screen2_info = info2;
+   termpty_screen_rows_set(rows, ty.screen, ty.w, ty.h);
+   termpty_screen_rows_set(rows2, ty.screen2, ty.w, ty.h);
+   ty.changes.gen = 1;
+   ty.fd = -1;
+
+   /* the text following an SGR goes straight to the screen, the SGR
+    * being split across reads or not */
+   termpty_handle_utf8(&ty, "\033[1", 3);
+   assert(ty.seq.state);
+   termpty_handle_utf8(&ty, "m0123456789abcdefghij", 21);
+   assert(!ty.seq.state);
+   assert(ty.stats.ascii == 20);
+   termpty_handle_utf8(&ty, "\033[31m0123456789abcdefghij", 25);
+   assert(ty.stats.ascii == 40);
+   for (i = 0; i < 20; i++)
+     {
+        assert(cells[i].codepoint == (Eina_Unicode)text[i]);
+        assert(termpty_cell_att(&ty, &cells[i])->bold);
+        assert(cells[20 + i].codepoint == (Eina_Unicode)text[i]);
+        assert(termpty_cell_att(&ty, &cells[20 + i])->bold);
+        assert(termpty_cell_att(&ty, &cells[20 + i])->fg == COL_RED);
+     }
+
+   /* reads of ASCII alone still compact the attributes */
+   memset(&att, 0, sizeof(att));
+   for (i = 0; i < 100; i++)
+     {
+        att.fg = i;
+        termpty_att_id(&ty, &att);
+     }
+   ty.atts.compact_at = ty.atts.count;
+   termpty_handle_utf8(&ty, text, 20);
+   assert(ty.stats.ascii == 60);
+   assert(ty.atts.count < 100);
+
+   free(ty.tabs);
+   free(ty.seq.buf);
+   termpty_atts_shutdown(&ty);
+   return 0;
+}
+#endif
@@ -6,12 +6,14 @@
 #include "sb.h"
 
 typedef struct _Termcell      Termcell;
+typedef struct _Termrow       Termrow;
 typedef struct _Termatt       Termatt;
 typedef struct _Termsave      Termsave;
 typedef struct _Termsavecomp  Termsavecomp;
 typedef struct _Termblock     Termblock;
 typedef struct _Termexp       Termexp;
 typedef struct _Termpty       Termpty;
+typedef struct _Termpty_Reader Termpty_Reader;
 typedef struct _Termlink      Term_Link;
 typedef struct _TitleIconElem TitleIconElem;
 
@@ -85,20 +87,17 @@ struct _Termatt
    unsigned short overlined : 1; // TODO: support it
    unsigned short tab_inserted : 1;
    unsigned short tab_last : 1;
+   unsigned short fgtrue : 1; // fg is an index in the terminal's true colors
+   unsigned short bgtrue : 1;
 #if defined(SUPPORT_80_132_COLUMNS)
    unsigned short is_80_132_mode_allowed : 1;
-   unsigned short bit_padding :  9;
+   unsigned short bit_padding :  7;
 #else
-   unsigned short bit_padding : 10;
+   unsigned short bit_padding : 8;
 #endif
    uint16_t       link_id;
 };
 
-typedef struct _Backlog_Beacon{
-    int screen_y;
-    int backlog_y;
-} Backlog_Beacon;
-
 typedef struct _Term_State {
     Termatt       att;
     unsigned char charset;
@@ -131,12 +130,141 @@ typedef struct _Term_Cursor {
     int cy;
 } Term_Cursor;
 
+/* True colors are interned per terminal and referenced by their index from
+ * the cells. They are rendered through the slots of the standard palette the
+ * color scheme leaves unused. Index 0 is never used. */
+#define TRUECOLOR_MAX 208
+#define TRUECOLOR_HASH_SIZE 512
+#define TRUECOLOR_PALETTE_SLOT(_idx) (47 + (_idx))
+#define TRUECOLOR_BACKOFF_MAX 8192
+#define TRUECOLOR_SWEEP_LINES 4096 /* backlog lines to sweep per read */
+
+typedef struct _Termpty_Truecolors {
+   uint32_t rgb[TRUECOLOR_MAX + 1]; /* 0xRRGGBB */
+   uint8_t hash[TRUECOLOR_HASH_SIZE]; /* indexes in rgb, 0 if empty */
+   uint8_t used[(TRUECOLOR_MAX + 8) / 8];
+   uint8_t dirty[(TRUECOLOR_MAX + 8) / 8]; /* not set in the palette yet */
+   unsigned int count;
+   unsigned int backoff; /* new colors to approximate before sweeping */
+   unsigned int backoff_len; /* doubles while sweeps free little */
+   uint8_t marked[(TRUECOLOR_MAX + 8) / 8]; /* found in use by the sweep */
+   size_t sweep_y; /* backlog line the sweep goes on from */
+   unsigned int has_dirty : 1;
+   unsigned int sweeping : 1;
+} Termpty_Truecolors;
+
+/* Attributes of the cells are interned per terminal and referenced by their
+ * index from the cells. Index 0 is the default, all zero, attribute. The
+ * table only grows between reads, when it is compacted, see
+ * termpty_atts_compact() */
+#define TERMPTY_ATTS_COMPACT_MIN 4096
+
+typedef struct _Termpty_Atts {
+   Termatt *atts; /* by index */
+   uint32_t *hash; /* indexes in atts, 0 if empty */
+   unsigned int count, size; /* used and allocated in atts */
+   unsigned int hash_mask;
+   unsigned int compact_at; /* count to compact the table at */
+   uint32_t last; /* index last looked up */
+   unsigned int gen; /* bumped when the indexes are renumbered */
+} Termpty_Atts;
+
+/* Lines scrolled by the terminal and not applied yet to the view and the
+ * selection, see termpty_scroll_flush() */
+typedef struct _Termpty_Scrolled {
+   int lines; /* < 0 when scrolled up, 0 if none */
+   int start_y, end_y; /* rows of the scrolled region */
+   int left_margin, right_margin; /* as they were then */
+} Termpty_Scrolled;
+
+/* A row of the selection as it was when checked last */
+typedef struct _Termpty_Sel_Row {
+   uint32_t hash; /* of the selected codepoints */
+   unsigned int gen; /* written to from that generation of changes on */
+} Termpty_Sel_Row;
+
+/* Backlog lines last decompressed, in order to read them again cheaply */
+#define BACKLOG_CACHE_SIZE 32
+
+typedef struct _Termsave_Cache {
+   struct {
+      const Termsave *ts;
+      Termcell *cells;
+      unsigned int size; /* allocated cells */
+   } lines[BACKLOG_CACHE_SIZE];
+   unsigned int next; /* entry to reuse next */
+   unsigned char *buf; /* to encode lines into */
+   size_t buf_size;
+} Termsave_Cache;
+
+/* Screen rows taken by the backlog lines, by slot in the ring, as a Fenwick
+ * tree to find the line shown on any row in O(log n). One is kept for each
+ * of the last widths used, counting lines from the newest one only as far
+ * as rows are looked up. Totals come from how many lines have each width. */
+#define BACKLOG_INDEX_WIDTHS 3
+#define BACKLOG_WIDTHS_PAGE 1024
+
+typedef struct _Termsave_Index {
+   unsigned int *tree; /* backsize + 1 entries, the first one unused */
+   size_t lines; /* newest lines counted in the tree, 0 for the others */
+   size_t rows; /* rows of the lines counted */
+   size_t total; /* rows of all the lines */
+   unsigned int used; /* when last looked up */
+   int w; /* width the rows are counted at, 0 if unused */
+} Termsave_Index;
+
+typedef struct _Termsave_Rows {
+   Termsave_Index index[BACKLOG_INDEX_WIDTHS];
+   /* lines of each width, BACKLOG_WIDTHS_PAGE widths per page, pages
+    * allocated while they count lines */
+   struct {
+      unsigned int *lines;
+      unsigned int count;
+   } *pages;
+   unsigned int nb_pages;
+   unsigned int clock;
+} Termsave_Rows;
+
+/* Backlog lines up to BACKLOG_SLAB_CLASSES * 16 bytes are blocks carved out
+ * of larger chunks, one size of blocks per chunk, so that the lines leaving
+ * the backlog make room for new ones without going through malloc() */
+#define BACKLOG_SLAB_CLASSES 64
+
+typedef struct _Termsave_Slab_Chunk Termsave_Slab_Chunk;
+typedef struct _Termsave_Disk Termsave_Disk;
+
+typedef struct _Termsave_Slab {
+   Termsave_Slab_Chunk *partial[BACKLOG_SLAB_CLASSES]; /* with free blocks */
+   Termsave_Slab_Chunk *empty; /* kept not to free and allocate it again */
+} Termsave_Slab;
+
+/* OSC numbers counted apart, others are counted together */
+#define TERMPTY_STATS_OSC_MAX 120
+
+/* Counters of what went through a terminal, see the "qc" query */
+typedef struct _Termpty_Stats {
+   uint64_t wakeups, reads, bytes, codepoints;
+   uint64_t ascii; /* codepoints that went straight to the screen */
+   uint64_t esc, dcs, terminology;
+   uint64_t csi[0x7f - 0x40]; /* by final byte */
+   uint64_t osc[TERMPTY_STATS_OSC_MAX + 1];
+   uint64_t scrolls, backlog_added, backlog_freed;
+   uint64_t backlog_compressed, backlog_inflated, backlog_evicted;
+   uint64_t backlog_blocks, backlog_mallocs; /* line allocations */
+   uint64_t backlog_disk, backlog_mapped; /* lines written, segments mapped */
+   uint64_t renders, cells_rendered, rows_skipped;
+   double render_time;
+   uint64_t decoding_errors;
+} Termpty_Stats;
+
 struct _Termpty
 {
    Evas_Object *obj;
    Config *config;
    Ecore_Event_Handler *hand_exe_exit;
    Ecore_Fd_Handler *hand_fd;
+   Termpty_Reader *reader;
+   double read_cost; /* seconds spent handling a byte read, averaged */
    struct {
       struct {
          void (*func) (void *data);
@@ -153,20 +281,42 @@ struct _Termpty
       const char *user_title;
    } prop;
    const char *cur_cmd;
-   Termcell *screen, *screen2;
+   Termcell *screen, *screen2; /* cells of the screens, rows in any order */
+   Termcell **screen_rows, **screen2_rows; /* rows of the screens, in order */
+   Termrow *screen_info, *screen2_info; /* by row in screen, not screen_rows */
    unsigned int *tabs;
-   int circular_offset;
-   int circular_offset2;
-   Eina_Unicode *buf;
-   size_t buflen;
+   /* generations of changes, for the renderer to only look at the rows
+    * changed since it last did, see Termrow */
+   struct {
+      unsigned int gen; /* bumped by each render */
+      unsigned int all; /* last time all the rows changed */
+      /* last time all the rows or the backlog got other cells, rather than
+       * only moved */
+      unsigned int rewritten;
+   } changes;
+   struct {
+      /* escape sequence not terminated yet, kept between reads */
+      Eina_Unicode *buf;
+      size_t len, size;
+      unsigned int payload;
+      unsigned char state;
+   } seq;
    Eina_Unicode last_char;
-   Eina_Bool buf_have_zero;
    unsigned char oldbuf[4];
    Termsave *back;
    size_t backsize, backpos;
-   /* this beacon in the backlog tells about the top line in screen
-    * coordinates that maps to a line in the backlog */
-   Backlog_Beacon backlog_beacon;
+   Termsave_Rows backlog_rows;
+   Termsave_Cache backlog_cache;
+   Termsave_Slab backlog_slab;
+   Termsave_Disk *backlog_disk; /* older lines, once written to a file */
+   /* to find whose lines to evict first when over the scrollback budget */
+   struct {
+      size_t lines; /* saved in the backlog */
+      double viewed, written; /* last times */
+      /* oldest slots known to hold no line in memory, and no line at all,
+       * for eviction not to go through them again */
+      size_t evicted, freed;
+   } backlog_use;
    int w, h;
    int fd, slavefd;
    struct ty_sb write_buffer;
@@ -184,7 +334,11 @@ struct _Termpty
       struct {
          int x, y;
       } start, end, orig;
-      Eina_Unicode *codepoints;
+      /* generation of changes it was made at, 0 while being made */
+      unsigned int gen;
+      /* to drop it once its rows show something else */
+      Termpty_Sel_Row *rows;
+      unsigned int nb_rows;
       time_t last_click;
       unsigned char is_box    : 1;
       unsigned char is_active : 1; // there is a visible selection
@@ -204,38 +358,54 @@ struct _Termpty
    unsigned int bracketed_paste : 1;
    unsigned int decoding_error : 1;
    unsigned int focus_reporting : 1;
+   unsigned int read_saturated : 1; /* last read stopped on its deadline */
    struct {
        Term_Link *links;
        uint8_t *bitmap;
        uint32_t size;
    } hl;
    TitleIconElem *title_icon_stack;
+   Termpty_Stats stats;
+   Termpty_Truecolors truecolor;
+   Termpty_Atts atts;
+   Termpty_Scrolled scrolled;
 };
 
 struct _Termcell
 {
    Eina_Unicode   codepoint;
-   Termatt        att;
+   uint32_t       att_id; /* index in the terminal's attributes, see atts */
+};
+
+/* What is known of a row of a screen, it follows the cells when rows move */
+struct _Termrow
+{
+   unsigned int   changed; /* generation of changes it last changed in */
+   unsigned int   written; /* same, not counting moves of the row */
+   int            len; /* line length, -1 when not known yet */
+   unsigned char  flags; /* TERMROW_*, what some cells may hold */
 };
 
+#define TERMROW_LINKS  (1 << 0) /* hyperlinks */
+#define TERMROW_BLOCKS (1 << 1) /* media blocks */
+
 struct _Termsave
 {
    unsigned int   gen  : 8;
    unsigned int   comp : 1;
-   unsigned int   z    : 1;
+   unsigned int   disk : 1;
    unsigned int   w    : 22;
-   /* TODO: union ? */
-   Termcell       *cells;
+   /* packed or compressed cells, or where they are on disk, see backlog.c */
+   void          *data;
 };
 
-/* TODO: RESIZE rewrite Termsavecomp */
+/* What data of a compressed Termsave points to: this header, the distinct
+ * attributes of the line then the encoded cells, see backlog.c */
 struct _Termsavecomp
 {
-   unsigned int   gen  : 8;
-   unsigned int   comp : 1;
-   unsigned int   z    : 1;
-   unsigned int   w    : 22; // compressed size in bytes
-   unsigned int   wout; // output width in Termcells
+   unsigned int   size; // compressed size in bytes, header included
+   unsigned short atts; // number of distinct attributes
+   unsigned short links : 1; // some cells are part of a hyperlink
 };
 
 struct _Termblock
@@ -304,10 +474,14 @@ void       termpty_cell_codepoint_att_fill(Termpty *ty, Eina_Unicode codepoint,
 void       termpty_cells_set_content(Termpty *ty, Termcell *cells,
                           Eina_Unicode codepoint, int count);
 void       termpty_screen_swap(Termpty *ty);
+void       termpty_screen_rows_set(Termcell **rows, Termcell *cells,
+                                   int w, int h);
 
-ssize_t termpty_line_length(const Termcell *cells, ssize_t nb_cells);
+ssize_t termpty_line_length(const Termpty *ty, const Termcell *cells,
+                            ssize_t nb_cells);
 
 void termpty_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len);
+void termpty_handle_utf8(Termpty *ty, const char *buf, int len);
 void termpty_handle_block_codepoint_overwrite_heavy(Termpty *ty, int oldc, int newc);
 
 Term_Link * term_link_new(Termpty *ty);
@@ -318,11 +492,21 @@ termpty_color_class_get(Termpty *ty, const char *key,
                         int *r, int *g, int *b, int *a);
 void
 termpty_focus_report(Termpty *ty, Eina_Bool focus);
+int
+termpty_truecolor_get(Termpty *ty, uint8_t r, uint8_t g, uint8_t b);
+void
+termpty_truecolor_sweep(Termpty *ty);
+void
+termpty_truecolor_sweep_restart(Termpty *ty);
+Eina_Bool termpty_atts_init(Termpty *ty);
+void termpty_atts_shutdown(Termpty *ty);
+uint32_t termpty_att_intern(Termpty *ty, const Termatt *att);
+void termpty_atts_compact(Termpty *ty);
 
 extern int _termpty_log_dom;
 
 #define TERMPTY_SCREEN(Tpty, X, Y) \
-  Tpty->screen[X + (((Y + Tpty->circular_offset) % Tpty->h) * Tpty->w)]
+  Tpty->screen_rows[Y][X]
 
 #define TERMPTY_RESTRICT_FIELD(Field, Min, Max) \
    do {                                         \
@@ -339,23 +523,27 @@ do {                                                                         \
        termpty_handle_block_codepoint_overwrite_heavy(Tpty, OLDC, NEWC);     \
 } while (0)
 
-#define TERMPTY_CELL_COPY(Tpty, Tsrc, Tdst, N)                               \
+#define TERMPTY_ROW_CHANGED(Tpty, Y)                                         \
+do {                                                                         \
+   Termrow *__row = termpty_screen_row_info(Tpty, Y);                        \
+                                                                             \
+   __row->changed = Tpty->changes.gen;                                       \
+   __row->written = Tpty->changes.gen;                                       \
+   __row->len = -1;                                                          \
+} while (0)
+
+/* Set one field of the attributes of a cell */
+#define TERMPTY_CELL_ATT_SET(Tpty, Cell, Field, Value)                       \
 do {                                                                         \
-   int __i;                                                                  \
+   Termatt __att = *termpty_cell_att(Tpty, Cell);                            \
                                                                              \
-   for (__i = 0; __i < N; __i++)                                             \
-     {                                                                       \
-        HANDLE_BLOCK_CODEPOINT_OVERWRITE(Tpty,                               \
-                                         (Tdst)[__i].codepoint,              \
-                                         (Tsrc)[__i].codepoint);             \
-        if (EINA_UNLIKELY((Tdst)[__i].att.link_id))                          \
-          term_link_refcount_dec(ty, (Tdst)[__i].att.link_id, 1);            \
-        if (EINA_UNLIKELY((Tsrc)[__i].att.link_id))                          \
-          term_link_refcount_inc(ty, (Tsrc)[__i].att.link_id, 1);            \
-     }                                                                       \
-   memcpy(Tdst, Tsrc, N * sizeof(Termcell));                                 \
+   __att.Field = Value;                                                      \
+   termpty_cell_att_set(Tpty, Cell, &__att);                                 \
 } while (0)
 
+#define TERMPTY_CELL_COPY(Tpty, Tsrc, Tdst, N) \
+   termpty_cells_copy(Tpty, Tsrc, Tdst, N)
+
 
 static inline void
 term_link_refcount_inc(Termpty *ty, uint16_t link_id, uint16_t count)
@@ -396,31 +584,227 @@ term_link_eq(Termpty *ty, Term_Link *hl, uint16_t link_id)
     return (strcmp(hl->url, hl2->url) == 0);
 }
 
+/* Where row @y of the terminal is stored in screen */
+static inline int
+termpty_screen_row_index(const Termpty *ty, int y)
+{
+   return (ty->screen_rows[y] - ty->screen) / ty->w;
+}
+
+static inline Termrow *
+termpty_screen_row_info(Termpty *ty, int y)
+{
+   return &ty->screen_info[termpty_screen_row_index(ty, y)];
+}
+
+static inline Eina_Bool
+termpty_cells_on_screen(const Termpty *ty, const Termcell *cells)
+{
+   return ((ty->screen_info) && (cells >= ty->screen) &&
+           (cells < ty->screen + ty->w * ty->h));
+}
+
+/* The pointer is only valid until attributes get interned again */
+static inline const Termatt *
+termpty_cell_att(const Termpty *ty, const Termcell *cell)
+{
+   return &ty->atts.atts[cell->att_id];
+}
+
+/* Index of @att in the terminal's attributes, added if needed */
+static inline uint32_t
+termpty_att_id(Termpty *ty, const Termatt *att)
+{
+   if (!memcmp(att, &ty->atts.atts[ty->atts.last], sizeof(Termatt)))
+     return ty->atts.last;
+   return termpty_att_intern(ty, att);
+}
+
+static inline void
+termpty_cell_att_set(Termpty *ty, Termcell *cell, const Termatt *att)
+{
+   cell->att_id = termpty_att_id(ty, att);
+}
+
+static inline uint16_t
+termpty_cell_link_id(const Termpty *ty, const Termcell *cell)
+{
+   if (EINA_LIKELY(!cell->att_id))
+     return 0;
+   return ty->atts.atts[cell->att_id].link_id;
+}
+
+static inline unsigned char
+termpty_cell_flags(const Termpty *ty, const Termcell *cell)
+{
+   return ((termpty_cell_link_id(ty, cell)) ? TERMROW_LINKS : 0) |
+      ((cell->codepoint & 0x80000000) ? TERMROW_BLOCKS : 0);
+}
+
+/* TERMROW_* flags of the rows @cells are on, all of them when not known */
+static inline unsigned char
+termpty_cells_flags_get(const Termpty *ty, const Termcell *cells, int n)
+{
+   unsigned char flags = 0;
+   int y;
+
+   if (!termpty_cells_on_screen(ty, cells))
+     return TERMROW_LINKS | TERMROW_BLOCKS;
+   for (y = (cells - ty->screen) / ty->w;
+        (y < ty->h) && (ty->screen + y * ty->w < cells + n);
+        y++)
+     flags |= ty->screen_info[y].flags;
+   return flags;
+}
+
+/* @n cells got written at @cells, holding what @flags say */
+static inline void
+termpty_cells_set(Termpty *ty, const Termcell *cells, int n,
+                  unsigned char flags)
+{
+   int y;
+
+   if ((n <= 0) || (!termpty_cells_on_screen(ty, cells)))
+     return;
+   for (y = (cells - ty->screen) / ty->w;
+        (y < ty->h) && (ty->screen + y * ty->w < cells + n);
+        y++)
+     {
+        Termrow *row = &ty->screen_info[y];
+        const Termcell *start = ty->screen + y * ty->w;
+
+        row->changed = ty->changes.gen;
+        row->written = ty->changes.gen;
+        row->len = -1;
+        if ((start >= cells) && (start + ty->w <= cells + n))
+          row->flags = flags;
+        else
+          row->flags |= flags;
+     }
+}
+
+/* Rows of the screen @cells are on changed, and hold no more links or
+ * blocks than before */
+static inline void
+termpty_cells_changed(Termpty *ty, const Termcell *cells, int n)
+{
+   int y;
+
+   if ((n <= 0) || (!termpty_cells_on_screen(ty, cells)))
+     return;
+   for (y = (cells - ty->screen) / ty->w;
+        (y < ty->h) && (ty->screen + y * ty->w < cells + n);
+        y++)
+     {
+        ty->screen_info[y].changed = ty->changes.gen;
+        ty->screen_info[y].written = ty->changes.gen;
+        ty->screen_info[y].len = -1;
+     }
+}
+
+/* Every row changed, or moved on the terminal */
+static inline void
+termpty_screen_changed(Termpty *ty)
+{
+   ty->changes.all = ty->changes.gen;
+}
+
+/* Every row or the backlog got other cells */
+static inline void
+termpty_screen_rewritten(Termpty *ty)
+{
+   ty->changes.all = ty->changes.gen;
+   ty->changes.rewritten = ty->changes.gen;
+}
+
+/* Start a new generation of changes, returns the first one after it */
+static inline unsigned int
+termpty_changes_next(Termpty *ty)
+{
+   if (EINA_UNLIKELY(++ty->changes.gen == 0))
+     {
+        int y;
+
+        /* wrapped around: everything looks changed once */
+        for (y = 0; y < ty->h; y++)
+          {
+             ty->screen_info[y].changed = 0;
+             ty->screen_info[y].written = 0;
+             ty->screen2_info[y].changed = 0;
+             ty->screen2_info[y].written = 0;
+          }
+        ty->changes.all = 0;
+        ty->changes.rewritten = 0;
+        ty->changes.gen = 1;
+        return 0;
+     }
+   return ty->changes.gen;
+}
+
+static inline void
+termpty_cells_copy(Termpty *ty, const Termcell *src, Termcell *dst, int n)
+{
+   unsigned char flags = termpty_cells_flags_get(ty, src, n) |
+      termpty_cells_flags_get(ty, dst, n);
+   int i;
+
+   if (EINA_UNLIKELY(flags))
+     {
+        flags = 0;
+        for (i = 0; i < n; i++)
+          {
+             HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint,
+                                              src[i].codepoint);
+             if (EINA_UNLIKELY(termpty_cell_link_id(ty, &dst[i])))
+               term_link_refcount_dec(ty, termpty_cell_link_id(ty, &dst[i]), 1);
+             if (EINA_UNLIKELY(termpty_cell_link_id(ty, &src[i])))
+               term_link_refcount_inc(ty, termpty_cell_link_id(ty, &src[i]), 1);
+             flags |= termpty_cell_flags(ty, &src[i]);
+          }
+     }
+   termpty_cells_set(ty, dst, n, flags);
+   memcpy(dst, src, n * sizeof(Termcell));
+}
+
 static inline void
 termpty_cell_fill(Termpty *ty, Termcell *src, Termcell *dst, int n)
 {
    int i;
 
+   if ((!termpty_cells_flags_get(ty, dst, n)) &&
+       ((!src) || (!termpty_cell_flags(ty, src))))
+     {
+        /* nothing to unreference nor reference */
+        termpty_cells_set(ty, dst, n, 0);
+        if (!src)
+          memset(dst, 0, n * sizeof(Termcell));
+        else
+          for (i = 0; i < n; i++)
+            dst[i] = src[0];
+        return;
+     }
+   termpty_cells_set(ty, dst, n, (src) ? termpty_cell_flags(ty, src) : 0);
+
    if (src)
      {
         for (i = 0; i < n; i++)
           {
              HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint, src[0].codepoint);
-             if (EINA_UNLIKELY(dst[i].att.link_id))
-               term_link_refcount_dec(ty, dst[i].att.link_id, 1);
+             if (EINA_UNLIKELY(termpty_cell_link_id(ty, &dst[i])))
+               term_link_refcount_dec(ty, termpty_cell_link_id(ty, &dst[i]), 1);
 
              dst[i] = src[0];
           }
-        if (src[0].att.link_id)
-          term_link_refcount_inc(ty, src[0].att.link_id, n);
+        if (termpty_cell_link_id(ty, &src[0]))
+          term_link_refcount_inc(ty, termpty_cell_link_id(ty, &src[0]), n);
      }
    else
      {
         for (i = 0; i < n; i++)
           {
              HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint, 0);
-             if (EINA_UNLIKELY(dst[i].att.link_id))
-               term_link_refcount_dec(ty, dst[i].att.link_id, 1);
+             if (EINA_UNLIKELY(termpty_cell_link_id(ty, &dst[i])))
+               term_link_refcount_dec(ty, termpty_cell_link_id(ty, &dst[i]), 1);
 
              memset(&(dst[i]), 0, sizeof(*dst));
           }
@@ -2,19 +2,47 @@
 #ifndef _TERMPTY_DBL_H__
 #define _TERMPTY_DBL_H__ 1
 
-Eina_Bool _termpty_is_wide(const Eina_Unicode g);
-Eina_Bool _termpty_is_ambigous_wide(const Eina_Unicode g);
+#define TERMPTY_UNICODE_WIDE 0x01 /* East Asian Wide or Fullwidth */
+#define TERMPTY_UNICODE_AMBIGUOUS 0x02 /* East Asian Ambiguous */
+#define TERMPTY_UNICODE_EMOJI 0x04 /* Emoji presentation by default */
+#define TERMPTY_UNICODE_COMBINING 0x08 /* Combining diacritical mark */
+#define TERMPTY_UNICODE_ZERO_WIDTH 0x10 /* Zero width space, direction mark or variation selector */
 
-static inline Eina_Bool
-_termpty_is_dblwidth_get(const Termpty *ty, const Eina_Unicode g)
+#define TERMPTY_UNICODE_BLOCK_SHIFT 8
+#define TERMPTY_UNICODE_BLOCKS 3586
+
+extern const uint8_t _termpty_unicode_index[TERMPTY_UNICODE_BLOCKS];
+extern const uint8_t _termpty_unicode_blocks[][1 << TERMPTY_UNICODE_BLOCK_SHIFT];
+
+static inline unsigned int
+_termpty_unicode_flags_get(const Eina_Unicode g)
 {
-   /* optimize for latin1 non-ambiguous */
+   /* optimize for latin1 */
    if (g <= 0xA0)
+     return 0;
+   if (g >= (TERMPTY_UNICODE_BLOCKS << TERMPTY_UNICODE_BLOCK_SHIFT))
+     return 0;
+   return _termpty_unicode_blocks
+      [_termpty_unicode_index[g >> TERMPTY_UNICODE_BLOCK_SHIFT]]
+      [g & ((1 << TERMPTY_UNICODE_BLOCK_SHIFT) - 1)];
+}
+
+static inline Eina_Bool
+_termpty_is_dblwidth_flags(const Termpty *ty, unsigned int flags)
+{
+   if ((flags & TERMPTY_UNICODE_EMOJI) &&
+       (ty->config) && (!ty->config->emoji_dbl_width))
      return EINA_FALSE;
    if (!ty->termstate.cjk_ambiguous_wide)
-     return _termpty_is_wide(g);
+     return !!(flags & TERMPTY_UNICODE_WIDE);
    else
-     return _termpty_is_ambigous_wide(g);
+     return !!(flags & (TERMPTY_UNICODE_WIDE | TERMPTY_UNICODE_AMBIGUOUS));
+}
+
+static inline Eina_Bool
+_termpty_is_dblwidth_get(const Termpty *ty, const Eina_Unicode g)
+{
+   return _termpty_is_dblwidth_flags(ty, _termpty_unicode_flags_get(g));
 }
 
 #endif
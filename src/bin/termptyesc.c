@@ -33,6 +33,9 @@
 #define OSC 0x9d
 #define DEL 0x7f
 
+/* size of the buffers csi, osc and dcs arguments are copied into */
+#define SEQ_ARGS_MAX 4096
+
 
 /* XXX: all handle_ functions return the number of bytes successfully read, 0
  * if not enough bytes could be read
@@ -222,10 +225,10 @@ _handle_cursor_control(Termpty *ty, const Eina_Unicode *cc)
       case 0x09: // HT  '\t' (horizontal tab)
          DBG("->HT");
          cell = &(TERMPTY_SCREEN(ty, ty->cursor_state.cx, ty->cursor_state.cy));
-         cell->att.tab_inserted = 1;
+         TERMPTY_CELL_ATT_SET(ty, cell, tab_inserted, 1);
          _tab_forward(ty, 1);
          cell = &(TERMPTY_SCREEN(ty, ty->cursor_state.cx -1, ty->cursor_state.cy));
-         cell->att.tab_last = 1;
+         TERMPTY_CELL_ATT_SET(ty, cell, tab_last, 1);
          return;
       case 0x0a: // LF  '\n' (new line)
       case 0x0b: // VT  '\v' (vertical tab)
@@ -661,140 +664,25 @@ _csi_truecolor_arg_get(Termpty *ty, Eina_Unicode **ptr)
    return sum;
 }
 
-#if !defined(BINARY_TYFUZZ)
-/*********************************
- * cache true color approximations
- *********************************
- * Approximating true colors is costly since it needs to compare 256 colors.
- * The following considers that a few colors are used a lot.  For example, one
- * can consider that a text editor with syntax highlighting would only use a
- * small palette.
- * Given that, using the cache needs to be efficient: it needs to speed up the
- * approximation when the color is already in the cache but not knowing the
- * color requested is not in the cache needs to be efficient too.
- *
- * The cache is an array of @TCC_LEN uint32_t.
- * Each entry has on the MSB the color as 3 uint8_t (R,G,B) and the LSB is
- * the approximated color.
- * Searching a color is simply going through the array and testing the mask on
- * the 3 most significant bytes.
- * When a color is found, it is bubbled up towards the start of the array by
- * swapping this entry with the one above.  This way the array is ordered to
- * get most used colors as fast as possible.
- * When a color is not found, the slow process of comparing it with the 256
- * colors is used.  Then the result is inserted in the lower half of the
- * array.  This ensures that new entries can live a bit and not be removed by
- * the next new color.  Using a modulo with a prime number makes for a
- * nice-enough random generator to figure out where to insert.
- */
-#define TCC_LEN 32
-#define TCC_PRIME 17 /* smallest prime number larger than @TCC_LEN/2 */
-static struct {
-     uint32_t colors[TCC_LEN];
-} _truecolor_cache;
-static int _tcc_random_pos = 0;
-
-static Eina_Bool
-_tcc_find(const uint32_t color_msb, uint8_t *chosen_color)
-{
-   int i;
-   for (i = 0; i < TCC_LEN; i++)
-     {
-        if ((_truecolor_cache.colors[i] & 0xffffff00) == color_msb)
-          {
-             *chosen_color = _truecolor_cache.colors[i] & 0xff;
-             /* bubble up this result */
-             if (i > 0)
-               {
-                  uint32_t prev = _truecolor_cache.colors[i - 1];
-                  _truecolor_cache.colors[i - 1] = _truecolor_cache.colors[i];
-                  _truecolor_cache.colors[i] = prev;
-               }
-             return EINA_TRUE;
-          }
-     }
-   return EINA_FALSE;
-}
-
-static void
-_tcc_insert(const uint32_t color_msb, const uint8_t approximated)
-{
-   uint32_t c = color_msb | approximated;
-   int i;
-
-   _tcc_random_pos = ((_tcc_random_pos + TCC_PRIME) % (TCC_LEN / 2));
-   i = (TCC_LEN / 2) + _tcc_random_pos;
-
-  _truecolor_cache.colors[i] = c;
-}
-#endif
-
 static uint8_t
 _approximate_truecolor_rgb(Termpty *ty, uint8_t r0, uint8_t g0, uint8_t b0)
 {
-   uint8_t chosen_color = COL_DEF;
 #if defined(BINARY_TYFUZZ)
    (void) ty;
    (void) r0;
    (void) g0;
    (void) b0;
+   return COL_DEF;
 #else
-   int c;
-   int distance_min = INT_MAX;
-   Evas_Object *textgrid;
-   const uint32_t color_msb = 0
-      | (((uint32_t)r0) << 24)
-      | (((uint32_t)g0) << 16)
-      | (((uint32_t)b0) << 8);
-
-   if (_tcc_find(color_msb, &chosen_color))
-     return chosen_color;
-
-   textgrid = termio_textgrid_get(ty->obj);
-   for (c = 0; c < 256; c++)
-     {
-        int r1 = 0, g1 = 0, b1 = 0, a1 = 0;
-        int delta_red_sq, delta_green_sq, delta_blue_sq, red_mean;
-        int distance;
-
-        evas_object_textgrid_palette_get(textgrid,
-                                         EVAS_TEXTGRID_PALETTE_EXTENDED,
-                                         c, &r1, &g1, &b1, &a1);
-        /* Compute the color distance
-         * XXX: this is inacurate but should give good enough results.
-         * See https://en.wikipedia.org/wiki/Color_difference
-         */
-        red_mean = (r0 + r1) / 2;
-        delta_red_sq = (r0 - r1) * (r0 - r1);
-        delta_green_sq = (g0 - g1) * (g0 - g1);
-        delta_blue_sq = (b0 - b1) * (b0 - b1);
-
-#if 1
-        distance = 2 * delta_red_sq
-           + 4 * delta_green_sq
-           + 3 * delta_blue_sq
-           + ((red_mean) * (delta_red_sq - delta_blue_sq) / 256);
-#else
-        /* from https://www.compuphase.com/cmetric.htm */
-        distance = (((512 + red_mean) * delta_red_sq) >> 8)
-                 + 4 * delta_green_sq
-                 + (((767 - red_mean) * delta_blue_sq) >> 8);
-        /* euclidian distance */
-        distance = delta_red_sq + delta_green_sq + delta_blue_sq;
-        (void)red_mean;
-#endif
-        if (distance < distance_min)
-          {
-             distance_min = distance;
-             chosen_color = c;
-          }
-     }
-   _tcc_insert(color_msb, chosen_color);
+   const Color_Cube *cube = colors_term_cube_get(termio_textgrid_get(ty->obj));
+
+   if (EINA_UNLIKELY(!cube))
+     return COL_DEF;
+   return colors_cube_nearest(cube, r0, g0, b0);
 #endif
-   return chosen_color;
 }
 
-static uint8_t
+static int
 _handle_esc_csi_truecolor_rgb(Termpty *ty, Eina_Unicode **ptr)
 {
    int r, g, b;
@@ -803,7 +691,7 @@ _handle_esc_csi_truecolor_rgb(Termpty *ty, Eina_Unicode **ptr)
 
    if ((u == NULL) || (*u == '\0'))
      {
-        return COL_DEF;
+        return -1;
      }
    separator = *(u-1);
 
@@ -813,7 +701,7 @@ _handle_esc_csi_truecolor_rgb(Termpty *ty, Eina_Unicode **ptr)
    if ((r == -ESC_ARG_ERROR) ||
        (g == -ESC_ARG_ERROR) ||
        (b == -ESC_ARG_ERROR))
-     return COL_DEF;
+     return -1;
 
    if (separator == ':' && *ptr)
      {
@@ -844,10 +732,10 @@ _handle_esc_csi_truecolor_rgb(Termpty *ty, Eina_Unicode **ptr)
    if (b == -ESC_ARG_NO_VALUE)
      b = 0;
 
-   return _approximate_truecolor_rgb(ty, (uint8_t)r, (uint8_t)g, (uint8_t)b);
+   return (((uint8_t)r) << 16) | (((uint8_t)g) << 8) | ((uint8_t)b);
 }
 
-static uint8_t
+static int
 _handle_esc_csi_truecolor_cmy(Termpty *ty, Eina_Unicode **ptr)
 {
    int r, g, b, c, m, y;
@@ -856,7 +744,7 @@ _handle_esc_csi_truecolor_cmy(Termpty *ty, Eina_Unicode **ptr)
 
    if ((u == NULL) || (*u == '\0'))
      {
-        return COL_DEF;
+        return -1;
      }
    separator = *(u-1);
 
@@ -868,7 +756,7 @@ _handle_esc_csi_truecolor_cmy(Termpty *ty, Eina_Unicode **ptr)
    if ((c == -ESC_ARG_ERROR) ||
        (m == -ESC_ARG_ERROR) ||
        (y == -ESC_ARG_ERROR))
-     return COL_DEF;
+     return -1;
 
    if (separator == ':' && *ptr)
      {
@@ -903,10 +791,10 @@ _handle_esc_csi_truecolor_cmy(Termpty *ty, Eina_Unicode **ptr)
    g = 255 - ((m * 255) / 100);
    b = 255 - ((y * 255) / 100);
 
-   return _approximate_truecolor_rgb(ty, (uint8_t)r, (uint8_t)g, (uint8_t)b);
+   return (((uint8_t)r) << 16) | (((uint8_t)g) << 8) | ((uint8_t)b);
 }
 
-static uint8_t
+static int
 _handle_esc_csi_truecolor_cmyk(Termpty *ty, Eina_Unicode **ptr)
 {
    int r, g, b, c, m, y, k;
@@ -915,7 +803,7 @@ _handle_esc_csi_truecolor_cmyk(Termpty *ty, Eina_Unicode **ptr)
 
    if ((u == NULL) || (*u == '\0'))
      {
-        return COL_DEF;
+        return -1;
      }
    separator = *(u-1);
 
@@ -929,7 +817,7 @@ _handle_esc_csi_truecolor_cmyk(Termpty *ty, Eina_Unicode **ptr)
        (m == -ESC_ARG_ERROR) ||
        (y == -ESC_ARG_ERROR) ||
        (k == -ESC_ARG_ERROR))
-     return COL_DEF;
+     return -1;
 
    if (separator == ':' && *ptr)
      {
@@ -967,7 +855,41 @@ _handle_esc_csi_truecolor_cmyk(Termpty *ty, Eina_Unicode **ptr)
    g = (255 * (100 - m) * (100 - k)) / 100 / 100;
    b = (255 * (100 - y) * (100 - k)) / 100 / 100;
 
-   return _approximate_truecolor_rgb(ty, (uint8_t)r, (uint8_t)g, (uint8_t)b);
+   return (((uint8_t)r) << 16) | (((uint8_t)g) << 8) | ((uint8_t)b);
+}
+
+/* Keep the color as is if there is room for it, approximate it otherwise */
+static void
+_handle_esc_csi_truecolor_set(Termpty *ty, Eina_Bool is_fg, int rgb)
+{
+   Termatt *att = &ty->termstate.att;
+   uint8_t color = COL_DEF;
+   int idx = 0;
+
+   if (rgb >= 0)
+     {
+        uint8_t r = rgb >> 16, g = rgb >> 8, b = rgb;
+
+        idx = termpty_truecolor_get(ty, r, g, b);
+        if (idx)
+          color = idx;
+        else
+          color = _approximate_truecolor_rgb(ty, r, g, b);
+     }
+   DBG("truecolor %s: %06x got %s %d", is_fg ? "fg" : "bg", rgb,
+       idx ? "true color" : "color", color);
+   if (is_fg)
+     {
+        att->fg = color;
+        att->fg256 = !idx;
+        att->fgtrue = !!idx;
+     }
+   else
+     {
+        att->bg = color;
+        att->bg256 = !idx;
+        att->bgtrue = !!idx;
+     }
 }
 
 static void
@@ -1061,6 +983,7 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
            case 36:
            case 37:
               ty->termstate.att.fg256 = 0;
+              ty->termstate.att.fgtrue = 0;
               ty->termstate.att.fg = (arg - 30) + COL_BLACK;
               ty->termstate.att.fgintense = 0;
               break;
@@ -1073,28 +996,20 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
                    /* TODO: -ESC_ARG_NO_VALUE */
                  case 1:
                     ty->termstate.att.fg256 = 0;
+                    ty->termstate.att.fgtrue = 0;
                     ty->termstate.att.fg = COL_INVIS;
                     break;
                  case 2:
-                    ty->termstate.att.fg256 = 1;
-                    ty->termstate.att.fg =
-                       _handle_esc_csi_truecolor_rgb(ty, &b);
-                    DBG("truecolor RGB fg: approximation got color %d",
-                        ty->termstate.att.fg);
+                    _handle_esc_csi_truecolor_set(ty, EINA_TRUE,
+                       _handle_esc_csi_truecolor_rgb(ty, &b));
                     break;
                  case 3:
-                    ty->termstate.att.fg256 = 1;
-                    ty->termstate.att.fg =
-                       _handle_esc_csi_truecolor_cmy(ty, &b);
-                    DBG("truecolor CMY fg: approximation got color %d",
-                        ty->termstate.att.fg);
+                    _handle_esc_csi_truecolor_set(ty, EINA_TRUE,
+                       _handle_esc_csi_truecolor_cmy(ty, &b));
                     break;
                  case 4:
-                    ty->termstate.att.fg256 = 1;
-                    ty->termstate.att.fg =
-                       _handle_esc_csi_truecolor_cmyk(ty, &b);
-                    DBG("truecolor CMYK fg: approximation got color %d",
-                        ty->termstate.att.fg);
+                    _handle_esc_csi_truecolor_set(ty, EINA_TRUE,
+                       _handle_esc_csi_truecolor_cmyk(ty, &b));
                     break;
                  case 5:
                     // then get next arg - should be color index 0-255
@@ -1109,6 +1024,7 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
                          if (arg == -ESC_ARG_NO_VALUE)
                            arg = 0;
                          ty->termstate.att.fg256 = 1;
+                         ty->termstate.att.fgtrue = 0;
                          ty->termstate.att.fg = arg;
                       }
                     break;
@@ -1120,6 +1036,7 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
               break;
            case 39: // default fg color
               ty->termstate.att.fg256 = 0;
+              ty->termstate.att.fgtrue = 0;
               ty->termstate.att.fg = COL_DEF;
               ty->termstate.att.fgintense = 0;
               break;
@@ -1132,6 +1049,7 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
            case 46:
            case 47:
               ty->termstate.att.bg256 = 0;
+              ty->termstate.att.bgtrue = 0;
               ty->termstate.att.bg = (arg - 40) + COL_BLACK;
               ty->termstate.att.bgintense = 0;
               break;
@@ -1144,28 +1062,20 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
                    /* TODO: -ESC_ARG_NO_VALUE */
                  case 1:
                     ty->termstate.att.bg256 = 0;
+                    ty->termstate.att.bgtrue = 0;
                     ty->termstate.att.bg = COL_INVIS;
                     break;
                  case 2:
-                    ty->termstate.att.bg256 = 1;
-                    ty->termstate.att.bg =
-                       _handle_esc_csi_truecolor_rgb(ty, &b);
-                    DBG("truecolor RGB bg: approximation got color %d",
-                        ty->termstate.att.bg);
+                    _handle_esc_csi_truecolor_set(ty, EINA_FALSE,
+                       _handle_esc_csi_truecolor_rgb(ty, &b));
                     break;
                  case 3:
-                    ty->termstate.att.bg256 = 1;
-                    ty->termstate.att.bg =
-                       _handle_esc_csi_truecolor_cmy(ty, &b);
-                    DBG("truecolor CMY bg: approximation got color %d",
-                        ty->termstate.att.bg);
+                    _handle_esc_csi_truecolor_set(ty, EINA_FALSE,
+                       _handle_esc_csi_truecolor_cmy(ty, &b));
                     break;
                  case 4:
-                    ty->termstate.att.bg256 = 1;
-                    ty->termstate.att.bg =
-                       _handle_esc_csi_truecolor_cmyk(ty, &b);
-                    DBG("truecolor CMYK bg: approximation got color %d",
-                        ty->termstate.att.bg);
+                    _handle_esc_csi_truecolor_set(ty, EINA_FALSE,
+                       _handle_esc_csi_truecolor_cmyk(ty, &b));
                     break;
                  case 5:
                     // then get next arg - should be color index 0-255
@@ -1180,6 +1090,7 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
                          if (arg == -ESC_ARG_NO_VALUE)
                            arg = 0;
                          ty->termstate.att.bg256 = 1;
+                         ty->termstate.att.bgtrue = 0;
                          ty->termstate.att.bg = arg;
                       }
                     break;
@@ -1191,6 +1102,7 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
               break;
            case 49: // default bg color
               ty->termstate.att.bg256 = 0;
+              ty->termstate.att.bgtrue = 0;
               ty->termstate.att.bg = COL_DEF;
               ty->termstate.att.bgintense = 0;
               break;
@@ -1221,11 +1133,13 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
            case 96:
            case 97:
               ty->termstate.att.fg256 = 0;
+              ty->termstate.att.fgtrue = 0;
               ty->termstate.att.fg = (arg - 90) + COL_BLACK;
               ty->termstate.att.fgintense = 1;
               break;
            case 99: // default fg color
               ty->termstate.att.fg256 = 0;
+              ty->termstate.att.fgtrue = 0;
               ty->termstate.att.fg = COL_DEF;
               ty->termstate.att.fgintense = 1;
               break;
@@ -1238,11 +1152,13 @@ _handle_esc_csi_color_set(Termpty *ty, Eina_Unicode **ptr,
            case 106:
            case 107:
               ty->termstate.att.bg256 = 0;
+              ty->termstate.att.bgtrue = 0;
               ty->termstate.att.bg = (arg - 100) + COL_BLACK;
               ty->termstate.att.bgintense = 1;
               break;
            case 109: // default bg color
               ty->termstate.att.bg256 = 0;
+              ty->termstate.att.bgtrue = 0;
               ty->termstate.att.bg = COL_DEF;
               ty->termstate.att.bgintense = 1;
               break;
@@ -1304,6 +1220,17 @@ _handle_esc_csi_cpl(Termpty *ty, Eina_Unicode **ptr)
    ty->cursor_state.cx = ty->termstate.left_margin;
 }
 
+/* Attributes of the blanks left by deleted characters */
+static uint32_t
+_blank_att_id(Termpty *ty)
+{
+   Termatt att = ty->termstate.att;
+
+   att.link_id = 0;
+   att.dblwidth = 0;
+   return termpty_att_id(ty, &att);
+}
+
 static void
 _handle_esc_csi_dch(Termpty *ty, Eina_Unicode **ptr)
 {
@@ -1318,6 +1245,7 @@ _handle_esc_csi_dch(Termpty *ty, Eina_Unicode **ptr)
    DBG("DCH - Delete Character: %d chars", arg);
 
    cells = &(TERMPTY_SCREEN(ty, 0, ty->cursor_state.cy));
+   TERMPTY_ROW_CHANGED(ty, ty->cursor_state.cy);
    max = ty->w;
    if (ty->termstate.left_margin)
      {
@@ -1339,11 +1267,10 @@ _handle_esc_csi_dch(Termpty *ty, Eina_Unicode **ptr)
         else
           {
              cells[x].codepoint = ' ';
-             if (EINA_UNLIKELY(cells[x].att.link_id))
-               term_link_refcount_dec(ty, cells[x].att.link_id, 1);
-             cells[x].att = ty->termstate.att;
-             cells[x].att.link_id = 0;
-             cells[x].att.dblwidth = 0;
+             if (EINA_UNLIKELY(termpty_cell_link_id(ty, &cells[x])))
+               term_link_refcount_dec(ty, termpty_cell_link_id(ty, &cells[x]),
+                                      1);
+             cells[x].att_id = _blank_att_id(ty);
           }
      }
 }
@@ -1626,7 +1553,7 @@ _clean_up_rect_coordinates(Termpty *ty,
           bottom = ty->termstate.bottom_margin;
      }
    bottom--;
-   if (bottom > ty->h)
+   if (bottom >= ty->h)
      bottom = ty->h - 1;
 
    if ((bottom < top) || (right < left))
@@ -1692,7 +1619,7 @@ _clean_up_from_to_coordinates(Termpty *ty,
           bottom = ty->termstate.bottom_margin;
      }
    bottom--;
-   if (bottom > ty->h)
+   if (bottom >= ty->h)
      bottom = ty->h - 1;
 
    if ((bottom == top) && (right < left))
@@ -1751,7 +1678,7 @@ _handle_esc_csi_decfra(Termpty *ty, Eina_Unicode **b)
 }
 
 static void
-_deccara(Termcell *cells, int len,
+_deccara(Termpty *ty, Termcell *cells, int len,
          Eina_Bool set_bold, Eina_Bool reset_bold,
          Eina_Bool set_underline, Eina_Bool reset_underline,
          Eina_Bool set_blink, Eina_Bool reset_blink,
@@ -1759,25 +1686,29 @@ _deccara(Termcell *cells, int len,
 {
    int i;
 
+   termpty_cells_changed(ty, cells, len);
+
    for (i = 0; i < len; i++)
      {
-        Termatt * att = &cells[i].att;
+        Termatt att = *termpty_cell_att(ty, &cells[i]);
+
         if (set_bold)
-          att->bold = 1;
+          att.bold = 1;
         if (set_underline)
-          att->underline = 1;
+          att.underline = 1;
         if (set_blink)
-          att->blink = 1;
+          att.blink = 1;
         if (set_inverse)
-          att->inverse = 1;
+          att.inverse = 1;
         if (reset_bold)
-          att->bold = 0;
+          att.bold = 0;
         if (reset_underline)
-          att->underline = 0;
+          att.underline = 0;
         if (reset_blink)
-          att->blink = 0;
+          att.blink = 0;
         if (reset_inverse)
-          att->inverse = 0;
+          att.inverse = 0;
+        termpty_cell_att_set(ty, &cells[i], &att);
      }
 }
 
@@ -1872,7 +1803,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
         for (; top <= bottom; top++)
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
-             _deccara(cells, len, set_bold, reset_bold, set_underline,
+             _deccara(ty, cells, len, set_bold, reset_bold, set_underline,
                       reset_underline, set_blink, reset_blink, set_inverse,
                       reset_inverse);
           }
@@ -1889,7 +1820,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right - left;
-             _deccara(cells, len, set_bold, reset_bold,
+             _deccara(ty, cells, len, set_bold, reset_bold,
                       set_underline, reset_underline,
                       set_blink, reset_blink,
                       set_inverse, reset_inverse);
@@ -1899,7 +1830,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
              /* First line */
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right_border - left;
-             _deccara(cells, len, set_bold, reset_bold,
+             _deccara(ty, cells, len, set_bold, reset_bold,
                       set_underline, reset_underline,
                       set_blink, reset_blink,
                       set_inverse, reset_inverse);
@@ -1909,7 +1840,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
              for (top = top + 1; top < bottom; top++)
                {
                   cells = &(TERMPTY_SCREEN(ty, left_border, top));
-                  _deccara(cells, len, set_bold, reset_bold,
+                  _deccara(ty, cells, len, set_bold, reset_bold,
                            set_underline, reset_underline,
                            set_blink, reset_blink,
                            set_inverse, reset_inverse);
@@ -1918,7 +1849,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
              /* Last line */
              cells = &(TERMPTY_SCREEN(ty, left_border, bottom));
              len = right - left_border;
-             _deccara(cells, len, set_bold, reset_bold,
+             _deccara(ty, cells, len, set_bold, reset_bold,
                       set_underline, reset_underline,
                       set_blink, reset_blink,
                       set_inverse, reset_inverse);
@@ -1927,7 +1858,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
 }
 
 static void
-_decrara(Termcell *cells, int len,
+_decrara(Termpty *ty, Termcell *cells, int len,
          Eina_Bool reverse_bold,
          Eina_Bool reverse_underline,
          Eina_Bool reverse_blink,
@@ -1935,17 +1866,21 @@ _decrara(Termcell *cells, int len,
 {
    int i;
 
+   termpty_cells_changed(ty, cells, len);
+
    for (i = 0; i < len; i++)
      {
-        Termatt * att = &cells[i].att;
+        Termatt att = *termpty_cell_att(ty, &cells[i]);
+
         if (reverse_bold)
-          att->bold = !att->bold;
+          att.bold = !att.bold;
         if (reverse_underline)
-          att->underline = !att->underline;
+          att.underline = !att.underline;
         if (reverse_blink)
-          att->blink = !att->blink;
+          att.blink = !att.blink;
         if (reverse_inverse)
-          att->inverse = !att->inverse;
+          att.inverse = !att.inverse;
+        termpty_cell_att_set(ty, &cells[i], &att);
      }
 }
 
@@ -2019,7 +1954,7 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
         for (; top <= bottom; top++)
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
           }
      }
@@ -2035,7 +1970,7 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right - left;
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
           }
         else
@@ -2043,7 +1978,7 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
              /* First line */
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right_border - left;
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
 
              /* Middle */
@@ -2051,14 +1986,14 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
              for (top = top + 1; top < bottom; top++)
                {
                   cells = &(TERMPTY_SCREEN(ty, left_border, top));
-                  _decrara(cells, len, reverse_bold, reverse_underline,
+                  _decrara(ty, cells, len, reverse_bold, reverse_underline,
                            reverse_blink, reverse_inverse);
                }
 
              /* Last line */
              cells = &(TERMPTY_SCREEN(ty, left_border, bottom));
              len = right - left_border;
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
           }
      }
@@ -2450,6 +2385,7 @@ _handle_esc_csi_decdc(Termpty *ty, Eina_Unicode **b)
         int x;
         Termcell *cells = &(TERMPTY_SCREEN(ty, 0, y));
 
+        TERMPTY_ROW_CHANGED(ty, y);
         for (x = ty->cursor_state.cx; x < max_x; x++)
           {
              if (x < lim)
@@ -2457,11 +2393,11 @@ _handle_esc_csi_decdc(Termpty *ty, Eina_Unicode **b)
              else
                {
                   cells[x].codepoint = ' ';
-                  if (EINA_UNLIKELY(cells[x].att.link_id))
-                    term_link_refcount_dec(ty, cells[x].att.link_id, 1);
-                  cells[x].att = ty->termstate.att;
-                  cells[x].att.link_id = 0;
-                  cells[x].att.dblwidth = 0;
+                  if (EINA_UNLIKELY(termpty_cell_link_id(ty, &cells[x])))
+                    term_link_refcount_dec(ty,
+                                           termpty_cell_link_id(ty, &cells[x]),
+                                           1);
+                  cells[x].att_id = _blank_att_id(ty);
                }
           }
      }
@@ -3313,28 +3249,32 @@ _handle_window_manipulation(Termpty *ty, Eina_Unicode **ptr)
 static int
 _handle_esc_csi(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
 {
-   const Eina_Unicode *cc, *be;
-   Eina_Unicode buf[4096], *b;
+   const Eina_Unicode *cc, *be, *p;
+   Eina_Unicode buf[SEQ_ARGS_MAX], *b;
 
    cc = (Eina_Unicode *)c;
    b = buf;
    be = buf + sizeof(buf) / sizeof(buf[0]);
    while ((cc < ce) && (*cc <= '?') && (b < be))
      {
-        _handle_cursor_control(ty, cc);
         *b = *cc;
         b++;
         cc++;
      }
+   if ((cc == ce) && (b < be)) return 0;
+   /* control characters within the sequence only act once it is complete */
+   for (p = buf; p < b; p++)
+     _handle_cursor_control(ty, p);
    if (b == be)
      {
         ERR("csi parsing overflowed, skipping the whole buffer (binary data?)");
         return cc - c;
      }
-   if (cc == ce) return 0;
    *b = 0;
    be = b;
    b = buf;
+   if ((*cc >= 0x40) && (*cc < 0x7f))
+     ty->stats.csi[*cc - 0x40]++;
    DBG(" CSI: '%s' args '%s'", termptyesc_safechar(*cc), (char *) buf);
    switch (*cc)
      {
@@ -4216,7 +4156,7 @@ static int
 _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
 {
    const Eina_Unicode *cc, *be;
-   Eina_Unicode buf[4096], *p;
+   Eina_Unicode buf[SEQ_ARGS_MAX], *p;
    char *s;
    int len = 0;
    int arg;
@@ -4250,6 +4190,10 @@ _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
      return 0;
 
    arg = _osc_arg_get(ty, &p);
+   if ((arg >= 0) && (arg < TERMPTY_STATS_OSC_MAX))
+     ty->stats.osc[arg]++;
+   else
+     ty->stats.osc[TERMPTY_STATS_OSC_MAX]++;
    switch (arg)
      {
       case -ESC_ARG_ERROR:
@@ -4411,6 +4355,76 @@ err:
     return cc - c;
 }
 
+/* Reply to "qc" with the counters of the terminal as a DCS string,
+ * "ESC P qc;name=value;...ESC \". It holds no end of line so that a shell
+ * reading it, when the query was only printed, does not run anything */
+static void
+_handle_esc_terminology_stats(Termpty *ty)
+{
+   const Termpty_Stats *st = &ty->stats;
+   const struct {
+      const char *name;
+      uint64_t value;
+   } counters[] = {
+        { "wakeups", st->wakeups },
+        { "reads", st->reads },
+        { "bytes", st->bytes },
+        { "codepoints", st->codepoints },
+        { "codepoints.ascii", st->ascii },
+        { "esc", st->esc },
+        { "dcs", st->dcs },
+        { "terminology", st->terminology },
+        { "osc.other", st->osc[TERMPTY_STATS_OSC_MAX] },
+        { "scrolls", st->scrolls },
+        { "backlog.added", st->backlog_added },
+        { "backlog.freed", st->backlog_freed },
+        { "backlog.compressed", st->backlog_compressed },
+        { "backlog.inflated", st->backlog_inflated },
+        { "backlog.evicted", st->backlog_evicted },
+        { "backlog.blocks", st->backlog_blocks },
+        { "backlog.mallocs", st->backlog_mallocs },
+        { "backlog.disk", st->backlog_disk },
+        { "backlog.mapped", st->backlog_mapped },
+        { "renders", st->renders },
+        { "render.cells", st->cells_rendered },
+        { "render.rows_skipped", st->rows_skipped },
+        { "decoding_errors", st->decoding_errors },
+   };
+   struct ty_sb sb = {};
+   char buf[64];
+   int i, res = 0;
+
+   res |= TY_SB_ADD(&sb, "\033Pqc");
+   for (i = 0; i < (int)(sizeof(counters) / sizeof(counters[0])); i++)
+     {
+        snprintf(buf, sizeof(buf), ";%s=%llu",
+                 counters[i].name, (unsigned long long)counters[i].value);
+        res |= TY_SB_ADD(&sb, buf);
+     }
+   for (i = 0; i < (int)(sizeof(st->csi) / sizeof(st->csi[0])); i++)
+     {
+        if (!st->csi[i])
+          continue;
+        snprintf(buf, sizeof(buf), ";csi.%c=%llu",
+                 (char)(0x40 + i), (unsigned long long)st->csi[i]);
+        res |= TY_SB_ADD(&sb, buf);
+     }
+   for (i = 0; i < TERMPTY_STATS_OSC_MAX; i++)
+     {
+        if (!st->osc[i])
+          continue;
+        snprintf(buf, sizeof(buf), ";osc.%d=%llu",
+                 i, (unsigned long long)st->osc[i]);
+        res |= TY_SB_ADD(&sb, buf);
+     }
+   snprintf(buf, sizeof(buf), ";render.time=%.6f\033\\", st->render_time);
+   res |= TY_SB_ADD(&sb, buf);
+
+   if (res == 0)
+     termpty_write(ty, sb.buf, sb.len);
+   ty_sb_free(&sb);
+}
+
 static int
 _handle_esc_terminology(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
 {
@@ -4420,9 +4434,6 @@ _handle_esc_terminology(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *
    size_t blen = 0;
    Config *config;
 
-   if (!ty->buf_have_zero)
-     return 0;
-
    config = termio_config_get(ty->obj);
 
    cc = (Eina_Unicode *)c;
@@ -4439,6 +4450,13 @@ _handle_esc_terminology(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *
      return 0;
    buf = (Eina_Unicode *)c;
    cc = cc_zero;
+   ty->stats.terminology++;
+
+   if ((buf[0] == 'q') && (buf[1] == 'c') && (buf[2] == 0))
+     {
+        _handle_esc_terminology_stats(ty);
+        return cc - c;
+     }
 
    // commands are stored in the buffer, 0 bytes not allowed (end marker)
    cmd = eina_unicode_unicode_to_utf8(buf, NULL);
@@ -4462,7 +4480,7 @@ _handle_esc_dcs(Termpty *ty,
                 const Eina_Unicode *ce)
 {
    const Eina_Unicode *cc, *be;
-   Eina_Unicode buf[4096], *b;
+   Eina_Unicode buf[SEQ_ARGS_MAX], *b;
    int len = 0;
 
    cc = c;
@@ -4491,6 +4509,7 @@ _handle_esc_dcs(Termpty *ty,
    if ((*cc == ST) || (*cc == '\\')) cc++;
    else return 0;
    len = cc - c;
+   ty->stats.dcs++;
    switch (buf[0])
      {
       case '+':
@@ -4678,6 +4697,7 @@ _handle_decfi(Termpty *ty)
              int x;
              Termcell *cells = &(TERMPTY_SCREEN(ty, 0, y));
 
+             TERMPTY_ROW_CHANGED(ty, y);
              for (x = ty->termstate.left_margin; x <= max_x; x++)
                {
                   if (x < max_x)
@@ -4685,11 +4705,10 @@ _handle_decfi(Termpty *ty)
                   else
                     {
                        cells[x].codepoint = ' ';
-                       if (EINA_UNLIKELY(cells[x].att.link_id))
-                         term_link_refcount_dec(ty, cells[x].att.link_id, 1);
-                       cells[x].att = ty->termstate.att;
-                       cells[x].att.link_id = 0;
-                       cells[x].att.dblwidth = 0;
+                       if (EINA_UNLIKELY(termpty_cell_link_id(ty, &cells[x])))
+                         term_link_refcount_dec(ty,
+                            termpty_cell_link_id(ty, &cells[x]), 1);
+                       cells[x].att_id = _blank_att_id(ty);
                     }
                }
           }
@@ -4880,6 +4899,10 @@ termpty_handle_seq(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
              len = _handle_esc(ty, c + 1, ce);
              if (len == 0)
                goto end;
+             /* others are counted by class */
+             if ((c[1] != '[') && (c[1] != ']') && (c[1] != 'P') &&
+                 (c[1] != '}'))
+               ty->stats.esc++;
              len++;
              goto end;
            default:
@@ -4965,6 +4988,8 @@ termpty_handle_seq(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
        last_char = c[len-1];
 
 end:
+   if (ty->decoding_error)
+     ty->stats.decoding_errors++;
 #if !defined(BINARY_TYFUZZ) && !defined(BINARY_TYTEST)
    if (ty->decoding_error)
      {
@@ -4980,6 +5005,247 @@ end:
      }
 #endif
    ty->decoding_error = EINA_FALSE;
-   ty->last_char = last_char;
+   /* an incomplete sequence is handled again once complete */
+   if (len > 0)
+     ty->last_char = last_char;
    return len;
 }
+
+/* Incomplete sequences.
+ *
+ * When termpty_handle_seq() lacks the end of a sequence, the codepoints read
+ * so far are stored in ty->seq and the state below tracks where in the
+ * sequence the parser is.  Each codepoint read afterwards is only looked at
+ * to advance that state, the whole sequence is handed to
+ * termpty_handle_seq() once its terminator has been read.
+ */
+enum _Seq_State
+{
+   SEQ_NONE = 0,
+   SEQ_ESC,
+   SEQ_ESC_ARG, /* 2 characters escape, like ESC ( */
+   SEQ_CSI,
+   SEQ_OSC,
+   SEQ_OSC_ESC, /* OSC payload ending with ESC, maybe ESC \ */
+   SEQ_DCS,
+   SEQ_DCS_ESC,
+   SEQ_TERMINOLOGY,
+   SEQ_DONE
+};
+
+/* Keep the buffer of the pending sequence across sequences unless it grew
+ * larger than this */
+#define SEQ_BUF_KEEP 1024
+
+static unsigned char
+_seq_step(Termpty *ty, Eina_Unicode c)
+{
+   switch (ty->seq.state)
+     {
+      case SEQ_NONE:
+         ty->seq.payload = 0;
+         if (c == ESC) return SEQ_ESC;
+         if (c == CSI) return SEQ_CSI;
+         if (c == OSC) return SEQ_OSC;
+         return SEQ_DONE;
+      case SEQ_ESC:
+         switch (c)
+           {
+            case '[': return SEQ_CSI;
+            case ']': return SEQ_OSC;
+            case 'P': return SEQ_DCS;
+            case '}': return SEQ_TERMINOLOGY;
+            case '"': case '(': case ')': case '*':
+            case '+': case '$': case '#': case '@':
+               return SEQ_ESC_ARG;
+            default:
+               return SEQ_DONE;
+           }
+      case SEQ_CSI:
+         if (c > '?') return SEQ_DONE;
+         return (++ty->seq.payload < SEQ_ARGS_MAX) ? SEQ_CSI : SEQ_DONE;
+      case SEQ_OSC_ESC:
+      case SEQ_DCS_ESC:
+         if (c == '\\') return SEQ_DONE;
+         /* the ESC was part of the payload */
+         ty->seq.state = (ty->seq.state == SEQ_OSC_ESC) ? SEQ_OSC : SEQ_DCS;
+         if (++ty->seq.payload >= SEQ_ARGS_MAX) return SEQ_DONE;
+         return _seq_step(ty, c);
+      case SEQ_OSC:
+      case SEQ_DCS:
+         if ((c == ST) || ((c == BEL) && (ty->seq.state == SEQ_OSC)))
+           return SEQ_DONE;
+         if (c == ESC)
+           {
+              /* an ESC filling the buffer ends the sequence, whatever
+               * follows */
+              if (ty->seq.payload + 1 >= SEQ_ARGS_MAX) return SEQ_DONE;
+              return ty->seq.state + 1;
+           }
+         if (++ty->seq.payload >= SEQ_ARGS_MAX) return SEQ_DONE;
+         return ty->seq.state;
+      case SEQ_TERMINOLOGY:
+         return (c == 0x0) ? SEQ_DONE : SEQ_TERMINOLOGY;
+      case SEQ_ESC_ARG:
+      default:
+         return SEQ_DONE;
+     }
+}
+
+/* Append codepoints of the pending sequence up to its end, if it is in
+ * [c, ce).  Returns the number of codepoints consumed */
+static int
+_seq_append(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
+{
+   const Eina_Unicode *cc;
+   size_t n;
+
+   for (cc = c; (cc < ce) && (ty->seq.state != SEQ_DONE); cc++)
+     ty->seq.state = _seq_step(ty, *cc);
+   n = cc - c;
+
+   if (ty->seq.len + n + 1 > ty->seq.size)
+     {
+        Eina_Unicode *b;
+        size_t size = MAX(ty->seq.size * 2, ty->seq.len + n + 1);
+
+        size = MAX(size, 64);
+        b = realloc(ty->seq.buf, size * sizeof(Eina_Unicode));
+        if (!b)
+          {
+             ERR(_("memerr: %s"), strerror(errno));
+             ty->seq.state = SEQ_NONE;
+             ty->seq.len = 0;
+             return ce - c;
+          }
+        ty->seq.buf = b;
+        ty->seq.size = size;
+     }
+   /* c may point within ty->seq.buf when suspending its remainder */
+   memmove(ty->seq.buf + ty->seq.len, c, n * sizeof(Eina_Unicode));
+   ty->seq.len += n;
+   /* parsers look past the end of the sequence */
+   ty->seq.buf[ty->seq.len] = 0;
+   return n;
+}
+
+static void
+_seq_dispatch(Termpty *ty)
+{
+   const Eina_Unicode *c, *ce;
+   int n;
+
+   c = ty->seq.buf;
+   ce = c + ty->seq.len;
+   ty->seq.state = SEQ_NONE;
+   while (c < ce)
+     {
+        n = termpty_handle_seq(ty, c, ce);
+        if (n == 0)
+          {
+             /* left over after an overflowing sequence */
+             termpty_seq_suspend(ty, c, ce);
+             return;
+          }
+        c += n;
+     }
+   ty->seq.len = 0;
+   if (ty->seq.size > SEQ_BUF_KEEP)
+     {
+        free(ty->seq.buf);
+        ty->seq.buf = NULL;
+        ty->seq.size = 0;
+     }
+}
+
+/* termpty_handle_seq() returned 0 on [c, ce): keep it for later */
+void
+termpty_seq_suspend(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
+{
+   int n;
+
+   ty->seq.state = SEQ_NONE;
+   ty->seq.len = 0;
+   n = _seq_append(ty, c, ce);
+   if (ty->seq.state == SEQ_DONE)
+     {
+        ERR("unterminated sequence of %i characters seen as complete",
+            (int)(ce - c));
+        ty->seq.state = SEQ_NONE;
+        ty->seq.len = 0;
+        return;
+     }
+   assert(n == ce - c);
+}
+
+/* Continue the pending sequence with [c, ce), handling it if it ends there.
+ * What its handling leaves over is pending again and comes before the rest
+ * of [c, ce), which is then appended to it.
+ * Returns the number of codepoints consumed */
+int
+termpty_seq_resume(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
+{
+   const Eina_Unicode *cc = c;
+
+   do
+     {
+        cc += _seq_append(ty, cc, ce);
+        if (ty->seq.state == SEQ_DONE)
+          _seq_dispatch(ty);
+     }
+   while ((cc < ce) && (ty->seq.state != SEQ_NONE));
+   return cc - c;
+}
+
+#if defined(BINARY_TYTEST)
+int
+tytest_seq_resume(void)
+{
+   Termpty ty;
+   const Eina_Unicode csi[] = { ESC, '[', '1', ';', '2' };
+   const Eina_Unicode osc[] = { ESC, ']', '2', ';', ESC, 'x' };
+   unsigned int i;
+   size_t n;
+
+   memset(&ty, 0, sizeof(ty));
+
+   termpty_seq_suspend(&ty, csi, csi + 1);
+   for (i = 1; i < sizeof(csi) / sizeof(csi[0]); i++)
+     assert(termpty_seq_resume(&ty, csi + i, csi + i + 1) == 1);
+   assert(ty.seq.state == SEQ_CSI);
+   assert(ty.seq.payload == 3);
+   assert(ty.seq.len == sizeof(csi) / sizeof(csi[0]));
+   assert(ty.seq.buf[ty.seq.len] == 0);
+
+   /* an ESC not followed by '\' is part of the payload */
+   termpty_seq_suspend(&ty, osc, osc + 5);
+   assert(ty.seq.state == SEQ_OSC_ESC);
+   assert(termpty_seq_resume(&ty, osc + 5, osc + 6) == 1);
+   assert(ty.seq.state == SEQ_OSC);
+   assert(ty.seq.payload == 4);
+   assert(ty.seq.len == sizeof(osc) / sizeof(osc[0]));
+
+   /* an overflowing OSC ready to be handled, with the start of a CSI left
+    * over after it: the rest of the input comes after that CSI, even if it
+    * is incomplete as well */
+   n = 2 + SEQ_ARGS_MAX + 3;
+   ty.seq.buf = realloc(ty.seq.buf, (n + 1) * sizeof(Eina_Unicode));
+   assert(ty.seq.buf);
+   ty.seq.size = n + 1;
+   ty.seq.buf[0] = ESC;
+   ty.seq.buf[1] = ']';
+   for (i = 2; i < 2 + SEQ_ARGS_MAX; i++)
+     ty.seq.buf[i] = 'a';
+   memcpy(ty.seq.buf + i, csi, 3 * sizeof(Eina_Unicode));
+   ty.seq.len = n;
+   ty.seq.buf[n] = 0;
+   ty.seq.state = SEQ_DONE;
+   assert(termpty_seq_resume(&ty, csi + 3, csi + 5) == 2);
+   assert(ty.seq.state == SEQ_CSI);
+   assert(ty.seq.len == sizeof(csi) / sizeof(csi[0]));
+   assert(!memcmp(ty.seq.buf, csi, sizeof(csi)));
+
+   free(ty.seq.buf);
+   return 0;
+}
+#endif
@@ -326,13 +326,17 @@ _handle_link(Termpty *ty, const Eina_Unicode *buf)
    /* highlight where the mouse is */
      {
         Termcell *cells = NULL;
+        Termatt att;
         ssize_t w;
 
         cells = termpty_cellrow_get(ty, sd->mouse.cy, &w);
-        termpty_reset_att(&cells[sd->mouse.cx].att);
-        cells[sd->mouse.cx].att.bold = 1;
-        cells[sd->mouse.cx].att.fg = COL_WHITE;
-        cells[sd->mouse.cx].att.bg = COL_RED;
+        att = *termpty_cell_att(ty, &cells[sd->mouse.cx]);
+        termpty_reset_att(&att);
+        att.bold = 1;
+        att.fg = COL_WHITE;
+        att.bg = COL_RED;
+        termpty_cell_att_set(ty, &cells[sd->mouse.cx], &att);
+        termpty_cells_changed(ty, &cells[sd->mouse.cx], 1);
      }
 
    /* skip type */
@@ -541,6 +545,8 @@ termpty_ext_handle(Termpty *ty ARG_USED_FOR_TESTS,
      {
 #if defined(BINARY_TYTEST) || defined(ENABLE_TEST_UI)
       case 't':
+        /* tests look at the selection */
+        termpty_scroll_flush(ty);
         tytest_handle_escape_codes(ty, buf + 1);
         return EINA_TRUE;
         break;
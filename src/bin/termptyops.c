@@ -25,15 +25,65 @@ void
 termpty_cells_clear(Termpty *ty, Termcell *cells, int count)
 {
    Termcell src;
+   Termatt att = ty->termstate.att;
 
-   memset(&src, 0, sizeof(src));
+   att.link_id = 0;
    src.codepoint = 0;
-   src.att = ty->termstate.att;
-   src.att.link_id = 0;
+   src.att_id = termpty_att_id(ty, &att);
 
    termpty_cell_fill(ty, &src, cells, count);
 }
 
+/* Rows @start_y to @end_y now show other cells */
+static void
+_rows_changed(Termpty *ty, int start_y, int end_y)
+{
+   int y;
+
+   if ((start_y == 0) && (end_y == ty->h - 1))
+     {
+        termpty_screen_changed(ty);
+        return;
+     }
+   /* moved rows keep their Termrow */
+   for (y = start_y; y <= end_y; y++)
+     termpty_screen_row_info(ty, y)->changed = ty->changes.gen;
+}
+
+/* Account for a scroll of one line, they are applied to the view and the
+ * selection in batches of the same direction and region */
+static void
+_scroll_account(Termpty *ty, int direction, int start_y, int end_y)
+{
+   Termpty_Scrolled *s = &ty->scrolled;
+
+   if ((s->lines != 0) &&
+       (((s->lines < 0) != (direction < 0)) ||
+        (s->start_y != start_y) || (s->end_y != end_y) ||
+        (s->left_margin != ty->termstate.left_margin) ||
+        (s->right_margin != ty->termstate.right_margin)))
+     termpty_scroll_flush(ty);
+   if (s->lines == 0)
+     {
+        s->start_y = start_y;
+        s->end_y = end_y;
+        s->left_margin = ty->termstate.left_margin;
+        s->right_margin = ty->termstate.right_margin;
+     }
+   s->lines += direction;
+}
+
+/* Apply the lines scrolled since last time to the view and the selection */
+void
+termpty_scroll_flush(Termpty *ty)
+{
+   Termpty_Scrolled s = ty->scrolled;
+
+   if (s.lines == 0)
+     return;
+   ty->scrolled.lines = 0;
+   termio_scroll(ty->obj, &s);
+}
 
 void
 termpty_text_scroll(Termpty *ty, Eina_Bool clear)
@@ -41,6 +91,7 @@ termpty_text_scroll(Termpty *ty, Eina_Bool clear)
    Termcell *cells = NULL;
    int start_y = 0, end_y = ty->h - 1;
 
+   ty->stats.scrolls++;
    start_y = ty->termstate.top_margin;
    if (ty->termstate.bottom_margin != 0)
      end_y = ty->termstate.bottom_margin - 1;
@@ -49,21 +100,24 @@ termpty_text_scroll(Termpty *ty, Eina_Bool clear)
        (!ty->altbuf))
      termpty_text_save_top(ty, &(TERMPTY_SCREEN(ty, 0, 0)), ty->w);
 
-   termio_scroll(ty->obj, -1, start_y, end_y);
+   _scroll_account(ty, -1, start_y, end_y);
    DBG("... scroll!!!!! [%i->%i]", start_y, end_y);
 
-   if ((start_y == 0 && end_y == ty->h - 1) &&
-       (ty->termstate.left_margin == 0) &&
+   if ((ty->termstate.left_margin == 0) &&
        (ty->termstate.right_margin == 0))
      {
-        // screen is a circular buffer now
-        cells = &(ty->screen[ty->circular_offset * ty->w]);
+        Termcell **rows = ty->screen_rows;
+
+        /* rotate the rows, the top one is reused at the bottom */
+        cells = rows[start_y];
+        memmove(&rows[start_y], &rows[start_y + 1],
+                (end_y - start_y) * sizeof(Termcell *));
+        rows[end_y] = cells;
         if (clear)
           termpty_cells_clear(ty, cells, ty->w);
-
-        ty->circular_offset++;
-        if (ty->circular_offset >= ty->h)
-          ty->circular_offset = 0;
+        else if ((end_y > start_y) && (start_y != 0 || end_y != ty->h - 1))
+          TERMPTY_CELL_COPY(ty, rows[end_y - 1], cells, ty->w);
+        _rows_changed(ty, start_y, end_y);
      }
    else
      {
@@ -94,26 +148,30 @@ termpty_text_scroll_rev(Termpty *ty, Eina_Bool clear)
    Termcell *cells;
    int start_y = 0, end_y = ty->h - 1;
 
+   ty->stats.scrolls++;
    if (ty->termstate.bottom_margin != 0)
      {
         start_y = ty->termstate.top_margin;
         end_y = ty->termstate.bottom_margin - 1;
      }
    DBG("... scroll rev!!!!! [%i->%i]", start_y, end_y);
-   termio_scroll(ty->obj, 1, start_y, end_y);
+   _scroll_account(ty, 1, start_y, end_y);
 
-   if ((start_y == 0 && end_y == (ty->h - 1)) &&
-       (ty->termstate.left_margin == 0) &&
+   if ((ty->termstate.left_margin == 0) &&
        (ty->termstate.right_margin == 0))
      {
-        // screen is a circular buffer now
-        ty->circular_offset--;
-        if (ty->circular_offset < 0)
-          ty->circular_offset = ty->h - 1;
+        Termcell **rows = ty->screen_rows;
 
-        cells = &(ty->screen[ty->circular_offset * ty->w]);
+        /* rotate the rows, the bottom one is reused at the top */
+        cells = rows[end_y];
+        memmove(&rows[start_y + 1], &rows[start_y],
+                (end_y - start_y) * sizeof(Termcell *));
+        rows[start_y] = cells;
         if (clear)
           termpty_cells_clear(ty, cells, ty->w);
+        else if ((end_y > start_y) && (start_y != 0 || end_y != ty->h - 1))
+          TERMPTY_CELL_COPY(ty, rows[start_y + 1], cells, ty->w);
+        _rows_changed(ty, start_y, end_y);
      }
    else
      {
@@ -177,10 +235,93 @@ termpty_text_scroll_rev_test(Termpty *ty, Eina_Bool clear)
      }
 }
 
-void
-termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
+#define IS_PRINTABLE_ASCII(g) (((g) >= 0x20) && ((g) < 0x7f))
+
+/* Can runs of printable ascii be written straight into the cells:
+ * charset is ascii and is not altered by fraktur or encircled, no insert
+ * mode, no margins, no hyperlink and no pending combining strike */
+static Eina_Bool
+_text_append_ascii_possible(const Termpty *ty)
+{
+   return ((ty->termstate.charsetch == 'B') &&
+           (!ty->termstate.insert) &&
+           (!ty->termstate.left_margin) &&
+           (!ty->termstate.right_margin) &&
+           (!ty->termstate.att.link_id) &&
+           (!ty->termstate.att.fraktur) &&
+           (!ty->termstate.att.encircled) &&
+           (!ty->termstate.combining_strike));
+}
+
+static void
+_cells_ascii_fill(Termpty *ty, Termcell *dst, const Eina_Unicode *codepoints,
+                  int n, uint32_t att_id)
+{
+   int i;
+
+   if (EINA_UNLIKELY(termpty_cells_flags_get(ty, dst, n)))
+     {
+        for (i = 0; i < n; i++)
+          {
+             HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint,
+                                              codepoints[i]);
+             if (termpty_cell_link_id(ty, &dst[i]))
+               term_link_refcount_dec(ty, termpty_cell_link_id(ty, &dst[i]),
+                                      1);
+          }
+     }
+   termpty_cells_set(ty, dst, n, 0);
+   for (i = 0; i < n; i++)
+     {
+        dst[i].codepoint = codepoints[i];
+        dst[i].att_id = att_id;
+     }
+}
+
+/* Same as _text_append_generic() on printable ascii codepoints, when
+ * _text_append_ascii_possible() */
+static void
+_text_append_ascii(Termpty *ty, const Eina_Unicode *codepoints, int len)
+{
+   Termcell *cells;
+   Termatt att = ty->termstate.att;
+   uint32_t att_id;
+
+   att.dblwidth = 0;
+   att_id = termpty_att_id(ty, &att);
+   cells = &(TERMPTY_SCREEN(ty, 0, ty->cursor_state.cy));
+   while (len > 0)
+     {
+        int n;
+
+        if (ty->termstate.wrapnext)
+          {
+             TERMPTY_CELL_ATT_SET(ty, &cells[ty->w - 1], autowrapped, 1);
+             ty->termstate.wrapnext = 0;
+             ty->cursor_state.cx = 0;
+             ty->cursor_state.cy++;
+             termpty_text_scroll_test(ty, EINA_TRUE);
+             cells = &(TERMPTY_SCREEN(ty, 0, ty->cursor_state.cy));
+          }
+        n = MIN(len, ty->w - ty->cursor_state.cx);
+        _cells_ascii_fill(ty, &(cells[ty->cursor_state.cx]), codepoints, n,
+                          att_id);
+        ty->cursor_state.cx += n;
+        if (ty->cursor_state.cx >= ty->w)
+          {
+             ty->cursor_state.cx = ty->w - 1;
+             ty->termstate.wrapnext = ty->termstate.wrap;
+          }
+        codepoints += n;
+        len -= n;
+     }
+}
+
+static void
+_text_append_generic(Termpty *ty, const Eina_Unicode *codepoints, int len)
 {
    Termcell *cells;
+   Termatt att;
    int i, j;
    int origin = ty->termstate.left_margin;
 
@@ -189,6 +330,7 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
      {
         int max_right = ty->w;
         Eina_Unicode g;
+        unsigned int flags;
 
         if (ty->termstate.right_margin &&
             (ty->cursor_state.cx < ty->termstate.right_margin))
@@ -198,7 +340,7 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
 
         if (ty->termstate.wrapnext)
           {
-             cells[max_right-1].att.autowrapped = 1;
+             TERMPTY_CELL_ATT_SET(ty, &cells[max_right - 1], autowrapped, 1);
              ty->termstate.wrapnext = 0;
              ty->cursor_state.cx = origin;
              ty->cursor_state.cy++;
@@ -212,17 +354,13 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
           }
 
         g = _termpty_charset_trans(ty, codepoints[i]);
-        /* Skip 0-width space or RTL/LTR marks */
-        if (EINA_UNLIKELY(g >= 0x200b && g <= 0x200f))
-          {
-             continue;
-          }
-        /* Skip variation selectors */
-        if (EINA_UNLIKELY(g >= 0xfe00 && g <= 0xfe0f))
+        flags = _termpty_unicode_flags_get(g);
+        /* Skip 0-width space, RTL/LTR marks and variation selectors */
+        if (EINA_UNLIKELY(flags & TERMPTY_UNICODE_ZERO_WIDTH))
           {
              continue;
           }
-        if (EINA_UNLIKELY(g >= 0x300 && g <=0x36f))
+        if (EINA_UNLIKELY(flags & TERMPTY_UNICODE_COMBINING))
           {
              /* combining chars */
              if (EINA_UNLIKELY(g == 0x336))
@@ -232,28 +370,32 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
              continue;
           }
 
-        termpty_cell_codepoint_att_fill(ty, g, ty->termstate.att,
-                                        &(cells[ty->cursor_state.cx]), 1);
+        att = ty->termstate.att;
         if (EINA_UNLIKELY(ty->termstate.combining_strike))
           {
              ty->termstate.combining_strike = 0;
-             cells[ty->cursor_state.cx].att.strike = 1;
+             att.strike = 1;
           }
 
-        cells[ty->cursor_state.cx].att.dblwidth = _termpty_is_dblwidth_get(ty, g);
-        if (EINA_UNLIKELY((cells[ty->cursor_state.cx].att.dblwidth) && (ty->cursor_state.cx < (max_right - 1))))
+        att.dblwidth = _termpty_is_dblwidth_flags(ty, flags);
+        if (EINA_UNLIKELY((att.dblwidth) && (ty->cursor_state.cx < (max_right - 1))))
           {
-             cells[ty->cursor_state.cx].att.newline = 0;
-             termpty_cell_codepoint_att_fill(ty, 0, cells[ty->cursor_state.cx].att,
+             att.newline = 0;
+             termpty_cell_codepoint_att_fill(ty, g, att,
+                                             &(cells[ty->cursor_state.cx]), 1);
+             termpty_cell_codepoint_att_fill(ty, 0, att,
                                              &(cells[ty->cursor_state.cx + 1]), 1);
           }
+        else
+          termpty_cell_codepoint_att_fill(ty, g, att,
+                                          &(cells[ty->cursor_state.cx]), 1);
 
         if (ty->termstate.wrap)
           {
              unsigned char offset = 1;
 
              ty->termstate.wrapnext = 0;
-             if (EINA_UNLIKELY(cells[ty->cursor_state.cx].att.dblwidth))
+             if (EINA_UNLIKELY(att.dblwidth))
                offset = 2;
              if (EINA_UNLIKELY(ty->cursor_state.cx >= (max_right - offset)))
                ty->termstate.wrapnext = 1;
@@ -268,7 +410,7 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
              unsigned char offset = 1;
 
              ty->termstate.wrapnext = 0;
-             if (EINA_UNLIKELY(cells[ty->cursor_state.cx].att.dblwidth))
+             if (EINA_UNLIKELY(att.dblwidth))
                offset = 2;
              ty->cursor_state.cx += offset;
              if (ty->cursor_state.cx > (max_right - offset))
@@ -281,6 +423,35 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
      }
 }
 
+void
+termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
+{
+   int i = 0, n;
+
+   while (i < len)
+     {
+        if (!_text_append_ascii_possible(ty))
+          {
+             _text_append_generic(ty, codepoints + i, len - i);
+             return;
+          }
+        for (n = i; (n < len) && IS_PRINTABLE_ASCII(codepoints[n]); n++)
+          ;
+        if (n > i)
+          {
+             _text_append_ascii(ty, codepoints + i, n - i);
+             i = n;
+          }
+        for (n = i; (n < len) && !IS_PRINTABLE_ASCII(codepoints[n]); n++)
+          ;
+        if (n > i)
+          {
+             _text_append_generic(ty, codepoints + i, n - i);
+             i = n;
+          }
+     }
+}
+
 void
 termpty_clear_line(Termpty *ty, Termpty_Clear mode, int limit)
 {
@@ -346,28 +517,17 @@ termpty_clear_screen(Termpty *ty, Termpty_Clear mode)
       case TERMPTY_CLR_BEGIN:
         if (ty->cursor_state.cy > 0)
           {
-             // First clear from circular > height, then from 0 to circular
-             int y = ty->cursor_state.cy + ty->circular_offset;
+             int y;
 
-             cells = &(TERMPTY_SCREEN(ty, 0, 0));
-
-             if (y < ty->h)
+             for (y = 0; y < ty->cursor_state.cy; y++)
                {
-                  termpty_cells_clear(ty, cells, ty->w * ty->cursor_state.cy);
-               }
-             else
-               {
-                  int yt = y % ty->h;
-                  int yb = ty->h - ty->circular_offset;
-
-                  termpty_cells_clear(ty, cells, ty->w * yb);
-                  termpty_cells_clear(ty, ty->screen, ty->w * yt);
+                  cells = &(TERMPTY_SCREEN(ty, 0, y));
+                  termpty_cells_clear(ty, cells, ty->w);
                }
           }
         termpty_clear_line(ty, mode, ty->w);
         break;
       case TERMPTY_CLR_ALL:
-        ty->circular_offset = 0;
         termpty_cells_clear(ty, ty->screen, ty->w * ty->h);
         if (ty->cb.cancel_sel.func)
           ty->cb.cancel_sel.func(ty->cb.cancel_sel.data);
@@ -401,6 +561,8 @@ termpty_reset_att(Termatt *att)
    att->strike = 0;
    att->fg256 = 0;
    att->bg256 = 0;
+   att->fgtrue = 0;
+   att->bgtrue = 0;
    att->fgintense = 0;
    att->bgintense = 0;
    att->autowrapped = 0;
@@ -510,7 +672,7 @@ termpty_move_cursor(Termpty *ty, int cx, int cy)
              /* go down */
              cells = termpty_cellrow_get(ty, cur_cy, &wlen);
              assert(cells);
-             if (cells[wlen-1].att.autowrapped)
+             if (termpty_cell_att(ty, &cells[wlen-1])->autowrapped)
                {
                   n_to_right += ty->w;
                }
@@ -525,7 +687,7 @@ termpty_move_cursor(Termpty *ty, int cx, int cy)
              /* go up */
              cells = termpty_cellrow_get(ty, cur_cy - 1, &wlen);
              assert(cells);
-             if (cells[wlen-1].att.autowrapped)
+             if (termpty_cell_att(ty, &cells[wlen-1])->autowrapped)
                {
                   n_to_right -= ty->w;
                }
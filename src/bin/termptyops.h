@@ -9,7 +9,6 @@ typedef enum _Termpty_Clear
 } Termpty_Clear;
 
 void termpty_text_save_top(Termpty *ty, Termcell *cells, ssize_t w_max);
-void termpty_cells_copy(Termpty *ty, Termcell *cells, Termcell *dest, int count);
 void termpty_cells_clear(Termpty *ty, Termcell *cells, int count);
 void termpty_cells_att_fill_preserve_colors(Termpty *ty, Termcell *cells,
                                        Eina_Unicode codepoint, int count);
@@ -17,6 +16,7 @@ void termpty_text_scroll(Termpty *ty, Eina_Bool clear);
 void termpty_text_scroll_rev(Termpty *ty, Eina_Bool clear);
 void termpty_text_scroll_test(Termpty *ty, Eina_Bool clear);
 void termpty_text_scroll_rev_test(Termpty *ty, Eina_Bool clear);
+void termpty_scroll_flush(Termpty *ty);
 void termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len);
 void termpty_clear_line(Termpty *ty, Termpty_Clear mode, int limit);
 void termpty_clear_screen(Termpty *ty, Termpty_Clear mode);
@@ -0,0 +1,706 @@
+#include "private.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <Elementary.h>
+#include "config.h"
+#include "termpty.h"
+#include "termptyops.h"
+#include "termiointernals.h"
+#include "backlog.h"
+#include "sb.h"
+#include "utf8.h"
+#include "tytest_common.h"
+
+/* Headless throughput benchmark of the terminal engine.
+ *
+ * Byte streams are replayed through the same code paths as the output of a
+ * pty: either built-in corpora, generated from a fixed seed so that numbers
+ * are comparable between runs and builds, or files recorded beforehand, for
+ * example with `sh tests/colors.sh > colors.bin`.
+ */
+
+int _log_domain = -1;
+
+#define BENCH_CHUNK 4096
+
+/* {{{ Allocation counting */
+
+static Eina_Bool _allocs_count = EINA_FALSE;
+static unsigned long long _allocs = 0;
+static unsigned long long _allocs_bytes = 0;
+
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *
+malloc(size_t size)
+{
+   if (_allocs_count)
+     {
+        _allocs++;
+        _allocs_bytes += size;
+     }
+   return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+   if (_allocs_count)
+     {
+        _allocs++;
+        _allocs_bytes += nmemb * size;
+     }
+   return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+   if (_allocs_count)
+     {
+        _allocs++;
+        _allocs_bytes += size;
+     }
+   return __libc_realloc(ptr, size);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+   void *ptr;
+
+   if (_allocs_count)
+     {
+        _allocs++;
+        _allocs_bytes += size;
+     }
+   ptr = __libc_memalign(alignment, size);
+   if (!ptr)
+     return ENOMEM;
+   *memptr = ptr;
+   return 0;
+}
+#define ALLOCS_COUNTED 1
+#endif
+
+/* }}} */
+/* {{{ Corpora */
+
+static uint32_t _seed;
+
+static uint32_t
+_rand(void)
+{
+   /* xorshift32, to get the same corpora whatever the libc */
+   _seed ^= _seed << 13;
+   _seed ^= _seed >> 17;
+   _seed ^= _seed << 5;
+   return _seed;
+}
+
+static const char *_words[] = {
+     "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+     "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+     "et", "dolore", "magna", "aliqua", "src/bin/termpty.c:1234:", "0x7f3a",
+     "-rw-r--r--", "1024", "Makefile", "error:", "warning:", "}", "{", "=",
+     "return", "static", "int", "(void)", "#include", "<stdio.h>",
+};
+
+static const char *
+_word(void)
+{
+   return _words[_rand() % (sizeof(_words) / sizeof(_words[0]))];
+}
+
+static void
+_add(struct ty_sb *sb, const char *s)
+{
+   if (TY_SB_ADD(sb, s) < 0)
+     {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+     }
+}
+
+static void
+_addf(struct ty_sb *sb, const char *fmt, ...) EINA_PRINTF(2, 3);
+
+static void
+_addf(struct ty_sb *sb, const char *fmt, ...)
+{
+   char buf[256];
+   va_list ap;
+
+   va_start(ap, fmt);
+   vsnprintf(buf, sizeof(buf), fmt, ap);
+   va_end(ap);
+   _add(sb, buf);
+}
+
+/* Lines of words, as from cat or a compiler */
+static void
+_corpus_plain(struct ty_sb *sb, size_t size)
+{
+   while (sb->len < size)
+     {
+        int n = _rand() % 16;
+
+        while (n-- > 0)
+          {
+             _add(sb, _word());
+             if (n)
+               _add(sb, " ");
+          }
+        _add(sb, "\r\n");
+     }
+}
+
+/* Words in 16, 256 or true colors, as from ls, git diff or syntax
+ * highlighters */
+static void
+_corpus_sgr(struct ty_sb *sb, size_t size)
+{
+   while (sb->len < size)
+     {
+        int n = _rand() % 16;
+
+        while (n-- > 0)
+          {
+             switch (_rand() % 6)
+               {
+                case 0:
+                   _addf(sb, "\033[%um", 30 + _rand() % 8);
+                   break;
+                case 1:
+                   _addf(sb, "\033[1;%um", 90 + _rand() % 8);
+                   break;
+                case 2:
+                   _addf(sb, "\033[38;5;%um", _rand() % 256);
+                   break;
+                case 3:
+                   _addf(sb, "\033[38;5;%u;48;5;%um",
+                         _rand() % 256, _rand() % 256);
+                   break;
+                case 4:
+                   _addf(sb, "\033[38;2;%u;%u;%um",
+                         _rand() % 256, _rand() % 256, _rand() % 256);
+                   break;
+                default:
+                   _add(sb, "\033[0m");
+               }
+             _add(sb, _word());
+             _add(sb, " ");
+          }
+        _add(sb, "\033[0m\r\n");
+     }
+}
+
+/* Full screen redraws with cursor addressing and scroll regions, as from
+ * top, htop or a text editor */
+static void
+_corpus_tui(struct ty_sb *sb, size_t size)
+{
+   unsigned int frame = 0;
+
+   while (sb->len < size)
+     {
+        int y;
+
+        _add(sb, "\033[?25l\033[H\033[7m");
+        _addf(sb, " frame %-8u load %u.%02u", frame, _rand() % 8,
+              _rand() % 100);
+        _add(sb, "\033[K\033[0m");
+        for (y = 2; y < TY_H; y++)
+          {
+             _addf(sb, "\033[%d;1H\033[%um%5u\033[0m %-12s\033[%u;1m%6u%%"
+                   "\033[0m %s %s\033[K",
+                   y, 31 + _rand() % 7, _rand() % 65536, _word(),
+                   32 + _rand() % 2, _rand() % 100, _word(), _word());
+          }
+        if (frame % 4 == 0)
+          {
+             _addf(sb, "\033[2;%dr\033[%d;1H\r\n%s\033[r", TY_H - 1, TY_H - 1,
+                   _word());
+             _add(sb, "\033[2;1H\033M\033[L\033[M\033[P\033[@");
+          }
+        _addf(sb, "\033[%d;1H\033[44m %s \033[0m\033[K", TY_H, _word());
+        _addf(sb, "\033[%u;%uH\033[?25h", 2 + _rand() % (TY_H - 2),
+              1 + _rand() % TY_W);
+        frame++;
+     }
+}
+
+/* Lines much wider than the terminal, as from minified files or logs */
+static void
+_corpus_long(struct ty_sb *sb, size_t size)
+{
+   while (sb->len < size)
+     {
+        size_t end = sb->len + 500 + _rand() % 8000;
+
+        while (sb->len < end)
+          {
+             _add(sb, _word());
+             _add(sb, ",");
+          }
+        _add(sb, "\r\n");
+     }
+}
+
+/* A true color for every cell, as from image viewers or color test scripts,
+ * more than a terminal keeps as is */
+static void
+_corpus_gradient(struct ty_sb *sb, size_t size)
+{
+   while (sb->len < size)
+     {
+        unsigned int base = _rand(), x;
+
+        for (x = 0; x < 80; x++)
+          _addf(sb, "\033[48;2;%u;%u;%um ",
+                (base + x * 3) & 0xff, (base >> 8) & 0xff,
+                ((base >> 16) + x) & 0xff);
+        _add(sb, "\033[0m\r\n");
+     }
+}
+
+/* OSC 8 hyperlinks, as from ls --hyperlink or gcc diagnostics */
+static void
+_corpus_links(struct ty_sb *sb, size_t size)
+{
+   while (sb->len < size)
+     {
+        int n = 1 + _rand() % 6;
+
+        while (n-- > 0)
+          {
+             const char *w = _word();
+             unsigned int id = _rand() % 1024;
+
+             _addf(sb, "\033]8;;file:///home/user/src/%s%u.c\033\\"
+                   "%s%u.c\033]8;;\033\\  ", w, id, w, id);
+          }
+        _add(sb, "\r\n");
+     }
+}
+
+/* Accented latin, cyrillic, double width and combining characters */
+static void
+_corpus_unicode(struct ty_sb *sb, size_t size)
+{
+   static const Eina_Unicode ranges[][2] = {
+        { 0x00c0, 0x00ff },
+        { 0x0410, 0x044f },
+        { 0x4e00, 0x4fff },
+        { 0x1f600, 0x1f64f },
+        { 0x2500, 0x257f },
+   };
+
+   while (sb->len < size)
+     {
+        int n = _rand() % 64;
+
+        while (n-- > 0)
+          {
+             const Eina_Unicode *r = ranges[_rand() % 5];
+             char txt[8];
+             int len;
+
+             len = codepoint_to_utf8(r[0] + _rand() % (r[1] - r[0] + 1), txt);
+             txt[len] = '\0';
+             _add(sb, txt);
+             if (_rand() % 16 == 0)
+               _add(sb, "\xcc\x81"); /* U+0301 COMBINING ACUTE ACCENT */
+             if (_rand() % 8 == 0)
+               _add(sb, " ");
+          }
+        _add(sb, "\r\n");
+     }
+}
+
+static const struct {
+     const char *name;
+     void (*gen)(struct ty_sb *sb, size_t size);
+} _corpora[] = {
+       { "plain", _corpus_plain },
+       { "sgr", _corpus_sgr },
+       { "tui", _corpus_tui },
+       { "long", _corpus_long },
+       { "gradient", _corpus_gradient },
+       { "links", _corpus_links },
+       { "unicode", _corpus_unicode },
+       { NULL, NULL },
+};
+
+static Eina_Bool
+_corpus_selected(const Eina_List *only, const char *name)
+{
+   const Eina_List *l;
+   const char *s;
+
+   EINA_LIST_FOREACH(only, l, s)
+     if (!strcmp(s, name))
+       return EINA_TRUE;
+   return EINA_FALSE;
+}
+
+/* Recorded output, repeated up to the given size */
+static Eina_Bool
+_corpus_file(struct ty_sb *sb, const char *path, size_t size)
+{
+   char buf[BENCH_CHUNK], *copy;
+   ssize_t len;
+   size_t once;
+   int fd;
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0)
+     {
+        fprintf(stderr, "can not open '%s': %s\n", path, strerror(errno));
+        return EINA_FALSE;
+     }
+   while ((len = read(fd, buf, sizeof(buf))) > 0)
+     {
+        if (ty_sb_add(sb, buf, len) < 0)
+          {
+             close(fd);
+             return EINA_FALSE;
+          }
+     }
+   close(fd);
+   if (len < 0)
+     return EINA_FALSE;
+   once = sb->len;
+   if ((once == 0) || (once >= size))
+     return EINA_TRUE;
+   /* the buffer moves as it grows */
+   copy = malloc(once);
+   if (!copy)
+     return EINA_FALSE;
+   memcpy(copy, sb->buf, once);
+   while (sb->len < size)
+     {
+        if (ty_sb_add(sb, copy, once) < 0)
+          break;
+     }
+   free(copy);
+   return sb->len >= size;
+}
+
+/* }}} */
+/* {{{ Runs */
+
+typedef struct _Bench_Result
+{
+   double decode, parse, total;
+   unsigned long long allocs, allocs_bytes;
+   int64_t backlog; /* memory used by the scrollback once filled */
+} Bench_Result;
+
+static void
+_bench_reset(Termpty *ty)
+{
+   /* RIS, then drop whatever would have been written back to the pty */
+   termpty_handle_utf8(ty, "\033c", 2);
+   ty_sb_free(&ty->write_buffer);
+}
+
+/* Decoding from utf-8 to codepoints alone */
+static double
+_bench_decode(const struct ty_sb *sb, Eina_Unicode *codepoints, size_t *n)
+{
+   double t = ecore_time_get();
+   size_t i = 0, j = 0;
+
+   while (i < sb->len)
+     codepoints[j++] = utf8_codepoint_next_get(sb->buf, sb->len, &i);
+   codepoints[j] = 0;
+   *n = j;
+   return ecore_time_get() - t;
+}
+
+/* Parsing and interpreting codepoints alone, through termpty_handle_buf() */
+static double
+_bench_parse(Termpty *ty, Eina_Unicode *codepoints, size_t n)
+{
+   double t = ecore_time_get();
+   size_t i;
+
+   for (i = 0; i < n; i += BENCH_CHUNK)
+     {
+        size_t len = MIN(n - i, (size_t)BENCH_CHUNK);
+        Eina_Unicode saved = codepoints[i + len];
+
+        /* the sequence parsers peek at the end of the buffer */
+        codepoints[i + len] = 0;
+        termpty_handle_buf(ty, codepoints + i, len);
+        codepoints[i + len] = saved;
+     }
+   return ecore_time_get() - t;
+}
+
+/* The whole path of a read from the pty, through termpty_handle_utf8() */
+static double
+_bench_total(Termpty *ty, const struct ty_sb *sb)
+{
+   char buf[BENCH_CHUNK + 1];
+   double t = ecore_time_get();
+   size_t i = 0;
+
+   while (i < sb->len)
+     {
+        size_t len = MIN(sb->len - i, (size_t)BENCH_CHUNK);
+
+        /* cut reads on a character boundary */
+        while ((len > 1) && (i + len < sb->len) &&
+               ((sb->buf[i + len] & 0xc0) == 0x80))
+          len--;
+        memcpy(buf, sb->buf + i, len);
+        buf[len] = '\0';
+        termpty_handle_utf8(ty, buf, len);
+        i += len;
+     }
+   return ecore_time_get() - t;
+}
+
+static Eina_Bool
+_bench_run(Termpty *ty, const struct ty_sb *sb, int repeat, Bench_Result *res)
+{
+   Eina_Unicode *codepoints;
+   size_t n = 0;
+   int r;
+
+   codepoints = malloc((sb->len + 1) * sizeof(Eina_Unicode));
+   if (!codepoints)
+     return EINA_FALSE;
+
+   memset(res, 0, sizeof(*res));
+   for (r = 0; r < repeat; r++)
+     {
+        double t;
+
+        t = _bench_decode(sb, codepoints, &n);
+        if ((r == 0) || (t < res->decode))
+          res->decode = t;
+
+        _bench_reset(ty);
+        t = _bench_parse(ty, codepoints, n);
+        if ((r == 0) || (t < res->parse))
+          res->parse = t;
+
+        _bench_reset(ty);
+        _allocs = _allocs_bytes = 0;
+        _allocs_count = EINA_TRUE;
+        t = _bench_total(ty, sb);
+        _allocs_count = EINA_FALSE;
+        if ((r == 0) || (t < res->total))
+          {
+             res->total = t;
+             res->allocs = _allocs;
+             res->allocs_bytes = _allocs_bytes;
+          }
+        res->backlog = termpty_backlog_memory_get();
+     }
+   _bench_reset(ty);
+   free(codepoints);
+   return EINA_TRUE;
+}
+
+static void
+_bench_print_header(void)
+{
+   printf("%-10s %8s %10s %10s %12s %10s %10s %10s %10s %11s\n",
+          "corpus", "MiB", "lines", "MiB/s", "lines/s", "allocs",
+          "decode ms", "parse ms", "total ms", "backlog KiB");
+}
+
+static void
+_bench_print(const char *name, const struct ty_sb *sb,
+             const Bench_Result *res)
+{
+   double mib = sb->len / (1024.0 * 1024.0);
+   size_t i, lines = 0;
+   char allocs[32];
+
+   for (i = 0; i < sb->len; i++)
+     if (sb->buf[i] == '\n')
+       lines++;
+#if defined(ALLOCS_COUNTED)
+   snprintf(allocs, sizeof(allocs), "%llu", res->allocs);
+#else
+   snprintf(allocs, sizeof(allocs), "n/a");
+#endif
+   printf("%-10s %8.2f %10zu %10.2f %12.0f %10s %10.2f %10.2f %10.2f %11lld\n",
+          name, mib, lines, mib / res->total, lines / res->total, allocs,
+          res->decode * 1000.0, res->parse * 1000.0, res->total * 1000.0,
+          (long long)(res->backlog / 1024));
+}
+
+static int
+_bench(Termpty *ty, const char *name, const struct ty_sb *sb, int repeat)
+{
+   Bench_Result res;
+
+   if (!_bench_run(ty, sb, repeat, &res))
+     {
+        fprintf(stderr, "can not run corpus '%s'\n", name);
+        return -1;
+     }
+   _bench_print(name, sb, &res);
+   return 0;
+}
+
+/* }}} */
+
+static void
+print_usage(const char *argv0)
+{
+   int i;
+
+   printf("Usage: %s [-s MIB] [-r REPEAT] [-b SCROLLBACK] [-z LINES] "
+          "[-d LINES] [-c CORPUS] [FILE...]\n"
+          "  Replay byte streams through the terminal engine and report its "
+          "throughput\n"
+          "\n"
+          "  -s MIB        size of each corpus, recorded output is repeated\n"
+          "                up to it (default: 16)\n"
+          "  -r REPEAT     runs of each corpus, the fastest one is kept "
+          "(default: 3)\n"
+          "  -b SCROLLBACK lines of scrollback (default: as in a new "
+          "config)\n"
+          "  -z LINES      compress scrollback lines older than that, 0 never\n"
+          "                (default: as in a new config)\n"
+          "  -d LINES      move scrollback lines older than that to disk, "
+          "0 never\n"
+          "                (default: as in a new config)\n"
+          "  -c CORPUS     only run this built-in corpus, can be repeated\n"
+          "  FILE          run recorded output instead of the built-in "
+          "corpora\n"
+          "\n"
+          "  Built-in corpora:",
+          argv0);
+   for (i = 0; _corpora[i].name; i++)
+     printf(" %s", _corpora[i].name);
+   printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+   Eina_List *only = NULL, *files = NULL, *l;
+   const char *name;
+   Termpty *ty;
+   size_t size = 16;
+   int repeat = 3, scrollback = -1, compress = -1, disk = -1,
+       i, res = 0;
+
+   for (i = 1; i < argc; i++)
+     {
+        if ((!strcmp(argv[i], "-h")) || (!strcmp(argv[i], "--help")))
+          {
+             print_usage(argv[0]);
+             return 0;
+          }
+        if ((argv[i][0] == '-') && (argv[i][1]) && (!argv[i][2]))
+          {
+             if (i + 1 >= argc)
+               goto usage;
+             switch (argv[i][1])
+               {
+                case 's': size = strtoul(argv[++i], NULL, 10); break;
+                case 'r': repeat = atoi(argv[++i]); break;
+                case 'b': scrollback = atoi(argv[++i]); break;
+                case 'z': compress = atoi(argv[++i]); break;
+                case 'd': disk = atoi(argv[++i]); break;
+                case 'c': only = eina_list_append(only, argv[++i]); break;
+                default: goto usage;
+               }
+             continue;
+          }
+        files = eina_list_append(files, argv[i]);
+     }
+   if ((size == 0) || (repeat <= 0))
+     goto usage;
+   EINA_LIST_FOREACH(only, l, name)
+     {
+        for (i = 0; _corpora[i].name; i++)
+          if (!strcmp(_corpora[i].name, name))
+            break;
+        if (!_corpora[i].name)
+          {
+             fprintf(stderr, "no built-in corpus named '%s'\n", name);
+             goto usage;
+          }
+     }
+
+   eina_init();
+
+   _log_domain = eina_log_domain_register("tybench", NULL);
+
+   tytest_common_init();
+   ty = tytest_termpty_get();
+   if (scrollback < 0)
+     scrollback = ty->config->scrollback;
+   termpty_backlog_size_set(ty, scrollback);
+   if (compress >= 0)
+     ty->config->scrollback_compress = compress;
+   if (disk >= 0)
+     ty->config->scrollback_disk = disk;
+
+   _bench_print_header();
+   if (files)
+     {
+        EINA_LIST_FOREACH(files, l, name)
+          {
+             struct ty_sb sb = {};
+
+             const char *base = strrchr(name, '/');
+
+             if (_corpus_file(&sb, name, size * 1024 * 1024))
+               res |= _bench(ty, base ? base + 1 : name, &sb, repeat);
+             else
+               res = -1;
+             ty_sb_free(&sb);
+          }
+     }
+   else
+     {
+        for (i = 0; _corpora[i].name; i++)
+          {
+             struct ty_sb sb = {};
+
+             if ((only) && (!_corpus_selected(only, _corpora[i].name)))
+               continue;
+             _seed = 0x7e57ab1e;
+             _corpora[i].gen(&sb, size * 1024 * 1024);
+             res |= _bench(ty, _corpora[i].name, &sb, repeat);
+             ty_sb_free(&sb);
+          }
+     }
+
+   termpty_backlog_free(ty);
+   tytest_common_shutdown();
+   eina_list_free(only);
+   eina_list_free(files);
+
+   eina_shutdown();
+
+   return res == 0 ? 0 : 1;
+
+usage:
+   print_usage(argv[0]);
+   return 1;
+}
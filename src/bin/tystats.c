@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "private.h"
+#include "tycommon.h"
+
+#define STATS_MAX 256
+
+typedef struct _Stat
+{
+   char name[32];
+   double value;
+} Stat;
+
+static void
+print_usage(const char* argv0)
+{
+   printf("Usage: %s "HELP_ARGUMENT_SHORT" [-i SECONDS]\n"
+         "  Show counters of what went through the current terminal\n"
+         "  -i SECONDS   Show what changed over that interval instead\n"
+         HELP_ARGUMENT_DOC"\n"
+         "\n",
+         argv0);
+}
+
+/* Read the reply, "ESC P qc;name=value;...ESC \", keeping what is between
+ * "qc" and the final "ESC \" */
+static int
+_reply_read(char *reply, size_t size)
+{
+   const char *start = "\033Pqc";
+   size_t len = 0, seen = 0;
+   char prev = 0;
+
+   for (;;)
+     {
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        fd_set readset;
+        char c;
+
+        FD_ZERO(&readset);
+        FD_SET(STDIN_FILENO, &readset);
+        if (select(STDIN_FILENO + 1, &readset, NULL, NULL, &tv) <= 0)
+          return -1;
+        if (read(STDIN_FILENO, &c, 1) != 1)
+          {
+             if (errno == EINTR)
+               continue;
+             return -1;
+          }
+        if (start[seen])
+          {
+             /* skip anything before the reply */
+             seen = (c == start[seen]) ? seen + 1 : (c == start[0]);
+             continue;
+          }
+        if ((prev == 0x1b) && (c == '\\'))
+          break;
+        if ((prev == 0x1b) && (len < size - 1))
+          reply[len++] = prev;
+        if ((c != 0x1b) && (len < size - 1))
+          reply[len++] = c;
+        prev = c;
+     }
+   reply[len] = '\0';
+   return len;
+}
+
+static int
+_stats_get(Stat *stats, int max)
+{
+   struct termios ttystate, ttysave;
+   char buf[64], reply[8192], *field, *save = NULL;
+   int n = 0;
+
+   if (tcgetattr(STDIN_FILENO, &ttystate))
+     {
+        perror("tcgetattr");
+        return -1;
+     }
+   ttysave = ttystate;
+   ttystate.c_lflag &= ~(ICANON | ECHO);
+   ttystate.c_cc[VMIN] = 1;
+   ttystate.c_cc[VTIME] = 0;
+   if (tcsetattr(STDIN_FILENO, TCSANOW, &ttystate))
+     {
+        perror("tcsetattr");
+        return -1;
+     }
+
+   snprintf(buf, sizeof(buf), "%c}qc", 0x1b);
+   if (ty_write(STDOUT_FILENO, buf, strlen(buf) + 1) < 0)
+     {
+        perror("write");
+        n = -1;
+        goto end;
+     }
+   if (_reply_read(reply, sizeof(reply)) < 0)
+     {
+        fprintf(stderr, "no reply from terminology\n");
+        n = -1;
+        goto end;
+     }
+   for (field = strtok_r(reply, ";", &save); field;
+        field = strtok_r(NULL, ";", &save))
+     {
+        char *sep = strchr(field, '=');
+
+        if ((!sep) || (n >= max))
+          continue;
+        *sep = '\0';
+        snprintf(stats[n].name, sizeof(stats[n].name), "%s", field);
+        stats[n].value = strtod(sep + 1, NULL);
+        n++;
+     }
+
+end:
+   tcsetattr(STDIN_FILENO, TCSANOW, &ttysave);
+   return n;
+}
+
+static double
+_stat_find(const Stat *stats, int n, const char *name)
+{
+   int i;
+
+   for (i = 0; i < n; i++)
+     {
+        if (!strcmp(stats[i].name, name))
+          return stats[i].value;
+     }
+   return 0.0;
+}
+
+static void
+_ratio_print(const char *name, double num, double den, double scale)
+{
+   if (den > 0.0)
+     printf("%-16s %.2f\n", name, num * scale / den);
+}
+
+int
+main(int argc, char **argv)
+{
+   Stat before[STATS_MAX], after[STATS_MAX];
+   int i, n, n0 = 0, interval = 0;
+
+   ON_NOT_RUNNING_IN_TERMINOLOGY_EXIT_1();
+   ARGUMENT_ENTRY_CHECK(argc, argv, print_usage);
+
+   for (i = 1; i < argc; i++)
+     {
+        if ((!strcmp(argv[i], "-i")) && (i + 1 < argc))
+          interval = atoi(argv[++i]);
+        else
+          {
+             print_usage(argv[0]);
+             return EXIT_FAILURE;
+          }
+     }
+
+   if (interval > 0)
+     {
+        n0 = _stats_get(before, STATS_MAX);
+        if (n0 < 0)
+          return EXIT_FAILURE;
+        sleep(interval);
+     }
+   n = _stats_get(after, STATS_MAX);
+   if (n < 0)
+     return EXIT_FAILURE;
+
+   /* counters only grow, show the difference over the interval */
+   for (i = 0; i < n; i++)
+     after[i].value -= _stat_find(before, n0, after[i].name);
+
+   for (i = 0; i < n; i++)
+     {
+        if ((interval > 0) && (after[i].value == 0.0))
+          continue;
+        if (!strcmp(after[i].name, "render.time"))
+          printf("%-16s %.3f\n", after[i].name, after[i].value);
+        else if (interval > 0)
+          printf("%-16s %.0f (%.1f/s)\n", after[i].name, after[i].value,
+                 after[i].value / interval);
+        else
+          printf("%-16s %.0f\n", after[i].name, after[i].value);
+     }
+
+   printf("\n");
+   _ratio_print("reads/wakeup", _stat_find(after, n, "reads"),
+                _stat_find(after, n, "wakeups"), 1.0);
+   _ratio_print("bytes/read", _stat_find(after, n, "bytes"),
+                _stat_find(after, n, "reads"), 1.0);
+   _ratio_print("cells/render", _stat_find(after, n, "render.cells"),
+                _stat_find(after, n, "renders"), 1.0);
+   _ratio_print("ms/render", _stat_find(after, n, "render.time"),
+                _stat_find(after, n, "renders"), 1000.0);
+   return EXIT_SUCCESS;
+}
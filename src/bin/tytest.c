@@ -40,7 +40,18 @@ static struct {
        { "color_parse_edc", tytest_color_parse_edc},
        { "color_parse_css_rgb", tytest_color_parse_css_rgb},
        { "color_parse_css_hsl", tytest_color_parse_css_hsl},
+       { "color_cube", tytest_color_cube},
        { "extn_matching", tytest_extn_matching},
+       { "utf8_decode", tytest_utf8_decode},
+       { "seq_resume", tytest_seq_resume},
+       { "ring", tytest_ring},
+       { "backlog_compress", tytest_backlog_compress},
+       { "backlog_slab", tytest_backlog_slab},
+       { "backlog_index", tytest_backlog_index},
+       { "backlog_disk", tytest_backlog_disk},
+       { "backlog_evict", tytest_backlog_evict},
+       { "atts", tytest_atts},
+       { "ascii_run", tytest_ascii_run},
        { NULL, NULL},
 };
 
@@ -107,7 +118,8 @@ _run_tytests(int argc, char **argv)
 typedef struct _Termpty_Tests
 {
    size_t backsize, backpos;
-   Backlog_Beacon backlog_beacon;
+   /* where the backlog beacon was, kept so that checksums do not change */
+   int unused[2];
    Term_State termstate;
    Term_Cursor cursor_state;
    Term_Cursor cursor_save[2];
@@ -124,7 +136,6 @@ _termpty_to_termpty_tests(Termpty *ty, Termpty_Tests *tt)
    memset(tt, '\0', sizeof(*tt));
    tt->backsize = ty->backsize;
    tt->backpos = ty->backpos;
-   tt->backlog_beacon = ty->backlog_beacon;
    tt->termstate = ty->termstate;
    tt->cursor_state = ty->cursor_state;
    tt->cursor_save[0] = ty->cursor_save[0];
@@ -137,6 +148,24 @@ _termpty_to_termpty_tests(Termpty *ty, Termpty_Tests *tt)
    tt->bracketed_paste = ty->bracketed_paste;
 }
 
+/* Cells are hashed with the attributes their index refers to */
+static void
+_cells_md5_update(MD5_CTX *ctx, const Termpty *ty, const Termcell *cells,
+                  int n)
+{
+   int i;
+
+   for (i = 0; i < n; i++)
+     {
+        MD5Update(ctx,
+                  (unsigned char const*)&cells[i].codepoint,
+                  sizeof(Eina_Unicode));
+        MD5Update(ctx,
+                  (unsigned char const*)termpty_cell_att(ty, &cells[i]),
+                  sizeof(Termatt));
+     }
+}
+
 static void
 _tytest_checksum(Termpty *ty)
 {
@@ -155,12 +184,17 @@ _tytest_checksum(Termpty *ty)
              (unsigned char const*)&tests,
              sizeof(tests));
    /* The screens */
-   MD5Update(&ctx,
-             (unsigned char const*)ty->screen,
-             sizeof(Termcell) * ty->w * ty->h);
-   MD5Update(&ctx,
-             (unsigned char const*)ty->screen2,
-             sizeof(Termcell) * ty->w * ty->h);
+   for (n = 0; n < ty->h; n++)
+     _cells_md5_update(&ctx, ty, ty->screen_rows[n], ty->w);
+   for (n = 0; n < ty->h; n++)
+     _cells_md5_update(&ctx, ty, ty->screen2_rows[n], ty->w);
+   /* True colors the screens refer to */
+   if (ty->truecolor.count)
+     {
+        MD5Update(&ctx,
+                  (unsigned char const*)ty->truecolor.rgb,
+                  sizeof(ty->truecolor.rgb));
+     }
    /* Icon/Title */
    if (ty->prop.icon)
      {
@@ -188,8 +188,10 @@ termio_sel_set(Termio *sd, Eina_Bool enable)
      {
         sd->pty->selection.by_word = EINA_FALSE;
         sd->pty->selection.by_line = EINA_FALSE;
-        free(sd->pty->selection.codepoints);
-        sd->pty->selection.codepoints = NULL;
+        sd->pty->selection.gen = 0;
+        free(sd->pty->selection.rows);
+        sd->pty->selection.rows = NULL;
+        sd->pty->selection.nb_rows = 0;
      }
 }
 void
@@ -404,20 +406,29 @@ _termpty_init(Termpty *ty, Config *config)
    ty->w = TY_W;
    ty->h = TY_H;
    ty->backsize = TY_BACKSIZE;
+   assert(termpty_atts_init(ty));
    termpty_resize_tabs(ty, 0, ty->w);
    termpty_reset_state(ty);
    ty->screen = calloc(1, sizeof(Termcell) * ty->w * ty->h);
    ty->screen2 = calloc(1, sizeof(Termcell) * ty->w * ty->h);
+   ty->screen_rows = malloc(sizeof(Termcell *) * ty->h);
+   ty->screen2_rows = malloc(sizeof(Termcell *) * ty->h);
+   ty->screen_info = calloc(ty->h, sizeof(Termrow));
+   ty->screen2_info = calloc(ty->h, sizeof(Termrow));
    assert(ty->screen);
    assert(ty->screen2);
-   ty->circular_offset = 0;
+   assert(ty->screen_rows);
+   assert(ty->screen2_rows);
+   assert(ty->screen_info);
+   assert(ty->screen2_info);
+   termpty_screen_rows_set(ty->screen_rows, ty->screen, ty->w, ty->h);
+   termpty_screen_rows_set(ty->screen2_rows, ty->screen2, ty->w, ty->h);
+   ty->changes.gen = 1;
    ty->fd = STDIN_FILENO;
    ty->hl.bitmap = calloc(1, HL_LINKS_MAX / 8); /* bit map for 1 << 16 elements */
    assert(ty->hl.bitmap);
    /* Mark id 0 as set */
    ty->hl.bitmap[0] = 1;
-   ty->backlog_beacon.backlog_y = 0;
-   ty->backlog_beacon.screen_y = 0;
 }
 
 void
@@ -426,8 +437,7 @@ tytest_common_main_loop(void)
    do
      {
         char buf[4097];
-        Eina_Unicode codepoint[4097];
-        int i, j;
+        int i;
         char *rbuf = buf;
         int len = sizeof(buf) - 1;
 
@@ -451,40 +461,7 @@ tytest_common_main_loop(void)
         len += rbuf - buf;
 
         buf[len] = 0;
-        // convert UTF8 to codepoint integers
-        j = 0;
-        for (i = 0; i < len;)
-          {
-             int g = 0, prev_i = i;
-
-             if (buf[i])
-               {
-                  g = eina_unicode_utf8_next_get(buf, &i);
-                  if ((0xdc80 <= g) && (g <= 0xdcff) &&
-                      (len - prev_i) <= (int)sizeof(_ty.oldbuf))
-                    {
-                       int k;
-                       for (k = 0;
-                            (k < (int)sizeof(_ty.oldbuf)) &&
-                            (k < (len - prev_i));
-                            k++)
-                         {
-                            _ty.oldbuf[k] = buf[prev_i+k];
-                         }
-                       DBG("failure at %d/%d/%d", prev_i, i, len);
-                       break;
-                    }
-               }
-             else
-               {
-                  g = 0;
-                  i++;
-               }
-             codepoint[j] = g;
-             j++;
-          }
-        codepoint[j] = 0;
-        termpty_handle_buf(&_ty, codepoint, j);
+        termpty_handle_utf8(&_ty, buf, len);
      }
    while (1);
 }
@@ -17,6 +17,17 @@ int tytest_color_parse_uint8(void);
 int tytest_color_parse_edc(void);
 int tytest_color_parse_css_rgb(void);
 int tytest_color_parse_css_hsl(void);
+int tytest_color_cube(void);
 int tytest_extn_matching(void);
+int tytest_utf8_decode(void);
+int tytest_seq_resume(void);
+int tytest_ring(void);
+int tytest_backlog_compress(void);
+int tytest_backlog_slab(void);
+int tytest_backlog_index(void);
+int tytest_backlog_disk(void);
+int tytest_backlog_evict(void);
+int tytest_atts(void);
+int tytest_ascii_run(void);
 
 #endif
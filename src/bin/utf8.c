@@ -1,5 +1,12 @@
 #include "private.h"
 #include "utf8.h"
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 int
 codepoint_to_utf8(Eina_Unicode g, char *txt)
@@ -40,3 +47,196 @@ codepoint_to_utf8(Eina_Unicode g, char *txt)
         return 0;
      }
 }
+
+/* Length of the run of printable ASCII characters (0x20 to 0x7e) at the
+ * start of @s.  This is where most of the bytes coming from the pty are, so
+ * check 32 (AVX2), 16 (SSE2) or 8 (scalar) bytes at once. */
+size_t
+utf8_printable_ascii_span(const char *s, size_t len)
+{
+   size_t i = 0;
+
+#if defined(__AVX2__)
+   const __m256i lo32 = _mm256_set1_epi8(0x1f);
+   const __m256i hi32 = _mm256_set1_epi8(0x7f);
+
+   for (; i + 32 <= len; i += 32)
+     {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        /* signed compares: bytes >= 0x80 are negative so not > 0x1f */
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo32),
+                                      _mm256_cmpgt_epi8(hi32, v));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(ok);
+
+        if (mask != 0xffffffffu)
+          return i + __builtin_ctz(~mask);
+     }
+#endif
+#if defined(__SSE2__)
+   const __m128i lo16 = _mm_set1_epi8(0x1f);
+   const __m128i hi16 = _mm_set1_epi8(0x7f);
+
+   for (; i + 16 <= len; i += 16)
+     {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo16),
+                                   _mm_cmpgt_epi8(hi16, v));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(ok);
+
+        if (mask != 0xffff)
+          return i + __builtin_ctz(~mask);
+     }
+#else
+   for (; i + 8 <= len; i += 8)
+     {
+        uint64_t v;
+
+        memcpy(&v, s + i, sizeof(v));
+        /* any byte < 0x20, == 0x7f or >= 0x80 ends the fast scan */
+        if (((v - 0x2020202020202020ULL) | (v + 0x0101010101010101ULL) | v)
+            & 0x8080808080808080ULL)
+          break;
+     }
+#endif
+   for (; i < len; i++)
+     {
+        unsigned char c = s[i];
+
+        if ((c < 0x20) || (c >= 0x7f))
+          break;
+     }
+   return i;
+}
+
+/* Expand @len ASCII bytes into codepoints */
+void
+utf8_ascii_widen(const char *s, Eina_Unicode *dst, size_t len)
+{
+   size_t i = 0;
+
+#if defined(__SSE2__)
+   const __m128i zero = _mm_setzero_si128();
+
+   for (; i + 16 <= len; i += 16)
+     {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(dst + i + 4),
+                         _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(dst + i + 8),
+                         _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)(dst + i + 12),
+                         _mm_unpackhi_epi16(hi, zero));
+     }
+#endif
+   for (; i < len; i++)
+     dst[i] = (unsigned char)s[i];
+}
+
+#define UTF8_IS_CONTINUATION(_c) (((_c) & 0xc0) == 0x80)
+
+/* Decode the character at *@idx, never reading past @len.
+ * Behaves as eina_unicode_utf8_next_get(): an invalid or truncated sequence
+ * returns 0xdc00 | first byte and only skips that byte. */
+Eina_Unicode
+utf8_codepoint_next_get(const char *s, size_t len, size_t *idx)
+{
+   const unsigned char *p = (const unsigned char *)s + *idx;
+   size_t left = len - *idx;
+   unsigned char d = p[0];
+   Eina_Unicode r, min;
+   size_t n, k;
+
+   if (d < 0x80)
+     {
+        *idx += 1;
+        return d;
+     }
+   if ((d & 0xe0) == 0xc0)
+     {
+        n = 2; r = d & 0x1f; min = 0x80;
+     }
+   else if ((d & 0xf0) == 0xe0)
+     {
+        n = 3; r = d & 0x0f; min = 0x800;
+     }
+   else if ((d & 0xf8) == 0xf0)
+     {
+        n = 4; r = d & 0x07; min = 0x10000;
+     }
+   else if ((d & 0xfc) == 0xf8)
+     {
+        n = 5; r = d & 0x03; min = 0x200000;
+     }
+   else if ((d & 0xfe) == 0xfc)
+     {
+        n = 6; r = d & 0x01; min = 0x4000000;
+     }
+   else
+     goto error;
+
+   if (left < n)
+     goto error;
+   for (k = 1; k < n; k++)
+     {
+        if (!UTF8_IS_CONTINUATION(p[k]))
+          goto error;
+        r = (r << 6) | (p[k] & 0x3f);
+     }
+   if (r < min)
+     goto error;
+   *idx += n;
+   return r;
+
+error:
+   *idx += 1;
+   return 0xdc00 | d;
+}
+
+#if defined(BINARY_TYTEST)
+#include <assert.h>
+
+int
+tytest_utf8_decode(void)
+{
+   const char *txt = "0123456789abcdef0123456789abcdef0123456789abcdef\033[m";
+   const char *mb = "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xc3";
+   Eina_Unicode codepoints[64];
+   size_t idx = 0, len;
+
+   /* printable ascii span */
+   assert(utf8_printable_ascii_span(txt, strlen(txt)) == 48);
+   assert(utf8_printable_ascii_span(txt, 20) == 20);
+   assert(utf8_printable_ascii_span("\x7f" "abc", 4) == 0);
+   assert(utf8_printable_ascii_span("abc\xc3\xa9", 5) == 3);
+   assert(utf8_printable_ascii_span("", 0) == 0);
+
+   utf8_ascii_widen(txt, codepoints, 48);
+   assert(codepoints[0] == '0');
+   assert(codepoints[47] == 'f');
+
+   /* multibyte */
+   len = strlen(mb);
+   assert(utf8_codepoint_next_get(mb, len, &idx) == 0xe9);
+   assert(idx == 2);
+   assert(utf8_codepoint_next_get(mb, len, &idx) == 0x20ac);
+   assert(idx == 5);
+   assert(utf8_codepoint_next_get(mb, len, &idx) == 0x1f600);
+   assert(idx == 9);
+   /* truncated */
+   assert(utf8_codepoint_next_get(mb, len, &idx) == 0xdcc3);
+   assert(idx == 10);
+   /* overlong */
+   idx = 0;
+   assert(utf8_codepoint_next_get("\xc0\xaf", 2, &idx) == 0xdcc0);
+   assert(idx == 1);
+   assert(utf8_codepoint_next_get("\xc0\xaf", 2, &idx) == 0xdcaf);
+   assert(idx == 2);
+
+   return 0;
+}
+#endif
@@ -3,4 +3,8 @@
 #include <Eina.h>
 int codepoint_to_utf8(Eina_Unicode g, char *txt);
 
+size_t utf8_printable_ascii_span(const char *s, size_t len);
+void utf8_ascii_widen(const char *s, Eina_Unicode *dst, size_t len);
+Eina_Unicode utf8_codepoint_next_get(const char *s, size_t len, size_t *idx);
+
 #endif
@@ -6719,6 +6719,26 @@ _cb_send_progress(void *data,
                              termio_file_send_progress_get(term->termio));
 }
 
+static void
+_cb_flood_on(void *data,
+             Evas_Object *_obj EINA_UNUSED,
+             void *_event EINA_UNUSED)
+{
+   Term *term = data;
+
+   elm_layout_signal_emit(term->bg, "flood,on", "terminology");
+}
+
+static void
+_cb_flood_off(void *data,
+              Evas_Object *_obj EINA_UNUSED,
+              void *_event EINA_UNUSED)
+{
+   Term *term = data;
+
+   elm_layout_signal_emit(term->bg, "flood,off", "terminology");
+}
+
 static void
 _cb_send_end(void *data,
              Evas_Object *_obj EINA_UNUSED,
@@ -7491,6 +7511,8 @@ term_new(Win *wn, Config *config, const char *cmd,
    evas_object_smart_callback_add(o, "icon,change", _cb_icon, term);
    evas_object_smart_callback_add(o, "send,progress", _cb_send_progress, term);
    evas_object_smart_callback_add(o, "send,end", _cb_send_end, term);
+   evas_object_smart_callback_add(o, "flood,on", _cb_flood_on, term);
+   evas_object_smart_callback_add(o, "flood,off", _cb_flood_off, term);
    evas_object_show(o);
 
    wn->terms = eina_list_append(wn->terms, term);
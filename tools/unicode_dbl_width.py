@@ -4,22 +4,38 @@
 Generate src/bin/termptydbl.{c,h} from unicode files
 used with ucd.all.flat.xml from
 https://www.unicode.org/Public/UCD/latest/ucdxml/ucd.all.flat.zip
+
+Properties of codepoints are stored as flags in a two-stage table: the
+codepoint's high bits index a block of flags, and identical blocks are
+shared.
 """
 
 import argparse
-from collections import namedtuple
 import xml.etree.ElementTree as ET
 
-URange = namedtuple('unicode_range', ['width', 'start', 'end'])
+UCD_NS = "{http://www.unicode.org/ns/2003/ucd/1.0}"
+CP_MAX = 0x110000
+
+BLOCK_SHIFT = 8
+BLOCK_SIZE = 1 << BLOCK_SHIFT
+
+FLAGS = [
+    ('WIDE', 0x01, "East Asian Wide or Fullwidth"),
+    ('AMBIGUOUS', 0x02, "East Asian Ambiguous"),
+    ('EMOJI', 0x04, "Emoji presentation by default"),
+    ('COMBINING', 0x08, "Combining diacritical mark"),
+    ('ZERO_WIDTH', 0x10, "Zero width space, direction mark or variation selector"),
+]
+F = {name: value for name, value, _ in FLAGS}
 
-def get_ranges(xmlfile, emoji_as_wide):
+def get_flags(xmlfile, emoji_as_wide):
     tree = ET.parse(xmlfile)
     root = tree.getroot()
-    repertoire = root.find("{http://www.unicode.org/ns/2003/ucd/1.0}repertoire")
-    chars = repertoire.findall("{http://www.unicode.org/ns/2003/ucd/1.0}char")
+    repertoire = root.find(UCD_NS + "repertoire")
+    chars = repertoire.findall(UCD_NS + "char")
 
-    ranges = []
-    r = URange('N', 0, 0)
+    flags = bytearray(CP_MAX)
+    prev_cp, prev_ea = 0, 'N'
     for c in chars:
         ea = c.get('ea')
         if ea in ('Na', 'H'):
@@ -28,6 +44,7 @@ def get_ranges(xmlfile, emoji_as_wide):
             ea = 'W'
         cp = c.get('cp')
         if not cp:
+            # ranges of codepoints, as private use ones, are left narrow
             continue
         if emoji_as_wide:
             ext_pic = c.get('ExtPict')
@@ -40,138 +57,106 @@ def get_ranges(xmlfile, emoji_as_wide):
                     ea = 'W'
 
         cp = int(cp, 16)
-        if ea != r[0]:
-            ranges.append(r)
-            r = URange(ea, cp, cp)
-        else:
-            r = r._replace(end=cp)
-
-    ranges.append(r)
-
-    return ranges
-
-def merge_ranges(ranges, is_same_width):
-    res = []
-    cur_range = ranges[0]
-    for r in ranges:
-        if is_same_width(r, cur_range):
-            cur_range = cur_range._replace(end=r.end)
-        else:
-            res.append(cur_range)
-            cur_range = r
-    res.append(cur_range)
-    return res
-
-def skip_ranges(ranges, width_skipped):
-    res = []
-    for r in ranges:
-        if r.width not in width_skipped:
-            res.append(r)
-    return res
-
-def gen_header(cur_range, file_header):
+        # unassigned codepoints between two of the same width share it
+        start = prev_cp + 1 if ea == prev_ea else cp
+        for i in range(start, cp + 1):
+            if ea == 'W':
+                flags[i] |= F['WIDE']
+            elif ea == 'A':
+                flags[i] |= F['AMBIGUOUS']
+        prev_cp, prev_ea = cp, ea
+
+        if c.get('EPres') == 'Y':
+            flags[cp] |= F['EMOJI']
+        # only those have been handled so far
+        blk = c.get('blk')
+        if blk == 'Diacriticals':
+            flags[cp] |= F['COMBINING']
+        if blk == 'VS' or 0x200B <= cp <= 0x200F:
+            flags[cp] |= F['ZERO_WIDTH']
+
+    return flags
+
+def get_tables(flags):
+    last = max(i for i, f in enumerate(flags) if f)
+    nb_blocks = (last >> BLOCK_SHIFT) + 1
+    blocks = []
+    index = []
+    known = {}
+    for b in range(nb_blocks):
+        block = bytes(flags[b * BLOCK_SIZE:(b + 1) * BLOCK_SIZE])
+        if block not in known:
+            known[block] = len(blocks)
+            blocks.append(block)
+        index.append(known[block])
+    assert len(blocks) <= 256
+    return index, blocks
+
+def latin1_end(flags):
+    for i, f in enumerate(flags):
+        if f:
+            return i - 1
+    return CP_MAX - 1
+
+def write_bytes(file_source, values, indent):
+    for i in range(0, len(values), 12):
+        line = ", ".join(f"0x{v:02X}" for v in values[i:i + 12])
+        file_source.write(f"{indent}{line},\n")
+
+def gen_header(flags, nb_index, file_header):
     file_header.write(
 """/* XXX: Code generated by tool unicode_dbl_width.py */
 #ifndef _TERMPTY_DBL_H__
 #define _TERMPTY_DBL_H__ 1
 
-Eina_Bool _termpty_is_wide(const Eina_Unicode g);
-Eina_Bool _termpty_is_ambigous_wide(const Eina_Unicode g);
-
-static inline Eina_Bool
-_termpty_is_dblwidth_get(const Termpty *ty, const Eina_Unicode g)
-{
-   /* optimize for latin1 non-ambiguous */
 """)
-    file_header.write(f"   if (g <= 0x{cur_range.end:X})")
+    for name, value, doc in FLAGS:
+        file_header.write(f"#define TERMPTY_UNICODE_{name} 0x{value:02X} /* {doc} */\n")
     file_header.write(
-"""
+f"""
+#define TERMPTY_UNICODE_BLOCK_SHIFT {BLOCK_SHIFT}
+#define TERMPTY_UNICODE_BLOCKS {nb_index}
+
+extern const uint8_t _termpty_unicode_index[TERMPTY_UNICODE_BLOCKS];
+extern const uint8_t _termpty_unicode_blocks[][1 << TERMPTY_UNICODE_BLOCK_SHIFT];
+
+static inline unsigned int
+_termpty_unicode_flags_get(const Eina_Unicode g)
+{{
+   /* optimize for latin1 */
+   if (g <= 0x{latin1_end(flags):X})
+     return 0;
+   if (g >= (TERMPTY_UNICODE_BLOCKS << TERMPTY_UNICODE_BLOCK_SHIFT))
+     return 0;
+   return _termpty_unicode_blocks
+      [_termpty_unicode_index[g >> TERMPTY_UNICODE_BLOCK_SHIFT]]
+      [g & ((1 << TERMPTY_UNICODE_BLOCK_SHIFT) - 1)];
+}}
+
+static inline Eina_Bool
+_termpty_is_dblwidth_flags(const Termpty *ty, unsigned int flags)
+{{
+   if ((flags & TERMPTY_UNICODE_EMOJI) &&
+       (ty->config) && (!ty->config->emoji_dbl_width))
      return EINA_FALSE;
    if (!ty->termstate.cjk_ambiguous_wide)
-     return _termpty_is_wide(g);
+     return !!(flags & TERMPTY_UNICODE_WIDE);
    else
-     return _termpty_is_ambigous_wide(g);
-}
-
-#endif
-""")
-
-def gen_ambigous(ranges, file_source):
-    file_source.write(
-"""
-__attribute__((const))
-Eina_Bool
-_termpty_is_ambigous_wide(Eina_Unicode g)
-{
-    switch (g)
-      {
-""")
-    def is_same_width(r1, r2):
-        if r1.width == 'N':
-            return r2.width == 'N'
-        else:
-            return r2.width in ('A', 'W')
-    ranges = merge_ranges(ranges[1:], is_same_width)
-    ranges = skip_ranges(ranges, ('N',))
-
-    fallthrough = " EINA_FALLTHROUGH;"
-    for idx, r in enumerate(ranges):
-        if r.width == 'N':
-            continue;
-        if idx == len(ranges) -1:
-            fallthrough = ""
-        if r.start == r.end:
-            file_source.write(f"       case 0x{r.start:X}:{fallthrough}\n")
-        else:
-            file_source.write(f"       case 0x{r.start:X} ... 0x{r.end:X}:{fallthrough}\n")
-
-    file_source.write(
-"""
-        return EINA_TRUE;
-    }
-   return EINA_FALSE;
-}
-""")
+     return !!(flags & (TERMPTY_UNICODE_WIDE | TERMPTY_UNICODE_AMBIGUOUS));
+}}
 
-def gen_wide(ranges, file_source):
-    file_source.write(
-"""
-__attribute__((const))
-Eina_Bool
-_termpty_is_wide(Eina_Unicode g)
-{
-    switch (g)
-      {
-""")
-    def is_same_width(r1, r2):
-        if r1.width in ('N', 'A'):
-            return r2.width in ('N', 'A')
-        else:
-            return r2.width == 'W'
-    ranges = merge_ranges(ranges[1:], is_same_width)
-    ranges = skip_ranges(ranges, ('N', 'A'))
-    fallthrough = " EINA_FALLTHROUGH;"
-    for idx, r in enumerate(ranges):
-        if r.width in ('N', 'A'):
-            continue;
-        if idx == len(ranges) -1:
-            fallthrough = ""
-        if r.start == r.end:
-            file_source.write(f"       case 0x{r.start:X}:{fallthrough}\n")
-        else:
-            file_source.write(f"       case 0x{r.start:X} ... 0x{r.end:X}:{fallthrough}\n")
+static inline Eina_Bool
+_termpty_is_dblwidth_get(const Termpty *ty, const Eina_Unicode g)
+{{
+   return _termpty_is_dblwidth_flags(ty, _termpty_unicode_flags_get(g));
+}}
 
-    file_source.write(
-"""
-        return EINA_TRUE;
-    }
-   return EINA_FALSE;
-}
+#endif
 """)
 
-
-def gen_c(ranges, file_header, file_source):
-    gen_header(ranges[0], file_header)
+def gen_c(flags, file_header, file_source):
+    index, blocks = get_tables(flags)
+    gen_header(flags, len(index), file_header)
     file_source.write(
 """/* XXX: Code generated by tool unicode_dbl_width.py */
 #include "private.h"
@@ -179,9 +164,22 @@ def gen_c(ranges, file_header, file_source):
 #include <Elementary.h>
 #include "termpty.h"
 #include "termptydbl.h"
+
+const uint8_t _termpty_unicode_index[TERMPTY_UNICODE_BLOCKS] =
+{
+""")
+    write_bytes(file_source, index, "   ")
+    file_source.write(
+"""};
+
+const uint8_t _termpty_unicode_blocks[][1 << TERMPTY_UNICODE_BLOCK_SHIFT] =
+{
 """)
-    gen_ambigous(ranges, file_source)
-    gen_wide(ranges, file_source)
+    for block in blocks:
+        file_source.write("     {\n")
+        write_bytes(file_source, block, "        ")
+        file_source.write("     },\n")
+    file_source.write("};\n")
 
 parser = argparse.ArgumentParser(description='Generate code handling different widths of unicode codepoints.')
 parser.add_argument('xml', type=argparse.FileType('r'))
@@ -190,5 +188,5 @@ parser.add_argument('source', type=argparse.FileType('w'))
 
 args = parser.parse_args()
 
-ranges = get_ranges(args.xml, False)
-gen_c(ranges, args.header, args.source)
+flags = get_flags(args.xml, False)
+gen_c(flags, args.header, args.source)